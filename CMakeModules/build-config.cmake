@@ -49,8 +49,16 @@ SET_PROPERTY( CACHE BUILD_UTILS_SPAWN_FASTCGI PROPERTY STRINGS "YES" "NO" )
 SET ( BUILD_UTILS_SPAWN_WTHTTPD "YES" CACHE STRING "" )
 SET_PROPERTY( CACHE BUILD_UTILS_SPAWN_WTHTTPD PROPERTY STRINGS "YES" "NO" )
 
+SET ( BUILD_UTILS_POOL_BENCHMARK "NO" CACHE STRING "" )
+SET_PROPERTY( CACHE BUILD_UTILS_POOL_BENCHMARK PROPERTY STRINGS "YES" "NO" )
+
+SET ( BUILD_UTILS_GEO_SNAPSHOT_CHECK "NO" CACHE STRING "" )
+SET_PROPERTY( CACHE BUILD_UTILS_GEO_SNAPSHOT_CHECK PROPERTY STRINGS "YES" "NO" )
+
 SET ( CORELIB_BIN_NAME "core" CACHE STRING "" )
 SET ( SERVICE_BIN_NAME "subscribe.app" CACHE STRING "" )
 SET ( UTILS_GEOIP_UPDATER_BIN_NAME "geoip-updater" CACHE STRING "" )
 SET ( UTILS_SPAWN_FASTCGI_BIN_NAME "spawn-fastcgi" CACHE STRING "" )
 SET ( UTILS_SPAWN_WTHTTPD_BIN_NAME "spawn-wthttpd" CACHE STRING "" )
+SET ( UTILS_POOL_BENCHMARK_BIN_NAME "pool-benchmark" CACHE STRING "" )
+SET ( UTILS_GEO_SNAPSHOT_CHECK_BIN_NAME "geo-snapshot-check" CACHE STRING "" )
@@ -57,6 +57,58 @@ SET ( PGSQL_DATABASE "blog_subscription_service_production" CACHE STRING "" )
 SET ( PGSQL_USER "blog_subscription_service" CACHE STRING "" )
 SET ( PGSQL_PASSWORD "A_STRONG_SECRET_PASSPHRASE" CACHE STRING "" )
 
+# The pool opens PGSQL_MIN_CONNECTIONS upfront and grows on demand up to
+# PGSQL_MAX_CONNECTIONS. Connections above the minimum which are idle for
+# longer than PGSQL_CONNECTION_IDLE_TIMEOUT or older than
+# PGSQL_CONNECTION_MAX_LIFETIME get closed, checked every half idle timeout.
+# Durations are in milliseconds, zero disables the corresponding limit.
+SET ( PGSQL_MIN_CONNECTIONS "2" CACHE STRING "" )
+SET ( PGSQL_MAX_CONNECTIONS "32" CACHE STRING "" )
+SET ( PGSQL_CONNECTION_IDLE_TIMEOUT "300000" CACHE STRING "" )
+SET ( PGSQL_CONNECTION_MAX_LIFETIME "3600000" CACHE STRING "" )
+
+# Upper bound on the dedicated non-blocking connections behind the
+# asynchronous query API; they are opened on demand.
+SET ( PGSQL_ASYNC_CONNECTIONS "8" CACHE STRING "" )
+
+# Read-only replicas as a list of connection strings separated by '|', e.g.
+# "host=replica1 dbname=... user=... password=...|host=replica2 ..."
+# Leave empty to serve every read from the primary.
+SET ( PGSQL_REPLICA_CONNECTION_STRINGS "" CACHE STRING "" )
+
+# Audit rows are written in the background, a batch at a time, as soon as
+# AUDIT_WRITER_BATCH_SIZE of them are waiting or every
+# AUDIT_WRITER_FLUSH_INTERVAL milliseconds otherwise. Beyond
+# AUDIT_WRITER_MAX_PENDING waiting rows new ones get dropped.
+SET ( AUDIT_WRITER_BATCH_SIZE "256" CACHE STRING "" )
+SET ( AUDIT_WRITER_FLUSH_INTERVAL "250" CACHE STRING "" )
+SET ( AUDIT_WRITER_MAX_PENDING "65536" CACHE STRING "" )
+
+# Queued mails are sent by up to MAIL_MAX_WORKERS threads in parallel, each
+# holding on to its own SMTP connection; they are started as the queue grows
+# and stop once it has been empty for a while.
+SET ( MAIL_MAX_WORKERS "4" CACHE STRING "" )
+
+# With MAIL_SPOOL set, queued mails are kept in the database until sent, so
+# they survive a crash or restart and every instance sharing the database
+# helps sending them. MAIL_MAX_WORKERS threads per instance each lease up to
+# MAIL_SPOOL_BATCH_SIZE mails at a time for MAIL_SPOOL_LEASE_TIMEOUT
+# milliseconds, and look for new ones every MAIL_SPOOL_POLL_INTERVAL
+# milliseconds while idle. A mail failing MAIL_SPOOL_MAX_ATTEMPTS times is
+# left in the spool with its last error.
+SET ( MAIL_SPOOL 0 CACHE STRING "" )
+SET ( MAIL_SPOOL_BATCH_SIZE "16" CACHE STRING "" )
+SET ( MAIL_SPOOL_LEASE_TIMEOUT "300000" CACHE STRING "" )
+SET ( MAIL_SPOOL_POLL_INTERVAL "1000" CACHE STRING "" )
+SET ( MAIL_SPOOL_MAX_ATTEMPTS "8" CACHE STRING "" )
+
+# Newsletter campaigns are sent NEWSLETTER_BATCH_SIZE recipients at a time,
+# each batch leased for NEWSLETTER_LEASE_TIMEOUT milliseconds and renewed every
+# half lease while it is being sent; a process that dies mid-campaign has at
+# most its last batch sent twice.
+SET ( NEWSLETTER_BATCH_SIZE "64" CACHE STRING "" )
+SET ( NEWSLETTER_LEASE_TIMEOUT "600000" CACHE STRING "" )
+
 SET ( GDPR_COMPLIANCE 1 CACHE STRING "" )
 
 SET ( CEREAL_THREAD_SAFE 1 CACHE STRING "" )
@@ -0,0 +1,333 @@
+/**
+ * @file
+ * @author  Mamadou Babaei <info@babaei.net>
+ * @version 0.1.0
+ *
+ * @section LICENSE
+ *
+ * (The MIT License)
+ *
+ * Copyright (c) 2016 - 2021 Mamadou Babaei
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * A background writer that batches audit records per table and flushes them
+ * through COPY, either once enough of them piled up or on a timer, so that
+ * requests never wait for their own audit trail.
+ */
+
+
+#include <atomic>
+#include <unordered_map>
+#include <utility>
+#include <boost/exception/diagnostic_information.hpp>
+#include <boost/format.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include "make_unique.hpp"
+#include "AuditWriter.hpp"
+#include "Log.hpp"
+
+#define     UNKNOWN_ERROR           "Unknown error!"
+
+using namespace std;
+using namespace boost;
+using namespace CoreLib;
+
+struct AuditWriter::Impl
+{
+    struct RecordType
+    {
+        std::string Id;
+        std::vector<std::string> Columns;
+        Mode WriteMode;
+        std::vector<std::string> Keys;
+        std::vector<Record> Pending;
+    };
+
+    struct Batch
+    {
+        std::string Id;
+        std::vector<std::string> Columns;
+        Mode WriteMode;
+        std::vector<std::string> Keys;
+        std::vector<Record> Records;
+    };
+
+    /// Kept in registration order; the index only speeds up the lookups
+    typedef std::vector<RecordType> RecordTypesList;
+    typedef std::unordered_map<std::string, std::size_t> RecordTypesIndex;
+
+    Database &DatabaseInstance;
+    const std::size_t BatchSize;
+    const boost::chrono::milliseconds FlushInterval;
+    const std::size_t MaxPending;
+
+    RecordTypesList RecordTypes;
+    RecordTypesIndex RecordTypeIndices;
+    std::size_t PendingTotal;
+
+    /// Flush() bumps the requested generation and waits for the worker to
+    /// complete a pass that started after it
+    std::uint64_t FlushRequested;
+    std::uint64_t FlushCompleted;
+
+    bool Running;
+    std::unique_ptr<boost::thread> Worker;
+
+    mutable boost::mutex Mutex;
+    boost::condition_variable WorkCondition;
+    boost::condition_variable FlushCondition;
+
+    std::atomic<std::uint64_t> WrittenTotal;
+    std::atomic<std::uint64_t> DroppedTotal;
+
+    Impl(Database &database,
+         const std::size_t batchSize,
+         const boost::chrono::milliseconds &flushInterval,
+         const std::size_t maxPending);
+
+    void DoWork();
+    void WriteBatch(const Batch &batch);
+};
+
+AuditWriter::AuditWriter(Database &database,
+                         const std::size_t batchSize,
+                         const boost::chrono::milliseconds &flushInterval,
+                         const std::size_t maxPending)
+    : m_pimpl(make_unique<AuditWriter::Impl>(database, batchSize, flushInterval, maxPending))
+{
+    m_pimpl->Worker = make_unique<boost::thread>(&AuditWriter::Impl::DoWork, m_pimpl.get());
+}
+
+AuditWriter::~AuditWriter()
+{
+    Stop();
+}
+
+void AuditWriter::Register(const std::string &id,
+                           const std::vector<std::string> &columns,
+                           const Mode mode,
+                           const std::vector<std::string> &keys)
+{
+    boost::lock_guard<boost::mutex> lock(m_pimpl->Mutex);
+    (void)lock;
+
+    auto it = m_pimpl->RecordTypeIndices.find(id);
+    if (it == m_pimpl->RecordTypeIndices.end()) {
+        it = m_pimpl->RecordTypeIndices.emplace(id, m_pimpl->RecordTypes.size()).first;
+        m_pimpl->RecordTypes.emplace_back();
+        m_pimpl->RecordTypes.back().Id = id;
+    }
+
+    auto &type = m_pimpl->RecordTypes[it->second];
+    type.Columns = columns;
+    type.WriteMode = mode;
+    type.Keys = keys;
+}
+
+bool AuditWriter::Write(const std::string &id, Record record)
+{
+    bool notify = false;
+
+    {
+        boost::lock_guard<boost::mutex> lock(m_pimpl->Mutex);
+        (void)lock;
+
+        auto it = m_pimpl->RecordTypeIndices.find(id);
+        if (!m_pimpl->Running || it == m_pimpl->RecordTypeIndices.end()
+                || record.size() != m_pimpl->RecordTypes[it->second].Columns.size()
+                || m_pimpl->PendingTotal >= m_pimpl->MaxPending) {
+            m_pimpl->DroppedTotal.fetch_add(1, std::memory_order_relaxed);
+            LOG_WARNING("Audit record dropped!", id);
+            return false;
+        }
+
+        m_pimpl->RecordTypes[it->second].Pending.push_back(std::move(record));
+        ++m_pimpl->PendingTotal;
+
+        /// The timer takes care of the rest, so only a full batch is worth a wake-up
+        notify = (m_pimpl->PendingTotal == m_pimpl->BatchSize);
+    }
+
+    if (notify)
+        m_pimpl->WorkCondition.notify_one();
+
+    return true;
+}
+
+void AuditWriter::Flush()
+{
+    boost::unique_lock<boost::mutex> lock(m_pimpl->Mutex);
+
+    if (!m_pimpl->Running)
+        return;
+
+    const std::uint64_t generation = ++m_pimpl->FlushRequested;
+    m_pimpl->WorkCondition.notify_one();
+
+    m_pimpl->FlushCondition.wait(lock, [this, generation] {
+        return m_pimpl->FlushCompleted >= generation || !m_pimpl->Running;
+    });
+}
+
+void AuditWriter::Stop()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(m_pimpl->Mutex);
+        (void)lock;
+
+        if (!m_pimpl->Running)
+            return;
+
+        m_pimpl->Running = false;
+    }
+
+    m_pimpl->WorkCondition.notify_one();
+
+    if (m_pimpl->Worker) {
+        m_pimpl->Worker->join();
+        m_pimpl->Worker.reset();
+    }
+
+    m_pimpl->FlushCondition.notify_all();
+}
+
+std::uint64_t AuditWriter::Written() const
+{
+    return m_pimpl->WrittenTotal.load(std::memory_order_relaxed);
+}
+
+std::uint64_t AuditWriter::Dropped() const
+{
+    return m_pimpl->DroppedTotal.load(std::memory_order_relaxed);
+}
+
+std::size_t AuditWriter::Pending() const
+{
+    boost::lock_guard<boost::mutex> lock(m_pimpl->Mutex);
+    (void)lock;
+
+    return m_pimpl->PendingTotal;
+}
+
+AuditWriter::Impl::Impl(Database &database,
+                        const std::size_t batchSize,
+                        const boost::chrono::milliseconds &flushInterval,
+                        const std::size_t maxPending)
+    : DatabaseInstance(database),
+      BatchSize(batchSize > 0 ? batchSize : 1),
+      FlushInterval(flushInterval),
+      MaxPending(maxPending > batchSize ? maxPending : batchSize),
+      PendingTotal(0),
+      FlushRequested(0),
+      FlushCompleted(0),
+      Running(true),
+      WrittenTotal(0),
+      DroppedTotal(0)
+{
+
+}
+
+void AuditWriter::Impl::DoWork()
+{
+    LOG_INFO("Audit writer thread started");
+
+    boost::unique_lock<boost::mutex> lock(Mutex);
+
+    for (;;) {
+        WorkCondition.wait_for(lock, FlushInterval, [this] {
+            return !Running || PendingTotal >= BatchSize || FlushRequested != FlushCompleted;
+        });
+
+        const std::uint64_t generation = FlushRequested;
+        const bool stopping = !Running;
+
+        std::vector<Batch> batches;
+        for (auto &type : RecordTypes) {
+            if (type.Pending.empty())
+                continue;
+
+            batches.push_back(Batch { type.Id, type.Columns, type.WriteMode, type.Keys,
+                                      std::move(type.Pending) });
+            type.Pending.clear();
+        }
+        PendingTotal = 0;
+
+        lock.unlock();
+
+        for (const auto &batch : batches) {
+            WriteBatch(batch);
+        }
+
+        lock.lock();
+
+        FlushCompleted = generation;
+        FlushCondition.notify_all();
+
+        /// Write() rejects everything once stopped, so the last pass drained it all
+        if (stopping)
+            break;
+    }
+
+    LOG_INFO("Audit writer thread stopped");
+}
+
+void AuditWriter::Impl::WriteBatch(const Batch &batch)
+{
+    try {
+        bool succeed = false;
+
+        switch (batch.WriteMode) {
+        case Mode::Insert:
+        case Mode::InsertIgnoreConflicts:
+            succeed = DatabaseInstance.BulkInsert(batch.Id, batch.Columns,
+                                                  batch.Records.begin(), batch.Records.end(),
+                                                  batch.WriteMode == Mode::InsertIgnoreConflicts);
+            break;
+        case Mode::Update:
+            succeed = DatabaseInstance.BulkUpdate(batch.Id, batch.Columns, batch.Keys,
+                                                  batch.Records.begin(), batch.Records.end());
+            break;
+        }
+
+        if (succeed) {
+            WrittenTotal.fetch_add(batch.Records.size(), std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    catch (const boost::exception &ex) {
+        LOG_ERROR(boost::diagnostic_information(ex));
+    }
+
+    catch (const std::exception &ex) {
+        LOG_ERROR(ex.what());
+    }
+
+    catch (...) {
+        LOG_ERROR(UNKNOWN_ERROR);
+    }
+
+    DroppedTotal.fetch_add(batch.Records.size(), std::memory_order_relaxed);
+    LOG_ERROR("Audit batch dropped!", batch.Id, (format("Records: %1%") % batch.Records.size()).str());
+}
@@ -0,0 +1,109 @@
+/**
+ * @file
+ * @author  Mamadou Babaei <info@babaei.net>
+ * @version 0.1.0
+ *
+ * @section LICENSE
+ *
+ * (The MIT License)
+ *
+ * Copyright (c) 2016 - 2021 Mamadou Babaei
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * A background writer that batches audit records per table and flushes them
+ * through COPY, either once enough of them piled up or on a timer, so that
+ * requests never wait for their own audit trail.
+ */
+
+
+#ifndef CORELIB_AUDIT_WRITER_HPP
+#define CORELIB_AUDIT_WRITER_HPP
+
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <boost/chrono/chrono.hpp>
+#include "Database.hpp"
+
+namespace CoreLib {
+class AuditWriter;
+}
+
+class CoreLib::AuditWriter
+{
+public:
+    /// Values in the order of the columns the record's table got registered with
+    typedef Database::BulkRow Record;
+
+    enum class Mode : unsigned char {
+        /// Appends every record
+        Insert,
+        /// Skips records that would violate a unique constraint, e.g. content
+        /// addressed rows written over and over again
+        InsertIgnoreConflicts,
+        /// Fills in rows that have already been inserted elsewhere, matched on
+        /// the key columns; records without a matching row are discarded
+        Update
+    };
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> m_pimpl;
+
+public:
+    /// Once maxPending records are waiting, new ones get dropped instead of
+    /// piling up while the database is unreachable.
+    AuditWriter(Database &database,
+                const std::size_t batchSize,
+                const boost::chrono::milliseconds &flushInterval,
+                const std::size_t maxPending);
+    virtual ~AuditWriter();
+
+    AuditWriter(const AuditWriter &) = delete;
+    AuditWriter &operator=(const AuditWriter &) = delete;
+
+public:
+    /// Batches get written in registration order, so register referenced
+    /// tables first. Keys are only used by Mode::Update.
+    void Register(const std::string &id,
+                  const std::vector<std::string> &columns,
+                  const Mode mode = Mode::Insert,
+                  const std::vector<std::string> &keys = { });
+
+    /// Never touches the database; returns false if the record got dropped
+    bool Write(const std::string &id, Record record);
+
+    /// Blocks until everything written so far has been flushed
+    void Flush();
+    /// Flushes whatever is left and stops the worker thread for good
+    void Stop();
+
+    std::uint64_t Written() const;
+    std::uint64_t Dropped() const;
+    std::size_t Pending() const;
+};
+
+
+#endif /* CORELIB_AUDIT_WRITER_HPP */
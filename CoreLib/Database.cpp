@@ -34,22 +34,51 @@
  */
 
 
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <iterator>
+#include <map>
 #include <sstream>
+#include <stdexcept>
 #include <unordered_map>
 #include <vector>
 #include <cstring>
+#include <functional>
+#include <unistd.h>
 #include <boost/algorithm/string.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/exception/diagnostic_information.hpp>
 #include <boost/format.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <boost/thread/lock_guard.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_lock_guard.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/thread.hpp>
 #include <libpq-fe.h>
 #include <pqxx/pqxx>
 #include "make_unique.hpp"
 #include "Database.hpp"
+#include "Exception.hpp"
+#include "Histogram.hpp"
 #include "Log.hpp"
 #include "SharedObjectPool.hpp"
-
-#define     MAX_DATABASE_CONNECTIONS    16
+#include "Stopwatch.hpp"
+
+#define     MIN_DATABASE_CONNECTIONS        2
+#define     MAX_DATABASE_CONNECTIONS        16
+#define     CONNECTION_ACQUISITION_TIMEOUT  5000        // milliseconds
+#define     CONNECTION_IDLE_TIMEOUT         300000      // milliseconds
+#define     CONNECTION_MAX_LIFETIME         3600000     // milliseconds
+#define     CONNECTION_VALIDATION_THRESHOLD 10000       // milliseconds
+#define     REPLICA_CONNECT_TIMEOUT         2           // seconds
+#define     REPLICA_RETRY_MIN_BACKOFF       1000        // milliseconds
+#define     REPLICA_RETRY_MAX_BACKOFF       60000       // milliseconds
+#define     MIN_REAP_INTERVAL               1000        // milliseconds
+#define     PRIMARY_METRICS_TAG         "PRIMARY"
+#define     REPLICA_METRICS_TAG         "REPLICA"
+#define     ASYNC_METRICS_TAG           "ASYNC"
 #define     QUERY_SUCCEED               "CoreLib::Database ==>  Query succeed!"
 #define     UNKNOWN_ERROR               "Unknow database error!"
 
@@ -59,22 +88,861 @@ using namespace CoreLib;
 
 struct Database::Impl
 {
+    typedef std::unordered_map<std::string, std::string> ExtensionNamesHashTable;
+
     typedef std::unordered_map<std::string, std::string> EnumNamesHashTable;
     typedef std::unordered_map<std::string, std::vector<std::string>> EnumeratorsHashTable;
 
     typedef std::unordered_map<std::string, std::string> TableNamesHashTable;
     typedef std::unordered_map<std::string, std::string> TableFieldsHashTable;
-
+    typedef std::unordered_map<std::string, Durability> TableDurabilityHashTable;
+
+    struct IndexDefinition
+    {
+        std::string Name;
+        std::string TableId;
+        std::string Columns;
+        std::string Include;
+        std::string Predicate;
+        bool Unique;
+    };
+
+    typedef std::unordered_map<std::string, IndexDefinition> IndexesHashTable;
+
+    typedef std::vector<std::pair<std::string, std::string>> StatementsList;
+    typedef std::unordered_map<const pqxx::connection *, std::size_t> PreparedStatementsHashTable;
+
+    /// Reads never open a replica connection themselves; a missing one is
+    /// opened in the background, and a replica that failed to connect is
+    /// left alone for a growing while
+    struct Replica
+    {
+        SharedObjectPool<pqxx::connection> Connections;
+        std::atomic<bool> Growing;
+        std::unique_ptr<boost::thread> Grower;
+        boost::mutex GrowerMutex;
+        std::size_t Failures;
+        /// Steady clock ticks; zero while the replica is healthy
+        std::atomic<boost::chrono::steady_clock::rep> RetryAfter;
+
+        Replica();
+    };
+
+    typedef std::vector<std::unique_ptr<Replica>> ReplicasList;
+
+    struct TagMetrics
+    {
+        Histogram PoolWait;
+        Histogram Execute;
+        Histogram Commit;
+    };
+
+    typedef std::map<std::string, std::unique_ptr<TagMetrics>> MetricsTable;
+
+    struct AsyncRequest
+    {
+        std::string Tag;
+        std::string Query;
+        std::vector<std::string> Params;
+        AsyncPoster Poster;
+        AsyncHandler Handler;
+        Stopwatch<> Watch;
+    };
+
+    typedef std::shared_ptr<AsyncRequest> AsyncRequestPtr;
+
+    /// A libpq connection in non-blocking mode, watched through a duplicate of
+    /// its socket so that asio never closes the descriptor libpq owns
+    struct AsyncConnection
+    {
+        PGconn *Handle;
+        int SocketDescriptor;
+        std::unique_ptr<boost::asio::posix::stream_descriptor> Socket;
+        AsyncRequestPtr Request;
+        std::shared_ptr<pg_result> Result;
+
+        AsyncConnection();
+        ~AsyncConnection();
+    };
+
+    typedef std::shared_ptr<AsyncConnection> AsyncConnectionPtr;
+
+    std::string ConnectionString;
     SharedObjectPool<pqxx::connection> Connections;
     boost::mutex ConnectionsMutex;
 
+    std::size_t MinConnections;
+    std::size_t MaxConnections;
+    boost::chrono::milliseconds IdleTimeout;
+    boost::chrono::milliseconds MaxLifetime;
+
+    /// Replicas only serve read-only connections, each one with its own pool
+    ReplicasList Replicas;
+    std::atomic<std::size_t> NextReplica;
+
+    static thread_local std::size_t PrimaryPins;
+    static thread_local UnitOfWork *CurrentUnit;
+
+    void SetupPool(Database *database,
+                   SharedObjectPool<pqxx::connection> &pool,
+                   const std::string &connectionString);
+    static std::string PoolSummary(const SharedObjectPool<pqxx::connection> &pool);
+
+    void GrowReplica(Replica &replica, const std::size_t index);
+
+    /// The pools only look at their idle connections when one is taken or
+    /// returned, which a quiet instance never does; this thread looks for them
+    std::unique_ptr<boost::thread> Reaper;
+    boost::mutex ReaperMutex;
+    boost::condition_variable ReaperCondition;
+    bool ReaperStopRequested;
+
+    void Reap(const boost::chrono::milliseconds interval);
+
+    /// Statements are kept in registration order, so each connection only
+    /// has to remember how many of them it has already prepared.
+    StatementsList Statements;
+    PreparedStatementsHashTable PreparedStatements;
+    boost::mutex StatementsMutex;
+
+    ExtensionNamesHashTable ExtensionNames;
+
     EnumNamesHashTable EnumNames;
     EnumeratorsHashTable Enumerators;
 
     TableNamesHashTable TableNames;
     TableFieldsHashTable TableFields;
+    TableDurabilityHashTable TableDurability;
+
+    IndexesHashTable Indexes;
+
+    /// Entries are never removed, so a histogram stays valid once handed out
+    /// and recording into it needs no lock at all.
+    MetricsTable Metrics;
+    mutable boost::shared_mutex MetricsMutex;
+
+    Histogram &FindMetric(const Metric metric, const std::string &tag);
+
+    boost::asio::io_service *AsyncService;
+    bool AsyncEnabled;
+    std::size_t MaxAsyncConnections;
+    std::size_t AsyncConnectionsTotal;
+    std::vector<AsyncConnectionPtr> IdleAsyncConnections;
+    /// Busy connections live only in their pending handlers, so DisableAsync
+    /// finds them through here
+    std::vector<std::weak_ptr<AsyncConnection>> OpenAsyncConnections;
+    std::deque<AsyncRequestPtr> PendingAsyncRequests;
+    boost::mutex AsyncMutex;
+
+    /// Everything below runs on the event loop, one step per socket event
+    void AsyncDispatch(const AsyncRequestPtr &request);
+    void AsyncConnect(const AsyncRequestPtr &request);
+    void AsyncPollConnect(const AsyncConnectionPtr &connection,
+                          const PostgresPollingStatusType status);
+    void AsyncSend(const AsyncConnectionPtr &connection);
+    void AsyncFlush(const AsyncConnectionPtr &connection);
+    void AsyncRead(const AsyncConnectionPtr &connection);
+    bool AsyncWatch(const AsyncConnectionPtr &connection);
+    void AsyncWait(const AsyncConnectionPtr &connection, const bool write,
+                   const std::function<void()> &next);
+    void AsyncFinish(const AsyncConnectionPtr &connection, const std::string &error,
+                     const bool broken);
+    void AsyncRelease(const AsyncConnectionPtr &connection, const bool broken);
+    static void AsyncDeliver(const AsyncRequestPtr &request,
+                             const std::shared_ptr<pg_result> &result,
+                             const std::string &error);
 };
 
+Database::Pipeline::Pipeline(pqxx::transaction_base &txn) :
+    m_txn(txn),
+    m_pipeline(txn)
+{
+
+}
+
+Database::Pipeline::~Pipeline()
+{
+
+}
+
+Database::Pipeline::QueryId Database::Pipeline::Queue(const std::string &query)
+{
+    return m_pipeline.insert(query);
+}
+
+pqxx::result Database::Pipeline::Retrieve(const QueryId id)
+{
+    return m_pipeline.retrieve(id);
+}
+
+void Database::Pipeline::Complete()
+{
+    m_pipeline.complete();
+}
+
+Database::Pipeline::QueryId Database::Pipeline::QueueExecute(const std::string &id,
+                                                             const std::vector<std::string> &quotedArgs)
+{
+    stringstream ss;
+    ss << "EXECUTE " << m_txn.quote_name(id);
+
+    if (!quotedArgs.empty()) {
+        ss << " ( " << algorithm::join(quotedArgs, ", ") << " )";
+    }
+
+    ss << ";";
+
+    return m_pipeline.insert(ss.str());
+}
+
+thread_local std::size_t Database::Impl::PrimaryPins = 0;
+thread_local Database::UnitOfWork *Database::Impl::CurrentUnit = nullptr;
+
+void Database::Impl::Reap(const boost::chrono::milliseconds interval)
+{
+    boost::unique_lock<boost::mutex> lock(ReaperMutex);
+
+    while (!ReaperCondition.wait_for(lock, interval, [this] { return ReaperStopRequested; })) {
+        lock.unlock();
+
+        try {
+            Connections.Reap();
+
+            boost::lock_guard<boost::mutex> connectionsLock(ConnectionsMutex);
+            (void)connectionsLock;
+
+            for (auto &replica : Replicas) {
+                replica->Connections.Reap();
+            }
+        }
+
+        catch (const boost::exception &ex) {
+            LOG_ERROR(boost::diagnostic_information(ex));
+        }
+
+        catch (const std::exception &ex) {
+            LOG_ERROR(ex.what());
+        }
+
+        catch (...) {
+            LOG_ERROR(UNKNOWN_ERROR);
+        }
+
+        lock.lock();
+    }
+}
+
+void Database::Impl::SetupPool(Database *database,
+                               SharedObjectPool<pqxx::connection> &pool,
+                               const std::string &connectionString)
+{
+    pool.SetLimits(MinConnections, MaxConnections);
+    pool.SetIdleTimeout(IdleTimeout);
+    pool.SetMaxLifetime(MaxLifetime);
+    pool.SetFactory(std::bind(&Database::Connect, database, connectionString));
+    pool.SetDisposer(std::bind(&Database::Disconnect, database, std::placeholders::_1));
+    pool.SetBorrowValidator(std::bind(&Database::ValidateOnBorrow, database,
+                                      std::placeholders::_1, std::placeholders::_2));
+    pool.SetReturnValidator(std::bind(&Database::ValidateOnReturn, database,
+                                      std::placeholders::_1));
+
+    /// Only the minimum is opened upfront, the rest are opened on demand
+    for (std::size_t i = 0; i < MinConnections; ++i) {
+        try {
+            std::unique_ptr<pqxx::connection> c(database->Connect(connectionString));
+            pool.Add(c);
+        } catch (...) {
+            LOG_FATAL((format("Database connection #%1% failed!") % i).str());
+        }
+    }
+}
+
+Database::Impl::Replica::Replica()
+    : Growing(false),
+      Failures(0),
+      RetryAfter(0)
+{
+
+}
+
+void Database::Impl::GrowReplica(Replica &replica, const std::size_t index)
+{
+    try {
+        /// Given straight back, so the next read finds it idle in the pool
+        auto c(replica.Connections.Acquire(boost::chrono::milliseconds(CONNECTION_ACQUISITION_TIMEOUT)));
+
+        replica.Failures = 0;
+        replica.RetryAfter = 0;
+    } catch (...) {
+        ++replica.Failures;
+
+        const boost::chrono::milliseconds backoff(
+                    std::min<boost::chrono::milliseconds::rep>(
+                        REPLICA_RETRY_MIN_BACKOFF << std::min<std::size_t>(replica.Failures - 1, 6),
+                        REPLICA_RETRY_MAX_BACKOFF));
+        replica.RetryAfter = (boost::chrono::steady_clock::now() + backoff).time_since_epoch().count();
+
+        LOG_WARNING("Replica connection failed! Backing off...", (format("Replica #%1%") % index).str(), (format("Backoff: %1%ms") % backoff.count()).str());
+    }
+
+    replica.Growing = false;
+}
+
+std::string Database::Impl::PoolSummary(const SharedObjectPool<pqxx::connection> &pool)
+{
+    return (format("open=%1% idle=%2% waiters=%3% acquires=%4% cached=%5% locks=%6% contended=%7%")
+            % pool.Total() % pool.Size() % pool.Waiters() % pool.Acquisitions()
+            % pool.CacheHits() % pool.Locks() % pool.Contentions()).str();
+}
+
+Histogram &Database::Impl::FindMetric(const Metric metric, const std::string &tag)
+{
+    TagMetrics *metrics = nullptr;
+
+    {
+        boost::shared_lock_guard<boost::shared_mutex> lock(MetricsMutex);
+        (void)lock;
+
+        auto it = Metrics.find(tag);
+        if (it != Metrics.end()) {
+            metrics = it->second.get();
+        }
+    }
+
+    if (metrics == nullptr) {
+        boost::lock_guard<boost::shared_mutex> lock(MetricsMutex);
+        (void)lock;
+
+        auto &entry = Metrics[tag];
+        if (!entry) {
+            entry = std::make_unique<TagMetrics>();
+        }
+        metrics = entry.get();
+    }
+
+    switch (metric) {
+    case Metric::PoolWait:
+        return metrics->PoolWait;
+    case Metric::Execute:
+        return metrics->Execute;
+    case Metric::Commit:
+    default:
+        return metrics->Commit;
+    }
+}
+
+Database::Impl::AsyncConnection::AsyncConnection() :
+    Handle(nullptr),
+    SocketDescriptor(-1)
+{
+
+}
+
+Database::Impl::AsyncConnection::~AsyncConnection()
+{
+    if (Socket) {
+        boost::system::error_code ec;
+        Socket->close(ec);
+    }
+
+    if (Handle != nullptr) {
+        PQfinish(Handle);
+    }
+}
+
+void Database::Impl::AsyncDispatch(const AsyncRequestPtr &request)
+{
+    AsyncConnectionPtr connection;
+    bool connect = false;
+    bool enabled;
+
+    {
+        boost::lock_guard<boost::mutex> lock(AsyncMutex);
+        (void)lock;
+
+        enabled = AsyncEnabled;
+
+        if (!enabled) {
+            /// Delivered below, outside the lock
+        } else if (!IdleAsyncConnections.empty()) {
+            connection = IdleAsyncConnections.back();
+            IdleAsyncConnections.pop_back();
+            connection->Request = request;
+        } else if (AsyncConnectionsTotal < MaxAsyncConnections) {
+            ++AsyncConnectionsTotal;
+            connect = true;
+        } else {
+            PendingAsyncRequests.push_back(request);
+        }
+    }
+
+    if (!enabled) {
+        LOG_ERROR("Asynchronous database queries are not enabled!", request->Query);
+        AsyncDeliver(request, nullptr, "Asynchronous database queries are not enabled!");
+    } else if (connection) {
+        AsyncService->post([this, connection]() { AsyncSend(connection); });
+    } else if (connect) {
+        AsyncService->post([this, request]() { AsyncConnect(request); });
+    }
+}
+
+void Database::Impl::AsyncConnect(const AsyncRequestPtr &request)
+{
+    AsyncConnectionPtr connection(std::make_shared<AsyncConnection>());
+    connection->Request = request;
+
+    {
+        boost::lock_guard<boost::mutex> lock(AsyncMutex);
+        (void)lock;
+
+        OpenAsyncConnections.erase(std::remove_if(OpenAsyncConnections.begin(), OpenAsyncConnections.end(),
+                                                  [](const std::weak_ptr<AsyncConnection> &c) { return c.expired(); }),
+                                   OpenAsyncConnections.end());
+        OpenAsyncConnections.push_back(connection);
+    }
+
+    connection->Handle = PQconnectStart(ConnectionString.c_str());
+
+    if (connection->Handle == nullptr) {
+        AsyncFinish(connection, "Async database connection failed!", true);
+        return;
+    }
+
+    if (PQstatus(connection->Handle) == CONNECTION_BAD) {
+        AsyncFinish(connection, PQerrorMessage(connection->Handle), true);
+        return;
+    }
+
+    /// libpq wants the socket to become writable before the first poll
+    AsyncPollConnect(connection, PGRES_POLLING_WRITING);
+}
+
+void Database::Impl::AsyncPollConnect(const AsyncConnectionPtr &connection,
+                                      const PostgresPollingStatusType status)
+{
+    switch (status) {
+    case PGRES_POLLING_READING:
+    case PGRES_POLLING_WRITING:
+        AsyncWait(connection, status == PGRES_POLLING_WRITING, [this, connection]() {
+            AsyncPollConnect(connection, PQconnectPoll(connection->Handle));
+        });
+        break;
+
+    case PGRES_POLLING_OK:
+        if (PQsetnonblocking(connection->Handle, 1) != 0) {
+            AsyncFinish(connection, PQerrorMessage(connection->Handle), true);
+            return;
+        }
+
+        {
+            std::size_t total;
+
+            {
+                boost::lock_guard<boost::mutex> lock(AsyncMutex);
+                (void)lock;
+
+                total = AsyncConnectionsTotal;
+            }
+
+            LOG_INFO("Async database connection succeed!", (boost::format("Backend PID: %1%") % PQbackendPID(connection->Handle)).str(), (format("Open Async Connections: %1%") % total).str());
+        }
+
+        AsyncSend(connection);
+        break;
+
+    case PGRES_POLLING_FAILED:
+    default:
+        AsyncFinish(connection, PQerrorMessage(connection->Handle), true);
+        break;
+    }
+}
+
+void Database::Impl::AsyncSend(const AsyncConnectionPtr &connection)
+{
+    const AsyncRequestPtr &request = connection->Request;
+
+    FindMetric(Metric::PoolWait, ASYNC_METRICS_TAG).Record(
+                static_cast<std::uint64_t>(request->Watch.Stop()));
+    request->Watch.Start();
+
+    std::vector<const char *> values;
+    values.reserve(request->Params.size());
+    for (const auto &p : request->Params) {
+        values.push_back(p.c_str());
+    }
+
+    if (PQsendQueryParams(connection->Handle, request->Query.c_str(),
+                          static_cast<int>(values.size()), nullptr,
+                          values.empty() ? nullptr : values.data(),
+                          nullptr, nullptr, 0) == 0) {
+        AsyncFinish(connection, PQerrorMessage(connection->Handle), true);
+        return;
+    }
+
+    AsyncFlush(connection);
+}
+
+void Database::Impl::AsyncFlush(const AsyncConnectionPtr &connection)
+{
+    int flushed = PQflush(connection->Handle);
+
+    if (flushed < 0) {
+        AsyncFinish(connection, PQerrorMessage(connection->Handle), true);
+        return;
+    }
+
+    if (flushed == 0) {
+        /// Input consumed while flushing may already hold the whole result
+        AsyncRead(connection);
+        return;
+    }
+
+    /// The server may stop reading until we read what it sent, so wait for
+    /// either direction; whichever fires first cancels the other one
+    if (!AsyncWatch(connection))
+        return;
+
+    std::shared_ptr<std::atomic<bool>> fired(std::make_shared<std::atomic<bool>>(false));
+    std::function<void(const bool, const boost::system::error_code &)> ready(
+                [this, connection, fired](const bool read, const boost::system::error_code &ec) {
+        if (fired->exchange(true))
+            return;
+
+        if (ec) {
+            AsyncFinish(connection, ec.message(), true);
+            return;
+        }
+
+        boost::system::error_code ignored;
+        connection->Socket->cancel(ignored);
+
+        if (read && PQconsumeInput(connection->Handle) == 0) {
+            AsyncFinish(connection, PQerrorMessage(connection->Handle), true);
+            return;
+        }
+
+        AsyncFlush(connection);
+    });
+
+    connection->Socket->async_wait(boost::asio::posix::stream_descriptor::wait_read,
+                                   [ready](const boost::system::error_code &ec) { ready(true, ec); });
+    connection->Socket->async_wait(boost::asio::posix::stream_descriptor::wait_write,
+                                   [ready](const boost::system::error_code &ec) { ready(false, ec); });
+}
+
+void Database::Impl::AsyncRead(const AsyncConnectionPtr &connection)
+{
+    if (PQconsumeInput(connection->Handle) == 0) {
+        AsyncFinish(connection, PQerrorMessage(connection->Handle), true);
+        return;
+    }
+
+    /// Only the last result of the query is kept, as with pqxx
+    while (PQisBusy(connection->Handle) == 0) {
+        PGresult *result = PQgetResult(connection->Handle);
+
+        if (result == nullptr) {
+            AsyncFinish(connection, "", false);
+            return;
+        }
+
+        connection->Result.reset(result, PQclear);
+    }
+
+    AsyncWait(connection, false, [this, connection]() { AsyncRead(connection); });
+}
+
+bool Database::Impl::AsyncWatch(const AsyncConnectionPtr &connection)
+{
+    const int descriptor = connection->Handle != nullptr ? PQsocket(connection->Handle) : -1;
+
+    if (descriptor < 0) {
+        AsyncFinish(connection, "Async database connection has no socket!", true);
+        return false;
+    }
+
+    /// The socket may change while connecting, e.g. when trying multiple hosts
+    if (!connection->Socket || connection->SocketDescriptor != descriptor) {
+        if (connection->Socket) {
+            boost::system::error_code ec;
+            connection->Socket->close(ec);
+        }
+
+        connection->Socket = std::make_unique<boost::asio::posix::stream_descriptor>(
+                    *AsyncService, ::dup(descriptor));
+        connection->SocketDescriptor = descriptor;
+    }
+
+    return true;
+}
+
+void Database::Impl::AsyncWait(const AsyncConnectionPtr &connection, const bool write,
+                               const std::function<void()> &next)
+{
+    if (!AsyncWatch(connection))
+        return;
+
+    connection->Socket->async_wait(
+                write ? boost::asio::posix::stream_descriptor::wait_write
+                      : boost::asio::posix::stream_descriptor::wait_read,
+                [this, connection, next](const boost::system::error_code &ec) {
+        if (ec) {
+            AsyncFinish(connection, ec.message(), true);
+            return;
+        }
+
+        next();
+    });
+}
+
+void Database::Impl::AsyncFinish(const AsyncConnectionPtr &connection, const std::string &error,
+                                 const bool broken)
+{
+    AsyncRequestPtr request(std::move(connection->Request));
+    std::shared_ptr<pg_result> result(std::move(connection->Result));
+
+    std::string message(error);
+    if (message.empty() && result) {
+        ExecStatusType status = PQresultStatus(result.get());
+        if (status != PGRES_COMMAND_OK && status != PGRES_TUPLES_OK) {
+            message = PQresultErrorMessage(result.get());
+        }
+    }
+
+    if (request) {
+        FindMetric(Metric::Execute, request->Tag).Record(
+                    static_cast<std::uint64_t>(request->Watch.Stop()));
+
+        if (!message.empty()) {
+            LOG_ERROR(message, request->Query);
+        } else {
+            LOG_INFO(QUERY_SUCCEED, request->Query);
+        }
+
+        AsyncDeliver(request, result, message);
+    }
+
+    AsyncRelease(connection, broken
+                 || connection->Handle == nullptr
+                 || PQstatus(connection->Handle) == CONNECTION_BAD);
+}
+
+void Database::Impl::AsyncRelease(const AsyncConnectionPtr &connection, const bool broken)
+{
+    AsyncRequestPtr next;
+
+    {
+        boost::lock_guard<boost::mutex> lock(AsyncMutex);
+        (void)lock;
+
+        if (!AsyncEnabled) {
+            /// DisableAsync already let go of it; it dies with its last handler
+            return;
+        }
+
+        if (!PendingAsyncRequests.empty()) {
+            next = PendingAsyncRequests.front();
+            PendingAsyncRequests.pop_front();
+        }
+
+        if (broken) {
+            /// A broken connection's slot goes to a fresh one if anyone waits
+            if (!next) {
+                --AsyncConnectionsTotal;
+            }
+        } else if (!next) {
+            IdleAsyncConnections.push_back(connection);
+        }
+    }
+
+    if (!next)
+        return;
+
+    if (broken) {
+        AsyncConnect(next);
+    } else {
+        connection->Request = next;
+        AsyncSend(connection);
+    }
+}
+
+void Database::Impl::AsyncDeliver(const AsyncRequestPtr &request,
+                                  const std::shared_ptr<pg_result> &result,
+                                  const std::string &error)
+{
+    try {
+        AsyncResult asyncResult(result, error);
+        AsyncHandler handler(request->Handler);
+
+        if (request->Poster) {
+            request->Poster([handler, asyncResult]() { handler(asyncResult); });
+        } else {
+            handler(asyncResult);
+        }
+    } catch (const std::exception &ex) {
+        LOG_ERROR(ex.what(), request->Query);
+    } catch (...) {
+        LOG_ERROR(UNKNOWN_ERROR, request->Query);
+    }
+}
+
+Database::AsyncResult::AsyncResult(const std::shared_ptr<pg_result> &result, const std::string &error) :
+    m_result(result),
+    m_error(error)
+{
+
+}
+
+Database::AsyncResult::~AsyncResult() = default;
+
+bool Database::AsyncResult::Succeeded() const
+{
+    return m_error.empty() && m_result;
+}
+
+const std::string &Database::AsyncResult::Error() const
+{
+    return m_error;
+}
+
+std::size_t Database::AsyncResult::Rows() const
+{
+    return m_result ? static_cast<std::size_t>(PQntuples(m_result.get())) : 0;
+}
+
+std::size_t Database::AsyncResult::Columns() const
+{
+    return m_result ? static_cast<std::size_t>(PQnfields(m_result.get())) : 0;
+}
+
+std::size_t Database::AsyncResult::AffectedRows() const
+{
+    if (!m_result)
+        return 0;
+
+    const char *tuples = PQcmdTuples(m_result.get());
+    return (tuples != nullptr && *tuples != '\0')
+            ? static_cast<std::size_t>(std::strtoull(tuples, nullptr, 10)) : 0;
+}
+
+bool Database::AsyncResult::IsNull(const std::size_t row, const std::string &column) const
+{
+    const int c = m_result ? PQfnumber(m_result.get(), column.c_str()) : -1;
+    if (c < 0 || row >= Rows())
+        return true;
+
+    return PQgetisnull(m_result.get(), static_cast<int>(row), c) != 0;
+}
+
+std::string Database::AsyncResult::Value(const std::size_t row, const std::size_t column) const
+{
+    if (row >= Rows() || column >= Columns()) {
+        throw std::out_of_range((format("No such field: row #%1%, column #%2%!") % row % column).str());
+    }
+
+    return PQgetvalue(m_result.get(), static_cast<int>(row), static_cast<int>(column));
+}
+
+std::string Database::AsyncResult::Value(const std::size_t row, const std::string &column) const
+{
+    const int c = m_result ? PQfnumber(m_result.get(), column.c_str()) : -1;
+    if (c < 0) {
+        throw std::out_of_range((format("No such column: %1%!") % column).str());
+    }
+
+    return Value(row, static_cast<std::size_t>(c));
+}
+
+Database::PrimaryPin::PrimaryPin()
+{
+    ++Database::Impl::PrimaryPins;
+}
+
+Database::PrimaryPin::~PrimaryPin()
+{
+    --Database::Impl::PrimaryPins;
+}
+
+Database::UnitOfWork::UnitOfWork(Database &database, const Access access)
+    : m_database(database),
+      m_access(access),
+      m_outer(Database::Impl::CurrentUnit),
+      m_joined(nullptr)
+{
+    if (m_outer && (access == Access::ReadOnly || m_outer->m_access == Access::ReadWrite)) {
+        m_joined = m_outer->m_joined ? m_outer->m_joined : m_outer;
+        m_access = m_joined->m_access;
+        return;
+    }
+
+    if (access == Access::ReadWrite) {
+        /// Whatever reads the thread does meanwhile should see these writes
+        m_pin = std::make_unique<PrimaryPin>();
+    }
+
+    m_connection = m_database.Connection(access);
+
+    Database::Impl::CurrentUnit = this;
+}
+
+Database::UnitOfWork::~UnitOfWork()
+{
+    if (m_joined)
+        return;
+
+    /// An uncommitted transaction gets rolled back here, before the
+    /// connection goes back to the pool
+    m_txn.reset();
+    m_connection.reset();
+
+    Database::Impl::CurrentUnit = m_outer;
+}
+
+Database::UnitOfWork *Database::UnitOfWork::Current()
+{
+    return Database::Impl::CurrentUnit;
+}
+
+Database::Access Database::UnitOfWork::GetAccess() const
+{
+    return m_access;
+}
+
+pqxx::transaction_base &Database::UnitOfWork::Transaction()
+{
+    if (m_joined)
+        return m_joined->Transaction();
+
+    if (!m_txn) {
+        if (m_access == Access::ReadOnly) {
+            m_txn = std::make_unique<pqxx::read_transaction>(*m_connection.get());
+        } else {
+            m_txn = std::make_unique<pqxx::work>(*m_connection.get());
+        }
+    }
+
+    return *m_txn.get();
+}
+
+void Database::UnitOfWork::Commit(const std::string &tag,
+                                  const Durability durability)
+{
+    if (m_joined || !m_txn)
+        return;
+
+    m_database.Commit(*m_txn.get(), tag, durability);
+    m_txn.reset();
+}
+
+void Database::UnitOfWork::Rollback()
+{
+    if (m_joined || !m_txn)
+        return;
+
+    m_txn->abort();
+    m_txn.reset();
+}
+
 std::string Database::Escape(const char *begin, const char *end)
 {
     std::string result;
@@ -119,89 +987,335 @@ bool Database::IsTrue(const std::string &value)
 }
 
 Database::Database(const std::string &connectionString) :
+    Database(connectionString,
+             MIN_DATABASE_CONNECTIONS, MAX_DATABASE_CONNECTIONS,
+             boost::chrono::milliseconds(CONNECTION_IDLE_TIMEOUT),
+             boost::chrono::milliseconds(CONNECTION_MAX_LIFETIME))
+{
+
+}
+
+Database::Database(const std::string &connectionString,
+                   const std::size_t minConnections,
+                   const std::size_t maxConnections,
+                   const boost::chrono::milliseconds &idleTimeout,
+                   const boost::chrono::milliseconds &maxLifetime) :
     m_pimpl(make_unique<Database::Impl>())
 {
     boost::lock_guard<boost::mutex> lock(m_pimpl->ConnectionsMutex);
     (void)lock;
 
-    LOG_INFO("Setting up database connections...");
+    LOG_INFO("Setting up database connections...", (format("Min: %1%") % minConnections).str(), (format("Max: %1%") % maxConnections).str(), (format("Idle Timeout: %1%ms") % idleTimeout.count()).str(), (format("Max Lifetime: %1%ms") % maxLifetime.count()).str());
+
+    m_pimpl->ConnectionString = connectionString;
+    m_pimpl->MinConnections = minConnections;
+    m_pimpl->MaxConnections = maxConnections;
+    m_pimpl->IdleTimeout = idleTimeout;
+    m_pimpl->MaxLifetime = maxLifetime;
+    m_pimpl->NextReplica = 0;
+    m_pimpl->AsyncService = nullptr;
+    m_pimpl->AsyncEnabled = false;
+    m_pimpl->MaxAsyncConnections = 0;
+    m_pimpl->AsyncConnectionsTotal = 0;
+
+    m_pimpl->SetupPool(this, m_pimpl->Connections, connectionString);
+
+    /// Half the timeout, so a connection goes at most that much late
+    const boost::chrono::milliseconds reapEvery(
+                (idleTimeout != boost::chrono::milliseconds::zero() ? idleTimeout : maxLifetime) / 2);
+    m_pimpl->ReaperStopRequested = false;
+    if (reapEvery != boost::chrono::milliseconds::zero()) {
+        m_pimpl->Reaper = make_unique<boost::thread>(
+                    &Database::Impl::Reap, m_pimpl.get(),
+                    std::max(reapEvery, boost::chrono::milliseconds(MIN_REAP_INTERVAL)));
+    }
 
-    for (int i = 0; i < MAX_DATABASE_CONNECTIONS; ++i) {
-        try {
-            std::unique_ptr<pqxx::connection> c(
-                        std::make_unique<pqxx::connection>(connectionString));
+    LOG_INFO("Database connections setup successfully!");
+}
 
-            LOG_INFO((format("Database connection #%1% succeed!") % i).str(), (boost::format("Backend PID: %1%") % c->backendpid()).str(), (boost::format("Socket: %1%") % c->sock()).str(), (boost::format("Host Name: %1%") % c->hostname()).str(), (boost::format("Port Number: %1%") % c->port()).str(), (boost::format("Database Name: %1%") % c->dbname()).str(), (boost::format("User Name: %1%") % c->username()).str());
+Database::~Database()
+{
+    if (m_pimpl->Reaper) {
+        {
+            boost::lock_guard<boost::mutex> reaperLock(m_pimpl->ReaperMutex);
+            (void)reaperLock;
 
-            m_pimpl->Connections.Add(c);
-        } catch (const pqxx::sql_error &ex) {
-            LOG_FATAL((format("Database connection #%1% failed!") % i).str(), ex.what());
-        } catch (const std::exception &ex) {
-            LOG_FATAL((format("Database connection #%1% failed!") % i).str(), ex.what());
-        } catch (...) {
-            LOG_FATAL((format("Database connection #%1% failed!") % i).str(), UNKNOWN_ERROR);
+            m_pimpl->ReaperStopRequested = true;
         }
+
+        m_pimpl->ReaperCondition.notify_all();
+        m_pimpl->Reaper->join();
+        m_pimpl->Reaper.reset();
     }
 
-    LOG_INFO("Database connections setup successfully!");
+    boost::lock_guard<boost::mutex> lock(m_pimpl->ConnectionsMutex);
+    (void)lock;
+
+    auto connections(m_pimpl->Connections.Drain());
+
+    for (auto &replica : m_pimpl->Replicas) {
+        boost::lock_guard<boost::mutex> growerLock(replica->GrowerMutex);
+        (void)growerLock;
+
+        if (replica->Grower) {
+            replica->Grower->join();
+            replica->Grower.reset();
+        }
+
+        auto replicaConnections(replica->Connections.Drain());
+        std::move(replicaConnections.begin(), replicaConnections.end(),
+                  std::back_inserter(connections));
+    }
+
+    for (auto &c : connections) {
+        Disconnect(*c.get());
+        c.reset();
+    }
+
+    boost::lock_guard<boost::mutex> asyncLock(m_pimpl->AsyncMutex);
+    (void)asyncLock;
+
+    m_pimpl->IdleAsyncConnections.clear();
 }
 
-Database::~Database()
+void Database::AddReplica(const std::string &connectionString)
 {
     boost::lock_guard<boost::mutex> lock(m_pimpl->ConnectionsMutex);
     (void)lock;
 
-    size_t i = 0;
-    while (!m_pimpl->Connections.Empty()) {
-        try {
-            auto c(m_pimpl->Connections.Pool().top().release());
+    LOG_INFO("Setting up replica connections...", (format("Replica #%1%") % m_pimpl->Replicas.size()).str());
 
-            LOG_INFO((format("Database connection #%1% disconnected successfully!") % i).str(), (boost::format("Backend PID: %1%") % c->backendpid()).str(), (boost::format("Socket: %1%") % c->sock()).str(), (boost::format("Host Name: %1%") % c->hostname()).str(), (boost::format("Port Number: %1%") % c->port()).str(), (boost::format("Database Name: %1%") % c->dbname()).str(), (boost::format("User Name: %1%") % c->username()).str());
+    /// libpq waits for an unreachable host forever by default, which would
+    /// hold up the background connect and shutdown along with it
+    std::string replicaConnectionString(connectionString);
+    if (replicaConnectionString.find("connect_timeout") == std::string::npos) {
+        if (starts_with(replicaConnectionString, "postgresql://")
+                || starts_with(replicaConnectionString, "postgres://")) {
+            replicaConnectionString += (replicaConnectionString.find('?') == std::string::npos ? "?" : "&");
+            replicaConnectionString += (format("connect_timeout=%1%") % REPLICA_CONNECT_TIMEOUT).str();
+        } else {
+            replicaConnectionString += (format(" connect_timeout=%1%") % REPLICA_CONNECT_TIMEOUT).str();
+        }
+    }
 
-            m_pimpl->Connections.Pool().pop();
-            ++i;
-        } catch (const pqxx::sql_error &ex) {
-            LOG_ERROR((format("Failed to disconnect from connection #%1%!") % i).str(), ex.what());
-        } catch (const std::exception &ex) {
-            LOG_ERROR((format("Failed to disconnect from connection #%1%!") % i).str(), ex.what());
-        } catch (...) {
-            LOG_ERROR((format("Failed to disconnect from connection #%1%!") % i).str(), UNKNOWN_ERROR);
+    m_pimpl->Replicas.push_back(std::make_unique<Impl::Replica>());
+    m_pimpl->SetupPool(this, m_pimpl->Replicas.back()->Connections, replicaConnectionString);
+
+    LOG_INFO("Replica connections setup successfully!", (format("Replica #%1%") % (m_pimpl->Replicas.size() - 1)).str());
+}
+
+void Database::EnableAsync(boost::asio::io_service &ioService, const std::size_t maxConnections)
+{
+    boost::lock_guard<boost::mutex> lock(m_pimpl->AsyncMutex);
+    (void)lock;
+
+    m_pimpl->AsyncService = &ioService;
+    m_pimpl->AsyncEnabled = true;
+    m_pimpl->MaxAsyncConnections = maxConnections > 0 ? maxConnections : 1;
+
+    LOG_INFO("Asynchronous database queries enabled!", (format("Max Async Connections: %1%") % m_pimpl->MaxAsyncConnections).str());
+}
+
+void Database::DisableAsync()
+{
+    std::vector<Impl::AsyncConnectionPtr> connections;
+    std::deque<Impl::AsyncRequestPtr> pending;
+
+    {
+        boost::lock_guard<boost::mutex> lock(m_pimpl->AsyncMutex);
+        (void)lock;
+
+        if (!m_pimpl->AsyncEnabled)
+            return;
+
+        m_pimpl->AsyncEnabled = false;
+
+        for (const auto &c : m_pimpl->OpenAsyncConnections) {
+            Impl::AsyncConnectionPtr connection(c.lock());
+            if (connection) {
+                connections.push_back(connection);
+            }
         }
+
+        m_pimpl->OpenAsyncConnections.clear();
+        m_pimpl->IdleAsyncConnections.clear();
+        m_pimpl->AsyncConnectionsTotal = 0;
+        pending.swap(m_pimpl->PendingAsyncRequests);
+    }
+
+    /// Handlers still queued on the stopped event loop keep their connection
+    /// alive; with the socket gone, destroying them later touches neither
+    /// the io_service nor this object
+    for (auto &c : connections) {
+        c->Socket.reset();
+        c->SocketDescriptor = -1;
+
+        if (c->Handle != nullptr) {
+            PQfinish(c->Handle);
+            c->Handle = nullptr;
+        }
+    }
+
+    for (const auto &r : pending) {
+        Impl::AsyncDeliver(r, nullptr, "Asynchronous database queries are disabled!");
     }
+
+    LOG_INFO("Asynchronous database queries disabled!", (format("Closed Async Connections: %1%") % connections.size()).str());
+}
+
+void Database::ExecuteAsync(const std::string &query,
+                            const std::vector<std::string> &params,
+                            const AsyncPoster &poster,
+                            const AsyncHandler &handler)
+{
+    Impl::AsyncRequestPtr request(std::make_shared<Impl::AsyncRequest>());
+    request->Tag = ASYNC_METRICS_TAG;
+    request->Query = query;
+    request->Params = params;
+    request->Poster = poster;
+    request->Handler = handler;
+
+    m_pimpl->AsyncDispatch(request);
+}
+
+void Database::ExecutePreparedAsync(const std::string &id,
+                                    const std::vector<std::string> &params,
+                                    const AsyncPoster &poster,
+                                    const AsyncHandler &handler)
+{
+    /// Async connections are not shared with the pool, so the statement runs
+    /// unnamed instead of through the per-connection prepared plan
+    Impl::AsyncRequestPtr request(std::make_shared<Impl::AsyncRequest>());
+    request->Tag = id;
+    request->Query = GetStatement(id);
+    request->Params = params;
+    request->Poster = poster;
+    request->Handler = handler;
+
+    if (request->Query == "{?}") {
+        LOG_ERROR("Prepared statement is not registered!", id);
+        Impl::AsyncDeliver(request, nullptr, "Prepared statement is not registered!");
+        return;
+    }
+
+    m_pimpl->AsyncDispatch(request);
 }
 
 SharedObjectPool<pqxx::connection>::ptrType Database::Connection()
 {
-    for (;;) {
-        size_t connectionNumber = MAX_DATABASE_CONNECTIONS - m_pimpl->Connections.Size();
+    return Connection(boost::chrono::milliseconds(CONNECTION_ACQUISITION_TIMEOUT));
+}
 
-        try {
-            if (!m_pimpl->Connections.Empty()) {
-                auto c(m_pimpl->Connections.Acquire());
+SharedObjectPool<pqxx::connection>::ptrType Database::Connection(const Access access)
+{
+    return Connection(access, boost::chrono::milliseconds(CONNECTION_ACQUISITION_TIMEOUT));
+}
 
-                LOG_INFO((format("Acquired connection #%1% successfully!") % connectionNumber).str(), (boost::format("Backend PID: %1%") % c->backendpid()).str(), (boost::format("Socket: %1%") % c->sock()).str(), (boost::format("Host Name: %1%") % c->hostname()).str(), (boost::format("Port Number: %1%") % c->port()).str(), (boost::format("Database Name: %1%") % c->dbname()).str(), (boost::format("User Name: %1%") % c->username()).str());
+SharedObjectPool<pqxx::connection>::ptrType Database::Connection(const Access access,
+                                                                 const boost::chrono::milliseconds &timeout)
+{
+    if (access == Access::ReadOnly
+            && !m_pimpl->Replicas.empty()
+            && Impl::PrimaryPins == 0) {
+        const std::size_t count = m_pimpl->Replicas.size();
+        const std::size_t first = m_pimpl->NextReplica++ % count;
+
+        /// Round-robin over the idle connections of the replicas, without
+        /// waiting on any of them or connecting to one; a busy or unreachable
+        /// replica should never delay a read
+        const boost::chrono::steady_clock::rep now =
+                boost::chrono::steady_clock::now().time_since_epoch().count();
+
+        for (std::size_t i = 0; i < count; ++i) {
+            const std::size_t index = (first + i) % count;
+            Impl::Replica &replica = *m_pimpl->Replicas[index];
+
+            if (replica.RetryAfter > now)
+                continue;
+
+            try {
+                Stopwatch<> stopwatch;
+                auto c(replica.Connections.TryAcquire());
+                RecordMetric(Metric::PoolWait, REPLICA_METRICS_TAG, stopwatch.Stop());
+
+                if (!c) {
+                    if (replica.Connections.Total() < m_pimpl->MaxConnections
+                            && !replica.Growing.exchange(true)) {
+                        boost::lock_guard<boost::mutex> lock(replica.GrowerMutex);
+                        (void)lock;
+
+                        /// The previous one is done already, it reset Growing
+                        if (replica.Grower) {
+                            replica.Grower->join();
+                        }
+
+                        replica.Grower = make_unique<boost::thread>(&Impl::GrowReplica, m_pimpl.get(),
+                                                                    std::ref(replica), index);
+                    }
+
+                    continue;
+                }
+
+                LOG_INFO("Acquired replica connection successfully!", (format("Replica #%1%") % index).str(), (boost::format("Backend PID: %1%") % c->backendpid()).str(), (boost::format("Host Name: %1%") % c->hostname()).str(), (boost::format("Port Number: %1%") % c->port()).str());
+
+                PrepareStatements(*c.get());
 
                 return c;
-            } else {
-                LOG_WARNING("No free connection is available! Retrying...");
+            } catch (...) {
+                continue;
             }
-        } catch (const pqxx::sql_error &ex) {
-            LOG_ERROR((format("Connection #%1% acquisition failed!") % connectionNumber).str(), ex.what());
-        } catch (const std::exception &ex) {
-            LOG_ERROR((format("Connection #%1% acquisition failed!") % connectionNumber).str(), ex.what());
-        } catch (const char &ex) {
-            /// To make Clang stop spitting out warnings about the unreached code below
-            (void)ex;
-            break;
-        } catch (...) {
-            LOG_ERROR((format("Connection #%1% acquisition failed!") % connectionNumber).str(), UNKNOWN_ERROR);
         }
+
+        LOG_WARNING("No replica connection is available! Falling back to the primary...");
     }
 
-    /// The execution should never reach here
-    /// Return an empty connection
-    SharedObjectPool<pqxx::connection>::ptrType c;
-    return c;
+    return Connection(timeout);
+}
+
+SharedObjectPool<pqxx::connection>::ptrType Database::Connection(const boost::chrono::milliseconds &timeout)
+{
+    Stopwatch<> stopwatch;
+
+    try {
+        auto c(m_pimpl->Connections.Acquire(timeout));
+        RecordMetric(Metric::PoolWait, PRIMARY_METRICS_TAG, stopwatch.Stop());
+
+        LOG_INFO("Acquired connection successfully!", (format("Open Connections: %1%") % m_pimpl->Connections.Total()).str(), (format("Idle Connections: %1%") % m_pimpl->Connections.Size()).str(), (boost::format("Backend PID: %1%") % c->backendpid()).str(), (boost::format("Socket: %1%") % c->sock()).str(), (boost::format("Host Name: %1%") % c->hostname()).str(), (boost::format("Port Number: %1%") % c->port()).str(), (boost::format("Database Name: %1%") % c->dbname()).str(), (boost::format("User Name: %1%") % c->username()).str());
+
+        PrepareStatements(*c.get());
+
+        return c;
+    } catch (const CoreLib::Exception<std::string> &ex) {
+        /// Timed out waits are exactly the tail we are after
+        RecordMetric(Metric::PoolWait, PRIMARY_METRICS_TAG, stopwatch.Stop());
+        LOG_ERROR("No free connection became available in time!", ex.What(), (format("Timeout: %1%ms") % timeout.count()).str(), (format("Waiters: %1%") % m_pimpl->Connections.Waiters()).str());
+        throw;
+    }
+}
+
+bool Database::CreateExtension(const std::string &id)
+{
+    try {
+        auto c = this->Connection();
+        pqxx::work txn(*c.get());
+
+        pqxx::result r = txn.exec((format("CREATE EXTENSION IF NOT EXISTS \"%1%\";")
+                                   % txn.esc(m_pimpl->ExtensionNames[id])).str());
+
+        LOG_INFO(QUERY_SUCCEED, r.query());
+
+        txn.commit();
+
+        return true;
+    } catch (const pqxx::sql_error &ex) {
+        LOG_ERROR(ex.what(), ex.query());
+    } catch (const std::exception &ex) {
+        LOG_ERROR(ex.what());
+    } catch (...) {
+        LOG_ERROR(UNKNOWN_ERROR);
+    }
+
+    return false;
 }
 
 bool Database::CreateEnum(const std::string &id)
@@ -248,19 +1362,85 @@ bool Database::CreateEnum(const std::string &id)
     return false;
 }
 
-bool Database::CreateTable(const std::string &id)
-{
-    try {
-        auto c = this->Connection();
-        pqxx::work txn(*c.get());
+bool Database::CreateTable(const std::string &id)
+{
+    try {
+        auto c = this->Connection();
+        pqxx::work txn(*c.get());
+
+        pqxx::result r = txn.exec((format("CREATE TABLE IF NOT EXISTS \"%1%\" ( %2% );")
+                  % txn.esc(m_pimpl->TableNames[id])
+                  % m_pimpl->TableFields[id]).str());
+
+        LOG_INFO(QUERY_SUCCEED, r.query());
+
+        txn.commit();
+
+        return true;
+    } catch (const pqxx::sql_error &ex) {
+        LOG_ERROR(ex.what(), ex.query());
+    } catch (const std::exception &ex) {
+        LOG_ERROR(ex.what());
+    } catch (...) {
+        LOG_ERROR(UNKNOWN_ERROR);
+    }
+
+    return false;
+}
+
+bool Database::CreateIndex(const std::string &id)
+{
+    try {
+        auto it = m_pimpl->Indexes.find(id);
+        if (it == m_pimpl->Indexes.end()) {
+            LOG_ERROR("Index is not registered!", id);
+            return false;
+        }
+
+        const Impl::IndexDefinition &index = it->second;
+
+        /// CREATE INDEX CONCURRENTLY refuses to run inside a transaction block
+        auto c = this->Connection();
+        pqxx::nontransaction txn(*c.get());
+
+        const string name(txn.quote_name(index.Name));
+
+        pqxx::result r = txn.exec_params("SELECT indisvalid FROM pg_index"
+                                         " WHERE indexrelid = to_regclass($1);", name);
+
+        if (!r.empty()) {
+            if (r[0][0].as<bool>()) {
+                return true;
+            }
+
+            LOG_WARNING("Found an invalid index left over by an interrupted build! Rebuilding...", index.Name);
+
+            r = txn.exec((format("DROP INDEX CONCURRENTLY IF EXISTS %1%;") % name).str());
+
+            LOG_INFO(QUERY_SUCCEED, r.query());
+        }
+
+        stringstream ss;
+        ss << (format("CREATE %1%INDEX CONCURRENTLY IF NOT EXISTS %2% ON \"%3%\" ( %4% )")
+               % (index.Unique ? "UNIQUE " : "")
+               % name
+               % txn.esc(m_pimpl->TableNames[index.TableId])
+               % index.Columns).str();
+
+        if (!index.Include.empty()) {
+            ss << (format(" INCLUDE ( %1% )") % index.Include).str();
+        }
+
+        if (!index.Predicate.empty()) {
+            ss << (format(" WHERE %1%") % index.Predicate).str();
+        }
 
-        pqxx::result r = txn.exec((format("CREATE TABLE IF NOT EXISTS \"%1%\" ( %2% );")
-                  % txn.esc(m_pimpl->TableNames[id])
-                  % m_pimpl->TableFields[id]).str());
+        ss << ";";
 
-        LOG_INFO(QUERY_SUCCEED, r.query());
+        Stopwatch<> stopwatch;
+        r = txn.exec(ss.str());
 
-        txn.commit();
+        LOG_INFO(QUERY_SUCCEED, r.query(), (format("Elapsed: %1%s") % (stopwatch.Stop() / 1000000.0)).str());
 
         return true;
     } catch (const pqxx::sql_error &ex) {
@@ -330,114 +1510,155 @@ bool Database::RenameTable(const std::string &id, const std::string &newName)
     return false;
 }
 
-bool Database::Insert(const std::string &id,
-                      const std::string &fields,
-                      const std::initializer_list<std::string> &args)
+bool Database::BulkInsert(const std::string &id,
+                          const std::vector<std::string> &columns,
+                          const BulkRowGenerator &generator,
+                          const bool ignoreConflicts,
+                          BulkInsertStats *stats)
+{
+    return BulkCopy(id, columns, { },
+                    ignoreConflicts ? BulkMode::InsertIgnoreConflicts : BulkMode::Insert,
+                    generator, stats);
+}
+
+bool Database::BulkUpdate(const std::string &id,
+                          const std::vector<std::string> &columns,
+                          const std::vector<std::string> &keys,
+                          const BulkRowGenerator &generator,
+                          BulkInsertStats *stats)
+{
+    return BulkCopy(id, columns, keys, BulkMode::Update, generator, stats);
+}
+
+bool Database::BulkCopy(const std::string &id,
+                        const std::vector<std::string> &columns,
+                        const std::vector<std::string> &keys,
+                        const BulkMode mode,
+                        const BulkRowGenerator &generator,
+                        BulkInsertStats *stats)
 {
+    Stopwatch<> stopwatch;
+    std::size_t rows = 0;
+    std::size_t inserted = 0;
+
     try {
         auto c = this->Connection();
         pqxx::work txn(*c.get());
 
-        stringstream ss;
-        ss << (format("INSERT INTO \"%1%\" ( %2% ) VALUES ( ")
-               % txn.esc(m_pimpl->TableNames[id])
-               % txn.esc(fields)).str();
-
-        size_t i = 0;
-        for(const auto &arg : args) {
-            if (i != 0) {
-                ss << ", ";
-            }
-            ss << txn.quote(arg);
-            ++i;
-        }
-
-        ss << ");";
+        const string table(m_pimpl->TableNames[id]);
+        const string fields(algorithm::join(columns, ", "));
 
-        pqxx::result r = txn.exec(ss.str());
-
-        LOG_INFO(QUERY_SUCCEED, r.query());
+        /// Conflicts cannot be skipped by COPY itself, so rows get copied into
+        /// a throw-away table first and moved over with INSERT ... ON CONFLICT.
+        string target(table);
+        if (mode == BulkMode::InsertIgnoreConflicts) {
+            target = (format("%1%_bulk") % table).str();
 
-        txn.commit();
+            txn.exec((format("CREATE TEMPORARY TABLE \"%1%\""
+                             " ( LIKE \"%2%\" INCLUDING DEFAULTS ) ON COMMIT DROP;")
+                      % txn.esc(target)
+                      % txn.esc(table)).str());
+        }
 
-        return true;
-    } catch (const pqxx::sql_error &ex) {
-        LOG_ERROR(ex.what(), ex.query());
-    } catch (const std::exception &ex) {
-        LOG_ERROR(ex.what());
-    } catch (...) {
-        LOG_ERROR(UNKNOWN_ERROR);
-    }
+        /// Updates only carry some of the columns, so the throw-away table
+        /// must not inherit the NOT NULL constraints of the rest.
+        string set;
+        string match;
+        if (mode == BulkMode::Update) {
+            for (const auto &column : columns) {
+                if (std::find(keys.begin(), keys.end(), column) != keys.end()) {
+                    match += (match.empty() ? "" : " AND ")
+                            + (format("t.%1% = s.%1%") % txn.esc(column)).str();
+                } else {
+                    set += (set.empty() ? "" : ", ")
+                            + (format("%1% = s.%1%") % txn.esc(column)).str();
+                }
+            }
 
-    return false;
-}
+            if (match.empty() || set.empty()) {
+                throw std::invalid_argument("Bulk updates need both key and value columns!");
+            }
 
-bool Database::Update(const std::string &id,
-                      const std::string &where,
-                      const std::string &value,
-                      const std::string &set,
-                      const std::initializer_list<std::string> &args)
-{
-    try {
-        auto c = this->Connection();
-        pqxx::work txn(*c.get());
+            target = (format("%1%_bulk") % table).str();
 
-        string processedSet;
-        for(const auto &arg : args) {
-            processedSet = boost::replace_nth_copy(set, "?", 0, txn.quote(arg));
+            txn.exec((format("CREATE TEMPORARY TABLE \"%1%\" ON COMMIT DROP"
+                             " AS SELECT %3% FROM \"%2%\" WITH NO DATA;")
+                      % txn.esc(target)
+                      % txn.esc(table)
+                      % txn.esc(fields)).str());
         }
 
-        pqxx::result r = txn.exec((format("UPDATE ONLY \"%1%\" SET %2% WHERE \"%3%\" = %4%;")
-                  % txn.esc(m_pimpl->TableNames[id])
-                  % processedSet
-                  % txn.esc(where)
-                  % txn.quote(value)).str());
+        {
+            pqxx::stream_to stream(txn, target, columns);
 
-        LOG_INFO(QUERY_SUCCEED, r.query());
+            BulkRow row;
+            while (generator(row)) {
+                if (row.size() != columns.size()) {
+                    throw std::invalid_argument((format("Row #%1% has %2% values instead of %3%!")
+                                                 % rows % row.size() % columns.size()).str());
+                }
 
-        txn.commit();
+                stream.write_row(row);
+                row.clear();
+                ++rows;
+            }
 
-        return true;
-    } catch (const pqxx::sql_error &ex) {
-        LOG_ERROR(ex.what(), ex.query());
-    } catch (const std::exception &ex) {
-        LOG_ERROR(ex.what());
-    } catch (...) {
-        LOG_ERROR(UNKNOWN_ERROR);
-    }
+            stream.complete();
+        }
 
-    return false;
-}
+        inserted = rows;
+
+        if (mode == BulkMode::InsertIgnoreConflicts) {
+            pqxx::result r = txn.exec((format("INSERT INTO \"%1%\" ( %3% )"
+                                              " SELECT %3% FROM \"%2%\""
+                                              " ON CONFLICT DO NOTHING;")
+                                       % txn.esc(table)
+                                       % txn.esc(target)
+                                       % txn.esc(fields)).str());
+            inserted = static_cast<std::size_t>(r.affected_rows());
+        } else if (mode == BulkMode::Update) {
+            pqxx::result r = txn.exec((format("UPDATE \"%1%\" AS t SET %3%"
+                                              " FROM \"%2%\" AS s WHERE %4%;")
+                                       % txn.esc(table)
+                                       % txn.esc(target)
+                                       % set
+                                       % match).str());
+            inserted = static_cast<std::size_t>(r.affected_rows());
+        }
 
-bool Database::Delete(const std::string &id,
-                      const std::string &where,
-                      const std::string &value)
-{
-    try {
-        auto c = this->Connection();
-        pqxx::work txn(*c.get());
+        RecordMetric(Metric::Execute, id, stopwatch.Stop());
+        Commit(txn, id, GetTableDurability(id));
 
-        pqxx::result r = txn.exec((format("DELETE FROM ONLY \"%1%\" WHERE \"%2%\"=%3%;")
-                  % txn.esc(m_pimpl->TableNames[id])
-                  % txn.esc(where)
-                  % txn.quote(value)).str());
+        const double elapsed = stopwatch.Stop() / 1000000.0;
+        const double rate = elapsed > 0.0 ? rows / elapsed : 0.0;
 
-        LOG_INFO(QUERY_SUCCEED, r.query());
+        LOG_INFO(mode == BulkMode::Update ? "Bulk update succeed!" : "Bulk insert succeed!", table, (format("Rows: %1%") % rows).str(), (format("Inserted: %1%") % inserted).str(), (format("Elapsed: %1%s") % elapsed).str(), (format("Rows/Second: %1%") % rate).str());
 
-        txn.commit();
+        if (stats) {
+            stats->Rows = rows;
+            stats->Inserted = inserted;
+            stats->ElapsedSeconds = elapsed;
+            stats->RowsPerSecond = rate;
+        }
 
         return true;
     } catch (const pqxx::sql_error &ex) {
-        LOG_ERROR(ex.what(), ex.query());
+        LOG_ERROR(ex.what(), ex.query(), (format("Row: %1%") % rows).str());
     } catch (const std::exception &ex) {
-        LOG_ERROR(ex.what());
+        LOG_ERROR(ex.what(), (format("Row: %1%") % rows).str());
     } catch (...) {
-        LOG_ERROR(UNKNOWN_ERROR);
+        LOG_ERROR(UNKNOWN_ERROR, (format("Row: %1%") % rows).str());
     }
 
     return false;
 }
 
+void Database::RegisterExtension(const std::string &id,
+                                 const std::string &name)
+{
+    m_pimpl->ExtensionNames[id] = name;
+}
+
 void Database::RegisterEnum(const std::string &id,
                             const std::string &name,
                             const std::initializer_list<std::string> &enumerators)
@@ -454,6 +1675,17 @@ void Database::RegisterTable(const std::string &id,
     m_pimpl->TableFields[id] = fields;
 }
 
+void Database::RegisterIndex(const std::string &id,
+                             const std::string &name,
+                             const std::string &tableId,
+                             const std::string &columns,
+                             const std::string &include,
+                             const std::string &predicate,
+                             const bool unique)
+{
+    m_pimpl->Indexes[id] = { name, tableId, columns, include, predicate, unique };
+}
+
 std::string Database::GetTableName(const std::string &id) const
 {
     if (m_pimpl->TableNames.find(id) != m_pimpl->TableNames.end()) {
@@ -494,11 +1726,399 @@ bool Database::SetTableFields(const std::string &id, const std::string &fields)
     return false;
 }
 
+Database::Durability Database::GetTableDurability(const std::string &id) const
+{
+    auto it = m_pimpl->TableDurability.find(id);
+    if (it != m_pimpl->TableDurability.end()) {
+        return it->second;
+    }
+
+    return Durability::Full;
+}
+
+void Database::SetTableDurability(const std::string &id, const Durability durability)
+{
+    m_pimpl->TableDurability[id] = durability;
+}
+
+void Database::RegisterStatement(const std::string &id,
+                                 const std::string &query)
+{
+    boost::lock_guard<boost::mutex> lock(m_pimpl->StatementsMutex);
+    (void)lock;
+
+    for (const auto &s : m_pimpl->Statements) {
+        if (s.first == id) {
+            LOG_ERROR("Prepared statement is already registered!", id);
+            return;
+        }
+    }
+
+    m_pimpl->Statements.push_back({ id, query });
+}
+
+std::string Database::GetStatement(const std::string &id) const
+{
+    boost::lock_guard<boost::mutex> lock(m_pimpl->StatementsMutex);
+    (void)lock;
+
+    for (const auto &s : m_pimpl->Statements) {
+        if (s.first == id) {
+            return s.second;
+        }
+    }
+
+    return "{?}";
+}
+
+bool Database::Execute(const std::string &id,
+                       const std::function<pqxx::result(pqxx::transaction_base &)> &query)
+{
+    UnitOfWork *unit = UnitOfWork::Current();
+    if (unit && unit->GetAccess() != Access::ReadWrite)
+        unit = nullptr;
+
+    try {
+        if (unit) {
+            Stopwatch<> stopwatch;
+            pqxx::result r = query(unit->Transaction());
+            RecordMetric(Metric::Execute, id, stopwatch.Stop());
+
+            LOG_INFO(QUERY_SUCCEED, r.query());
+
+            return true;
+        }
+
+        auto c = this->Connection();
+        pqxx::work txn(*c.get());
+
+        Stopwatch<> stopwatch;
+        pqxx::result r = query(txn);
+        RecordMetric(Metric::Execute, id, stopwatch.Stop());
+
+        LOG_INFO(QUERY_SUCCEED, r.query());
+
+        Commit(txn, id, GetTableDurability(id));
+
+        return true;
+    } catch (const pqxx::sql_error &ex) {
+        LOG_ERROR(ex.what(), ex.query());
+        if (unit)
+            throw;
+    } catch (const std::exception &ex) {
+        LOG_ERROR(ex.what());
+        if (unit)
+            throw;
+    } catch (...) {
+        LOG_ERROR(UNKNOWN_ERROR);
+        if (unit)
+            throw;
+    }
+
+    return false;
+}
+
+bool Database::MatchesArity(const std::string &id,
+                            const std::string &text,
+                            const std::size_t expected,
+                            const std::size_t actual) const
+{
+    if (expected != actual) {
+        LOG_ERROR("The number of values does not match the query!", id, text, (format("Expected: %1%") % expected).str(), (format("Actual: %1%") % actual).str());
+        return false;
+    }
+
+    return true;
+}
+
+std::string Database::InsertQuery(pqxx::transaction_base &txn,
+                                  const std::string &id,
+                                  const std::string &fields,
+                                  const std::size_t count) const
+{
+    stringstream ss;
+    ss << (format("INSERT INTO \"%1%\" ( %2% ) VALUES ( ")
+           % txn.esc(m_pimpl->TableNames[id])
+           % txn.esc(fields)).str();
+
+    for (std::size_t i = 1; i <= count; ++i) {
+        if (i != 1) {
+            ss << ", ";
+        }
+        ss << "$" << i;
+    }
+
+    ss << " );";
+
+    return ss.str();
+}
+
+std::string Database::UpdateQuery(pqxx::transaction_base &txn,
+                                  const std::string &id,
+                                  const std::string &where,
+                                  const std::string &set) const
+{
+    /// The WHERE value comes after the ones of the SET clause
+    std::size_t index = 0;
+    const std::string processedSet(NumberPlaceholders(set, index));
+
+    return (format("UPDATE ONLY \"%1%\" SET %2% WHERE \"%3%\" = $%4%;")
+            % txn.esc(m_pimpl->TableNames[id])
+            % processedSet
+            % txn.esc(where)
+            % (index + 1)).str();
+}
+
+std::string Database::UpsertQuery(pqxx::transaction_base &txn,
+                                  const std::string &id,
+                                  const std::string &fields,
+                                  const std::string &values,
+                                  const std::string &conflict,
+                                  const std::string &update,
+                                  const std::string &returning) const
+{
+    std::size_t index = 0;
+
+    stringstream ss;
+    ss << (format("INSERT INTO \"%1%\" ( %2% ) VALUES ( %3% )")
+           % txn.esc(m_pimpl->TableNames[id])
+           % txn.esc(fields)
+           % NumberPlaceholders(values, index)).str();
+
+    if (!conflict.empty()) {
+        if (update.empty()) {
+            ss << (format(" ON CONFLICT ( %1% ) DO NOTHING") % txn.esc(conflict)).str();
+        } else {
+            ss << (format(" ON CONFLICT ( %1% ) DO UPDATE SET %2%")
+                   % txn.esc(conflict)
+                   % NumberPlaceholders(update, index)).str();
+        }
+    }
+
+    if (!returning.empty()) {
+        ss << " RETURNING " << txn.esc(returning);
+    }
+
+    ss << ";";
+
+    return ss.str();
+}
+
+std::string Database::NumberPlaceholders(const std::string &sql, std::size_t &index)
+{
+    /// Turn every '?' into $n, carrying on from index
+    std::string processed;
+    processed.reserve(sql.size() + 16);
+
+    for (const char c : sql) {
+        if (c == '?') {
+            processed += "$";
+            processed += std::to_string(++index);
+        } else {
+            processed += c;
+        }
+    }
+
+    return processed;
+}
+
+std::string Database::DeleteQuery(pqxx::transaction_base &txn,
+                                  const std::string &id,
+                                  const std::string &where) const
+{
+    return (format("DELETE FROM ONLY \"%1%\" WHERE \"%2%\" = $1;")
+            % txn.esc(m_pimpl->TableNames[id])
+            % txn.esc(where)).str();
+}
+
+void Database::Commit(pqxx::transaction_base &txn, const std::string &tag,
+                      const Durability durability)
+{
+    Stopwatch<> stopwatch;
+
+    /// Scoped to this transaction only; the connection goes back to the pool
+    /// with the server default
+    if (durability == Durability::Relaxed)
+        txn.exec("SET LOCAL synchronous_commit TO OFF;");
+
+    txn.commit();
+    RecordMetric(Metric::Commit, tag, stopwatch.Stop());
+}
+
+void Database::RecordMetric(const Metric metric, const std::string &tag, const double microseconds)
+{
+    m_pimpl->FindMetric(metric, tag).Record(
+                microseconds > 0.0 ? static_cast<std::uint64_t>(microseconds) : 0);
+}
+
+const Histogram &Database::GetMetric(const Metric metric, const std::string &tag)
+{
+    return m_pimpl->FindMetric(metric, tag);
+}
+
+std::string Database::DumpMetrics() const
+{
+    boost::shared_lock_guard<boost::shared_mutex> lock(m_pimpl->MetricsMutex);
+    (void)lock;
+
+    stringstream ss;
+    ss << "Database latencies (us):";
+
+    for (const auto &m : m_pimpl->Metrics) {
+        const std::pair<const char *, const Histogram *> histograms[] = {
+            { "wait", &m.second->PoolWait },
+            { "execute", &m.second->Execute },
+            { "commit", &m.second->Commit }
+        };
+
+        for (const auto &h : histograms) {
+            if (h.second->Count() > 0) {
+                ss << std::endl << m.first << " " << h.first << " " << h.second->Summary();
+            }
+        }
+    }
+
+    ss << std::endl << "Connection pools:";
+    ss << std::endl << PRIMARY_METRICS_TAG << " " << Impl::PoolSummary(m_pimpl->Connections);
+    for (std::size_t i = 0; i < m_pimpl->Replicas.size(); ++i) {
+        ss << std::endl << REPLICA_METRICS_TAG << " #" << i << " "
+           << Impl::PoolSummary(m_pimpl->Replicas[i]->Connections);
+    }
+
+    return ss.str();
+}
+
+std::unique_ptr<pqxx::connection> Database::Connect(const std::string &connectionString)
+{
+    try {
+        std::unique_ptr<pqxx::connection> c(
+                    std::make_unique<pqxx::connection>(connectionString));
+
+        LOG_INFO("Database connection succeed!", (boost::format("Backend PID: %1%") % c->backendpid()).str(), (boost::format("Socket: %1%") % c->sock()).str(), (boost::format("Host Name: %1%") % c->hostname()).str(), (boost::format("Port Number: %1%") % c->port()).str(), (boost::format("Database Name: %1%") % c->dbname()).str(), (boost::format("User Name: %1%") % c->username()).str());
+
+        return c;
+    } catch (const pqxx::sql_error &ex) {
+        LOG_ERROR("Database connection failed!", ex.what());
+        throw;
+    } catch (const std::exception &ex) {
+        LOG_ERROR("Database connection failed!", ex.what());
+        throw;
+    } catch (...) {
+        LOG_ERROR("Database connection failed!", UNKNOWN_ERROR);
+        throw;
+    }
+}
+
+void Database::Disconnect(pqxx::connection &connection)
+{
+    {
+        boost::lock_guard<boost::mutex> lock(m_pimpl->StatementsMutex);
+        (void)lock;
+
+        /// A new connection might end up at the very same address
+        m_pimpl->PreparedStatements.erase(&connection);
+    }
+
+    try {
+        LOG_INFO("Database connection disconnected successfully!", (boost::format("Backend PID: %1%") % connection.backendpid()).str(), (boost::format("Socket: %1%") % connection.sock()).str(), (boost::format("Host Name: %1%") % connection.hostname()).str(), (boost::format("Port Number: %1%") % connection.port()).str(), (boost::format("Database Name: %1%") % connection.dbname()).str(), (boost::format("User Name: %1%") % connection.username()).str());
+    } catch (const std::exception &ex) {
+        LOG_ERROR("Failed to disconnect from database connection!", ex.what());
+    } catch (...) {
+        LOG_ERROR("Failed to disconnect from database connection!", UNKNOWN_ERROR);
+    }
+}
+
+bool Database::ValidateOnBorrow(pqxx::connection &connection,
+                                const boost::chrono::milliseconds &idle)
+{
+    if (!connection.is_open()) {
+        LOG_WARNING("Discarding a closed database connection!");
+        return false;
+    }
+
+    /// A recently used connection is most likely alive, so spare the round trip
+    if (idle < boost::chrono::milliseconds(CONNECTION_VALIDATION_THRESHOLD)) {
+        return true;
+    }
+
+    try {
+        pqxx::nontransaction ntxn(connection);
+        ntxn.exec("SELECT 1;");
+        return true;
+    } catch (const std::exception &ex) {
+        LOG_WARNING("Discarding a broken database connection!", ex.what(), (format("Idle: %1%ms") % idle.count()).str());
+    } catch (...) {
+        LOG_WARNING("Discarding a broken database connection!", UNKNOWN_ERROR, (format("Idle: %1%ms") % idle.count()).str());
+    }
+
+    return false;
+}
+
+bool Database::ValidateOnReturn(pqxx::connection &connection)
+{
+    if (!connection.is_open()) {
+        LOG_WARNING("Discarding a closed database connection on return!");
+        return false;
+    }
+
+    return true;
+}
+
+void Database::PrepareStatements(pqxx::connection &connection)
+{
+    Impl::StatementsList pending;
+
+    {
+        boost::lock_guard<boost::mutex> lock(m_pimpl->StatementsMutex);
+        (void)lock;
+
+        std::size_t &prepared = m_pimpl->PreparedStatements[&connection];
+        if (prepared >= m_pimpl->Statements.size())
+            return;
+
+        pending.assign(m_pimpl->Statements.begin() + static_cast<long>(prepared),
+                       m_pimpl->Statements.end());
+    }
+
+    /// The connection is exclusively owned by the caller at this point, so it
+    /// is safe to talk to the server without holding the statements lock.
+    std::size_t succeeded = 0;
+    for (const auto &s : pending) {
+        try {
+            connection.prepare(s.first, s.second);
+
+            LOG_INFO("Prepared statement successfully!", s.first, s.second, (boost::format("Backend PID: %1%") % connection.backendpid()).str());
+
+            ++succeeded;
+            continue;
+        } catch (const pqxx::sql_error &ex) {
+            LOG_ERROR(ex.what(), ex.query(), s.first);
+        } catch (const std::exception &ex) {
+            LOG_ERROR(ex.what(), s.first);
+        } catch (...) {
+            LOG_ERROR(UNKNOWN_ERROR, s.first);
+        }
+
+        /// Stop at the first failure and retry from there on the next
+        /// acquisition; re-preparing an existing name is an error.
+        break;
+    }
+
+    boost::lock_guard<boost::mutex> lock(m_pimpl->StatementsMutex);
+    (void)lock;
+
+    m_pimpl->PreparedStatements[&connection] += succeeded;
+}
+
 bool Database::Initialize()
 {
     LOG_INFO("Initializing CoreLib::Database...");
 
     try {
+        for (const auto &e : m_pimpl->ExtensionNames) {
+            CreateExtension(e.first);
+        }
+
         for (const auto &e : m_pimpl->EnumNames) {
             CreateEnum(e.first);
         }
@@ -507,6 +2127,10 @@ bool Database::Initialize()
             CreateTable(t.first);
         }
 
+        for (const auto &i : m_pimpl->Indexes) {
+            CreateIndex(i.first);
+        }
+
         LOG_INFO("CoreLib::Crypto initialized successfully!");
 
         return true;
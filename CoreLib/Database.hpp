@@ -38,10 +38,23 @@
 #define CORELIB_DATABASE_HPP
 
 
+#include <functional>
 #include <memory>
 #include <string>
+#include <utility>
+#include <vector>
+#include <cstddef>
+#include <boost/asio/io_service.hpp>
+#include <boost/chrono/duration.hpp>
 #include <pqxx/connection>
+#include <pqxx/pipeline>
+#include <pqxx/result>
+#include <pqxx/transaction_base>
+#include "Histogram.hpp"
 #include "SharedObjectPool.hpp"
+#include "Stopwatch.hpp"
+
+struct pg_result;
 
 namespace CoreLib {
 class Database;
@@ -49,6 +62,168 @@ class Database;
 
 class CoreLib::Database
 {
+public:
+    enum class Access : unsigned char {
+        ReadWrite,
+        ReadOnly
+    };
+
+    /// Latencies are recorded in microseconds, per table id or statement id;
+    /// pool waits are tagged PRIMARY or REPLICA instead.
+    enum class Metric : unsigned char {
+        PoolWait,
+        Execute,
+        Commit
+    };
+
+    /// Relaxed commits return before the WAL is flushed; a crash may lose the
+    /// last few of them, but never leaves the database inconsistent.
+    enum class Durability : unsigned char {
+        Full,
+        Relaxed
+    };
+
+    /// While alive, read-only connections on the current thread are served by
+    /// the primary, so a request can read its own writes.
+    class PrimaryPin
+    {
+    public:
+        PrimaryPin();
+        virtual ~PrimaryPin();
+    };
+
+    typedef std::vector<std::string> BulkRow;
+    /// Fills in the next row and returns true, or returns false once exhausted
+    typedef std::function<bool(BulkRow &)> BulkRowGenerator;
+
+    struct BulkInsertStats
+    {
+        std::size_t Rows;
+        std::size_t Inserted;
+        double ElapsedSeconds;
+        double RowsPerSecond;
+    };
+
+    /// Sends a batch of independent queries in one go and collects the
+    /// results afterwards. The transaction cannot be used for anything else
+    /// while the pipeline is alive, so keep it in its own scope.
+    class Pipeline
+    {
+    public:
+        typedef pqxx::pipeline::query_id QueryId;
+
+    private:
+        pqxx::transaction_base &m_txn;
+        pqxx::pipeline m_pipeline;
+
+    public:
+        explicit Pipeline(pqxx::transaction_base &txn);
+        virtual ~Pipeline();
+
+    public:
+        QueryId Queue(const std::string &query);
+
+        /// Runs a statement registered through Database::RegisterStatement;
+        /// it has to be prepared on the transaction's connection already.
+        template <typename... _Args>
+        QueryId QueuePrepared(const std::string &id, _Args &&... args)
+        {
+            std::vector<std::string> quoted{ m_txn.quote(std::forward<_Args>(args))... };
+            return QueueExecute(id, quoted);
+        }
+
+        pqxx::result Retrieve(const QueryId id);
+        void Complete();
+
+    private:
+        QueryId QueueExecute(const std::string &id,
+                             const std::vector<std::string> &quotedArgs);
+    };
+
+    /// Gives the current thread one pooled connection for as long as it is
+    /// alive, e.g. for the span of a request. Insert, Update and Delete join
+    /// its transaction instead of borrowing a connection of their own, and
+    /// let their exceptions through rather than returning false. Nothing is
+    /// committed until Commit(); whatever is left uncommitted gets rolled
+    /// back. A unit created while another one is alive joins it, unless it
+    /// needs to write and the outer one is read-only.
+    class UnitOfWork
+    {
+    private:
+        Database &m_database;
+        Access m_access;
+        UnitOfWork *m_outer;
+        UnitOfWork *m_joined;
+        std::unique_ptr<PrimaryPin> m_pin;
+        SharedObjectPool<pqxx::connection>::ptrType m_connection;
+        std::unique_ptr<pqxx::transaction_base> m_txn;
+
+    public:
+        explicit UnitOfWork(Database &database, const Access access = Access::ReadWrite);
+        virtual ~UnitOfWork();
+
+        UnitOfWork(const UnitOfWork &) = delete;
+        UnitOfWork &operator=(const UnitOfWork &) = delete;
+
+    public:
+        /// The innermost unit of the current thread, or nullptr
+        static UnitOfWork *Current();
+
+        Access GetAccess() const;
+
+        /// Opens a new transaction on the unit's connection once the
+        /// previous one got committed
+        pqxx::transaction_base &Transaction();
+        /// Both do nothing for a unit that joined another one; the outermost
+        /// unit decides
+        void Commit(const std::string &tag,
+                    const Durability durability = Durability::Full);
+        void Rollback();
+    };
+
+    /// Outcome of an asynchronous query; a read-only view over libpq's result
+    class AsyncResult
+    {
+    private:
+        std::shared_ptr<pg_result> m_result;
+        std::string m_error;
+
+    public:
+        AsyncResult(const std::shared_ptr<pg_result> &result, const std::string &error);
+        virtual ~AsyncResult();
+
+    public:
+        bool Succeeded() const;
+        const std::string &Error() const;
+
+        std::size_t Rows() const;
+        std::size_t Columns() const;
+        std::size_t AffectedRows() const;
+
+        bool IsNull(const std::size_t row, const std::string &column) const;
+        std::string Value(const std::size_t row, const std::size_t column) const;
+        std::string Value(const std::size_t row, const std::string &column) const;
+    };
+
+    /// Runs a function in the context of the session that issued the query,
+    /// e.g. through Wt::WServer::post
+    typedef std::function<void(const std::function<void()> &)> AsyncPoster;
+    typedef std::function<void(const AsyncResult &)> AsyncHandler;
+
+    /// Comma separated column list, see DATABASE_COLUMNS
+    template <std::size_t _Columns>
+    struct Columns
+    {
+        const char *Text;
+    };
+
+    /// SQL fragment with '?' placeholders, see DATABASE_SQL
+    template <std::size_t _Placeholders>
+    struct Sql
+    {
+        const char *Text;
+    };
+
 private:
     struct Impl;
     std::unique_ptr<Impl> m_pimpl;
@@ -60,29 +235,266 @@ public:
 
     static bool IsTrue(const std::string &value);
 
+    static constexpr std::size_t CountColumns(const char *fields)
+    {
+        std::size_t count = 0;
+        bool pending = false;
+
+        for (; *fields != '\0'; ++fields) {
+            if (*fields == ',') {
+                ++count;
+                pending = false;
+            } else if (*fields != ' ') {
+                pending = true;
+            }
+        }
+
+        return pending ? count + 1 : count;
+    }
+
+    static constexpr std::size_t CountPlaceholders(const char *sql)
+    {
+        std::size_t count = 0;
+
+        for (; *sql != '\0'; ++sql) {
+            if (*sql == '?')
+                ++count;
+        }
+
+        return count;
+    }
+
 public:
     explicit Database(const std::string &connectionString);
+    Database(const std::string &connectionString,
+             const std::size_t minConnections,
+             const std::size_t maxConnections,
+             const boost::chrono::milliseconds &idleTimeout,
+             const boost::chrono::milliseconds &maxLifetime);
     virtual ~Database();
 
+    /// Replicas have to be added during initialization, before any connection is acquired
+    void AddReplica(const std::string &connectionString);
+
     SharedObjectPool<pqxx::connection>::ptrType Connection();
+    SharedObjectPool<pqxx::connection>::ptrType Connection(const boost::chrono::milliseconds &timeout);
+    SharedObjectPool<pqxx::connection>::ptrType Connection(const Access access);
+    SharedObjectPool<pqxx::connection>::ptrType Connection(const Access access,
+                                                           const boost::chrono::milliseconds &timeout);
+
+    /// Hooks the asynchronous API up to the server's event loop. Queries run
+    /// on dedicated non-blocking connections, up to maxConnections of them,
+    /// opened on demand; further queries wait in line for a free one.
+    void EnableAsync(boost::asio::io_service &ioService, const std::size_t maxConnections);
+    /// Closes every async connection, busy ones included, and fails the queued
+    /// queries. Call it once the event loop has stopped and before its
+    /// io_service goes away.
+    void DisableAsync();
+    /// Returns immediately; handler gets called through poster once the result
+    /// is in, or on the event loop thread if no poster is given
+    void ExecuteAsync(const std::string &query,
+                      const std::vector<std::string> &params,
+                      const AsyncPoster &poster,
+                      const AsyncHandler &handler);
+    void ExecutePreparedAsync(const std::string &id,
+                              const std::vector<std::string> &params,
+                              const AsyncPoster &poster,
+                              const AsyncHandler &handler);
 
+    bool CreateExtension(const std::string &id);
     bool CreateEnum(const std::string &id);
 
     bool CreateTable(const std::string &id);
     bool DropTable(const std::string &id);
+
+    /// Builds the index concurrently unless a valid one already exists; an
+    /// invalid leftover of an interrupted build is dropped and rebuilt.
+    bool CreateIndex(const std::string &id);
     bool RenameTable(const std::string &id, const std::string &newName);
 
+    /// Use DATABASE_COLUMNS for the column list, so the number of values is
+    /// checked at compile time; values are bound as parameters, never quoted.
+    template <std::size_t _Columns, typename... _Args>
+    bool Insert(const std::string &id,
+                const Columns<_Columns> &fields,
+                _Args &&... args)
+    {
+        static_assert(_Columns == sizeof...(_Args),
+                      "Insert: the number of values does not match the number of columns!");
+
+        return Execute(id, [&](pqxx::transaction_base &txn) {
+            return txn.exec_params(InsertQuery(txn, id, fields.Text, sizeof...(_Args)),
+                                   std::forward<_Args>(args)...);
+        });
+    }
+
+    /// Same as above for column lists built at runtime, checked at runtime
+    template <typename... _Args>
     bool Insert(const std::string &id,
                 const std::string &fields,
-                const std::initializer_list<std::string> &args);
+                _Args &&... args)
+    {
+        if (!MatchesArity(id, fields, CountColumns(fields.c_str()), sizeof...(_Args)))
+            return false;
+
+        return Execute(id, [&](pqxx::transaction_base &txn) {
+            return txn.exec_params(InsertQuery(txn, id, fields, sizeof...(_Args)),
+                                   std::forward<_Args>(args)...);
+        });
+    }
+
+    bool BulkInsert(const std::string &id,
+                    const std::vector<std::string> &columns,
+                    const BulkRowGenerator &generator,
+                    const bool ignoreConflicts = false,
+                    BulkInsertStats *stats = nullptr);
+
+    template <typename _Iterator>
+    bool BulkInsert(const std::string &id,
+                    const std::vector<std::string> &columns,
+                    _Iterator first, _Iterator last,
+                    const bool ignoreConflicts = false,
+                    BulkInsertStats *stats = nullptr)
+    {
+        return BulkInsert(id, columns, [&first, &last](BulkRow &row) {
+            if (first == last)
+                return false;
+
+            row.assign(std::begin(*first), std::end(*first));
+            ++first;
+
+            return true;
+        }, ignoreConflicts, stats);
+    }
+
+    /// Rows are matched on the key columns, which must be among columns, and
+    /// the rest of the columns get overwritten; rows without a match are
+    /// skipped. Stats count the updated rows as inserted.
+    bool BulkUpdate(const std::string &id,
+                    const std::vector<std::string> &columns,
+                    const std::vector<std::string> &keys,
+                    const BulkRowGenerator &generator,
+                    BulkInsertStats *stats = nullptr);
+
+    template <typename _Iterator>
+    bool BulkUpdate(const std::string &id,
+                    const std::vector<std::string> &columns,
+                    const std::vector<std::string> &keys,
+                    _Iterator first, _Iterator last,
+                    BulkInsertStats *stats = nullptr)
+    {
+        return BulkUpdate(id, columns, keys, [&first, &last](BulkRow &row) {
+            if (first == last)
+                return false;
+
+            row.assign(std::begin(*first), std::end(*first));
+            ++first;
+
+            return true;
+        }, stats);
+    }
+
+    /// Use DATABASE_SQL for the SET clause, so the number of '?' placeholders
+    /// is checked against the number of values at compile time.
+    template <typename _Value, std::size_t _Placeholders, typename... _Args>
+    bool Update(const std::string &id,
+                const std::string &where,
+                _Value &&value,
+                const Sql<_Placeholders> &set,
+                _Args &&... args)
+    {
+        static_assert(_Placeholders == sizeof...(_Args),
+                      "Update: the number of values does not match the number of placeholders!");
+
+        return Execute(id, [&](pqxx::transaction_base &txn) {
+            return txn.exec_params(UpdateQuery(txn, id, where, set.Text),
+                                   std::forward<_Args>(args)...,
+                                   std::forward<_Value>(value));
+        });
+    }
+
+    /// Same as above for SET clauses built at runtime, checked at runtime
+    template <typename _Value, typename... _Args>
     bool Update(const std::string &id,
                 const std::string &where,
-                const std::string &value,
+                _Value &&value,
                 const std::string &set,
-                const std::initializer_list<std::string> &args);
+                _Args &&... args)
+    {
+        if (!MatchesArity(id, set, CountPlaceholders(set.c_str()), sizeof...(_Args)))
+            return false;
+
+        return Execute(id, [&](pqxx::transaction_base &txn) {
+            return txn.exec_params(UpdateQuery(txn, id, where, set),
+                                   std::forward<_Args>(args)...,
+                                   std::forward<_Value>(value));
+        });
+    }
+
+    /// Inserts one row inside the caller's transaction and returns the
+    /// returning columns of it. values is a DATABASE_SQL list of '?'
+    /// placeholders and server-side expressions, e.g. gen_random_uuid(), so
+    /// generated keys come back without another round trip.
+    template <std::size_t _Columns, std::size_t _Placeholders, typename... _Args>
+    pqxx::result InsertReturning(pqxx::transaction_base &txn,
+                                 const std::string &id,
+                                 const Columns<_Columns> &fields,
+                                 const Sql<_Placeholders> &values,
+                                 const std::string &returning,
+                                 _Args &&... args)
+    {
+        static_assert(_Placeholders == sizeof...(_Args),
+                      "InsertReturning: the number of values does not match the number of placeholders!");
+
+        Stopwatch<> stopwatch;
+        pqxx::result r(txn.exec_params(UpsertQuery(txn, id, fields.Text, values.Text,
+                                                   "", "", returning),
+                                       std::forward<_Args>(args)...));
+        RecordMetric(Metric::Execute, id, stopwatch.Stop());
+        return r;
+    }
+
+    /// Same as InsertReturning, but a row clashing on the conflict columns
+    /// gets the DATABASE_SQL update applied instead; its '?' placeholders
+    /// take the values following the ones of the insert, and EXCLUDED refers
+    /// to the rejected row. An empty update leaves the clashing row alone,
+    /// in which case nothing is returned for it.
+    template <std::size_t _Columns, std::size_t _ValuePlaceholders,
+              std::size_t _UpdatePlaceholders, typename... _Args>
+    pqxx::result Upsert(pqxx::transaction_base &txn,
+                        const std::string &id,
+                        const Columns<_Columns> &fields,
+                        const Sql<_ValuePlaceholders> &values,
+                        const std::string &conflict,
+                        const Sql<_UpdatePlaceholders> &update,
+                        const std::string &returning,
+                        _Args &&... args)
+    {
+        static_assert(_ValuePlaceholders + _UpdatePlaceholders == sizeof...(_Args),
+                      "Upsert: the number of values does not match the number of placeholders!");
+
+        Stopwatch<> stopwatch;
+        pqxx::result r(txn.exec_params(UpsertQuery(txn, id, fields.Text, values.Text,
+                                                   conflict, update.Text, returning),
+                                       std::forward<_Args>(args)...));
+        RecordMetric(Metric::Execute, id, stopwatch.Stop());
+        return r;
+    }
+
+    template <typename _Value>
     bool Delete(const std::string &id,
                 const std::string &where,
-                const std::string &value);
+                _Value &&value)
+    {
+        return Execute(id, [&](pqxx::transaction_base &txn) {
+            return txn.exec_params(DeleteQuery(txn, id, where),
+                                   std::forward<_Value>(value));
+        });
+    }
+
+    /// Extensions get created before anything else by Initialize()
+    void RegisterExtension(const std::string &id,
+                           const std::string &name);
 
     void RegisterEnum(const std::string &id,
                       const std::string &name,
@@ -91,13 +503,107 @@ public:
     void RegisterTable(const std::string &id,
                        const std::string &name,
                        const std::string &fields);
+    /// columns may carry per-column options, e.g. "user_id, login_time DESC";
+    /// include lists the extra columns of a covering index, and predicate
+    /// turns it into a partial index. Both may be left empty.
+    void RegisterIndex(const std::string &id,
+                       const std::string &name,
+                       const std::string &tableId,
+                       const std::string &columns,
+                       const std::string &include = "",
+                       const std::string &predicate = "",
+                       const bool unique = false);
+
     std::string GetTableName(const std::string &id) const;
     std::string GetTableFields(const std::string &id) const;
     bool SetTableName(const std::string &id, const std::string &newName);
     bool SetTableFields(const std::string &id, const std::string &fields);
+    /// Durability of the standalone writes to a table, e.g. Execute() and
+    /// BulkInsert(); units of work always ask for it explicitly on Commit()
+    Durability GetTableDurability(const std::string &id) const;
+    void SetTableDurability(const std::string &id, const Durability durability);
+
+    void RegisterStatement(const std::string &id,
+                           const std::string &query);
+    std::string GetStatement(const std::string &id) const;
+
+    template <typename... _Args>
+    pqxx::result ExecutePrepared(pqxx::transaction_base &txn,
+                                 const std::string &id,
+                                 _Args &&... args)
+    {
+        Stopwatch<> stopwatch;
+        pqxx::result r(txn.exec_prepared(id, std::forward<_Args>(args)...));
+        RecordMetric(Metric::Execute, id, stopwatch.Stop());
+        return r;
+    }
+
+    /// Commits the transaction and records the time it took under tag
+    void Commit(pqxx::transaction_base &txn, const std::string &tag,
+                const Durability durability = Durability::Full);
+
+    void RecordMetric(const Metric metric, const std::string &tag, const double microseconds);
+    const Histogram &GetMetric(const Metric metric, const std::string &tag);
+    /// Summary of every recorded histogram, one line per tag and metric
+    std::string DumpMetrics() const;
 
     bool Initialize();
+
+private:
+    std::unique_ptr<pqxx::connection> Connect(const std::string &connectionString);
+    void Disconnect(pqxx::connection &connection);
+    bool ValidateOnBorrow(pqxx::connection &connection,
+                          const boost::chrono::milliseconds &idle);
+    bool ValidateOnReturn(pqxx::connection &connection);
+    void PrepareStatements(pqxx::connection &connection);
+
+    /// Runs query in its own transaction and commits it, recording metrics under
+    /// id; inside a read-write unit of work it joins the unit's transaction instead
+    bool Execute(const std::string &id,
+                 const std::function<pqxx::result(pqxx::transaction_base &)> &query);
+    enum class BulkMode : unsigned char {
+        Insert,
+        InsertIgnoreConflicts,
+        Update
+    };
+
+    /// COPY is the transport for every bulk operation; whatever is not a plain
+    /// insert goes through a throw-away table first
+    bool BulkCopy(const std::string &id,
+                  const std::vector<std::string> &columns,
+                  const std::vector<std::string> &keys,
+                  const BulkMode mode,
+                  const BulkRowGenerator &generator,
+                  BulkInsertStats *stats);
+    bool MatchesArity(const std::string &id,
+                      const std::string &text,
+                      const std::size_t expected,
+                      const std::size_t actual) const;
+    std::string InsertQuery(pqxx::transaction_base &txn,
+                            const std::string &id,
+                            const std::string &fields,
+                            const std::size_t count) const;
+    std::string UpdateQuery(pqxx::transaction_base &txn,
+                            const std::string &id,
+                            const std::string &where,
+                            const std::string &set) const;
+    static std::string NumberPlaceholders(const std::string &sql, std::size_t &index);
+    std::string UpsertQuery(pqxx::transaction_base &txn,
+                            const std::string &id,
+                            const std::string &fields,
+                            const std::string &values,
+                            const std::string &conflict,
+                            const std::string &update,
+                            const std::string &returning) const;
+    std::string DeleteQuery(pqxx::transaction_base &txn,
+                            const std::string &id,
+                            const std::string &where) const;
 };
 
+#define DATABASE_COLUMNS(FIELDS) \
+    CoreLib::Database::Columns<CoreLib::Database::CountColumns(FIELDS)>{ FIELDS }
+#define DATABASE_SQL(SQL) \
+    CoreLib::Database::Sql<CoreLib::Database::CountPlaceholders(SQL)>{ SQL }
+
 
 #endif /* CORELIB_DATABASE_HPP */
@@ -0,0 +1,168 @@
+/**
+ * @file
+ * @author  Mamadou Babaei <info@babaei.net>
+ * @version 0.1.0
+ *
+ * @section LICENSE
+ *
+ * (The MIT License)
+ *
+ * Copyright (c) 2016 - 2021 Mamadou Babaei
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Lock-free log-linear histogram for latency measurements. Each power of two
+ * is split into a fixed number of linear sub-buckets, so the relative error of
+ * any reported percentile stays within 1 / SUB_BUCKETS.
+ */
+
+
+#include <limits>
+#include <boost/format.hpp>
+#include "Histogram.hpp"
+
+using namespace std;
+using namespace boost;
+using namespace CoreLib;
+
+Histogram::Histogram()
+{
+    Reset();
+}
+
+Histogram::~Histogram() = default;
+
+void Histogram::Record(const std::uint64_t value)
+{
+    m_buckets[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value, std::memory_order_relaxed);
+
+    std::uint64_t max = m_max.load(std::memory_order_relaxed);
+    while (value > max
+           && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+    }
+}
+
+void Histogram::Reset()
+{
+    for (auto &bucket : m_buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+
+    m_count.store(0, std::memory_order_relaxed);
+    m_sum.store(0, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+std::uint64_t Histogram::Count() const
+{
+    return m_count.load(std::memory_order_relaxed);
+}
+
+std::uint64_t Histogram::Sum() const
+{
+    return m_sum.load(std::memory_order_relaxed);
+}
+
+std::uint64_t Histogram::Max() const
+{
+    return m_max.load(std::memory_order_relaxed);
+}
+
+double Histogram::Mean() const
+{
+    std::uint64_t count = Count();
+    return count > 0 ? static_cast<double>(Sum()) / static_cast<double>(count) : 0.0;
+}
+
+std::uint64_t Histogram::Percentile(const double percentile) const
+{
+    /// Writers may keep recording while we read, so work on a snapshot of the
+    /// buckets rather than on m_count, which could be out of step with them.
+    std::array<std::uint64_t, BUCKETS> snapshot;
+    std::uint64_t total = 0;
+    for (std::size_t i = 0; i < BUCKETS; ++i) {
+        snapshot[i] = m_buckets[i].load(std::memory_order_relaxed);
+        total += snapshot[i];
+    }
+
+    if (total == 0)
+        return 0;
+
+    double clamped = percentile < 0.0 ? 0.0 : (percentile > 100.0 ? 100.0 : percentile);
+    std::uint64_t rank = static_cast<std::uint64_t>(clamped / 100.0 * static_cast<double>(total) + 0.5);
+    if (rank == 0)
+        rank = 1;
+
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < BUCKETS; ++i) {
+        seen += snapshot[i];
+        if (seen >= rank) {
+            std::uint64_t bound = BucketUpperBound(i);
+            std::uint64_t max = Max();
+            return (max > 0 && bound > max) ? max : bound;
+        }
+    }
+
+    return Max();
+}
+
+std::string Histogram::Summary() const
+{
+    return (format("count=%1% mean=%2$.0f p50=%3% p99=%4% p999=%5% max=%6%")
+            % Count() % Mean() % Percentile(50.0) % Percentile(99.0)
+            % Percentile(99.9) % Max()).str();
+}
+
+std::size_t Histogram::BucketIndex(const std::uint64_t value)
+{
+    if (value < SUB_BUCKETS)
+        return static_cast<std::size_t>(value);
+
+#if defined ( __GNUC__ ) || defined ( __clang__ )
+    std::size_t exponent = 63 - static_cast<std::size_t>(__builtin_clzll(value));
+#else
+    std::size_t exponent = 0;
+    for (std::uint64_t v = value; v > 1; v >>= 1) {
+        ++exponent;
+    }
+#endif  // defined ( __GNUC__ ) || defined ( __clang__ )
+
+    std::size_t shift = exponent - SUB_BUCKET_BITS;
+    std::size_t sub = static_cast<std::size_t>(value >> shift) - SUB_BUCKETS;
+
+    return SUB_BUCKETS + shift * SUB_BUCKETS + sub;
+}
+
+std::uint64_t Histogram::BucketUpperBound(const std::size_t index)
+{
+    if (index < SUB_BUCKETS)
+        return static_cast<std::uint64_t>(index);
+
+    std::size_t shift = (index - SUB_BUCKETS) / SUB_BUCKETS;
+    std::size_t sub = (index - SUB_BUCKETS) % SUB_BUCKETS;
+
+    if (shift + SUB_BUCKET_BITS >= 63 && sub == SUB_BUCKETS - 1)
+        return std::numeric_limits<std::uint64_t>::max();
+
+    return ((static_cast<std::uint64_t>(SUB_BUCKETS + sub + 1)) << shift) - 1;
+}
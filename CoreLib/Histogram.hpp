@@ -0,0 +1,94 @@
+/**
+ * @file
+ * @author  Mamadou Babaei <info@babaei.net>
+ * @version 0.1.0
+ *
+ * @section LICENSE
+ *
+ * (The MIT License)
+ *
+ * Copyright (c) 2016 - 2021 Mamadou Babaei
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Lock-free log-linear histogram for latency measurements. Each power of two
+ * is split into a fixed number of linear sub-buckets, so the relative error of
+ * any reported percentile stays within 1 / SUB_BUCKETS.
+ */
+
+
+#ifndef CORELIB_HISTOGRAM_HPP
+#define CORELIB_HISTOGRAM_HPP
+
+
+#include <array>
+#include <atomic>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+namespace CoreLib {
+class Histogram;
+}
+
+class CoreLib::Histogram
+{
+public:
+    static constexpr std::size_t SUB_BUCKET_BITS = 4;
+    static constexpr std::size_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static constexpr std::size_t BUCKETS = SUB_BUCKETS + (64 - SUB_BUCKET_BITS) * SUB_BUCKETS;
+
+private:
+    std::array<std::atomic<std::uint64_t>, BUCKETS> m_buckets;
+    std::atomic<std::uint64_t> m_count;
+    std::atomic<std::uint64_t> m_sum;
+    std::atomic<std::uint64_t> m_max;
+
+public:
+    Histogram();
+    virtual ~Histogram();
+
+    Histogram(const Histogram &) = delete;
+    Histogram &operator=(const Histogram &) = delete;
+
+public:
+    void Record(const std::uint64_t value);
+    void Reset();
+
+    std::uint64_t Count() const;
+    std::uint64_t Sum() const;
+    std::uint64_t Max() const;
+    double Mean() const;
+
+    /// percentile is in the range of [0.0, 100.0]; the returned value is the
+    /// upper bound of the bucket the percentile falls into
+    std::uint64_t Percentile(const double percentile) const;
+
+    /// One line summary, e.g. "count=12 mean=340 p50=311 p99=1023 p999=1023 max=1009"
+    std::string Summary() const;
+
+private:
+    static std::size_t BucketIndex(const std::uint64_t value);
+    static std::uint64_t BucketUpperBound(const std::size_t index);
+};
+
+
+#endif /* CORELIB_HISTOGRAM_HPP */
@@ -0,0 +1,305 @@
+/**
+ * @file
+ * @author  Mamadou Babaei <info@babaei.net>
+ * @version 0.1.0
+ *
+ * @section LICENSE
+ *
+ * (The MIT License)
+ *
+ * Copyright (c) 2016 - 2021 Mamadou Babaei
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * A lock-free object pool on top of a bounded multi-producer multi-consumer
+ * ring buffer.
+ */
+
+
+#ifndef CORELIB_LOCK_FREE_OBJECT_POOL_HPP
+#define CORELIB_LOCK_FREE_OBJECT_POOL_HPP
+
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <boost/chrono/chrono.hpp>
+#include <boost/thread/thread.hpp>
+#include "Exception.hpp"
+
+namespace CoreLib {
+template <typename _T, typename _D = std::default_delete<_T>>
+class LockFreeObjectPool;
+}
+
+/// Offers the Add/Acquire interface of SharedObjectPool without any mutex.
+/// The capacity is fixed upfront and caps the number of live objects. There
+/// is no reaping and no validation, and since nothing can block without a
+/// lock, callers spin with a yield while the pool is exhausted. Unlike the
+/// other pool, which never refuses an object, Add() returns false once every
+/// cell is taken and leaves the object with the caller, who must size the
+/// capacity for everything it adds or handle the refusal.
+template <typename _T, typename _D>
+class CoreLib::LockFreeObjectPool
+{
+private:
+    struct ReturnToPoolDeleter {
+    private:
+        std::weak_ptr<LockFreeObjectPool<_T, _D> *> m_pool;
+
+    public:
+        explicit ReturnToPoolDeleter(const std::weak_ptr<LockFreeObjectPool<_T, _D> *> pool = { })
+            : m_pool(pool) {
+
+        }
+
+        void operator()(_T *ptr) {
+            if (auto poolPtr = m_pool.lock()) {
+                std::unique_ptr<_T, _D> uptr{ptr};
+                (*poolPtr.get())->Return(uptr);
+            } else {
+                _D{}(ptr);
+            }
+        }
+    };
+
+    /// A cell is free for the producer whose position equals its sequence
+    /// and full for the consumer whose position is one behind it.
+    struct Cell {
+        std::atomic<std::size_t> Sequence;
+        _T *Object;
+    };
+
+    static constexpr std::size_t CACHE_LINE_SIZE = 64;
+
+public:
+    using ptrType = std::unique_ptr<_T, ReturnToPoolDeleter>;
+    using uptrType = std::unique_ptr<_T, _D>;
+
+    typedef std::function<uptrType()> FactoryType;
+
+private:
+    std::shared_ptr<LockFreeObjectPool<_T, _D> *> m_thisPtr;
+
+    std::unique_ptr<Cell[]> m_cells;
+    const std::size_t m_mask;
+
+    alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> m_enqueuePosition;
+    alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> m_dequeuePosition;
+
+    /// Every live object, whether idle or borrowed, plus the ones being born
+    alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> m_total;
+
+    FactoryType m_factory;
+
+public:
+    /// The capacity gets rounded up to a power of two
+    explicit LockFreeObjectPool(const std::size_t capacity)
+        : m_thisPtr(std::make_shared<LockFreeObjectPool<_T, _D> *>(this)),
+          m_cells(new Cell[RoundUp(capacity)]),
+          m_mask(RoundUp(capacity) - 1),
+          m_enqueuePosition(0),
+          m_dequeuePosition(0),
+          m_total(0) {
+        for (std::size_t i = 0; i <= m_mask; ++i) {
+            m_cells[i].Sequence.store(i, std::memory_order_relaxed);
+            m_cells[i].Object = nullptr;
+        }
+    }
+
+    virtual ~LockFreeObjectPool() {
+        _T *object = nullptr;
+        while (Pop(object)) {
+            _D{}(object);
+        }
+    }
+
+    LockFreeObjectPool(const LockFreeObjectPool &) = delete;
+    LockFreeObjectPool &operator=(const LockFreeObjectPool &) = delete;
+
+public:
+    /// Must be set before the pool gets shared among threads
+    void SetFactory(const FactoryType &factory) {
+        m_factory = factory;
+    }
+
+    /// Returns false and leaves the object to the caller if the pool is full
+    bool Add(uptrType &uptr) {
+        if (!Reserve()) {
+            return false;
+        }
+
+        Push(uptr.release());
+        return true;
+    }
+
+    ptrType Acquire() {
+        return Acquire(boost::chrono::milliseconds::zero());
+    }
+
+    /// Spins until an object is available or the timeout expires, in which
+    /// case an exception is thrown. Waiters are not served in any order.
+    ptrType Acquire(const boost::chrono::milliseconds &timeout) {
+        const boost::chrono::steady_clock::time_point deadline =
+                boost::chrono::steady_clock::now() + timeout;
+
+        for (;;) {
+            _T *object = nullptr;
+
+            if (Pop(object)) {
+                return Wrap(object);
+            }
+
+            if (m_factory && Reserve()) {
+                uptrType created;
+
+                try {
+                    created = m_factory();
+                } catch (...) {
+                    m_total.fetch_sub(1, std::memory_order_relaxed);
+                    throw;
+                }
+
+                if (!created) {
+                    m_total.fetch_sub(1, std::memory_order_relaxed);
+                    throw CoreLib::Exception<std::string>("Pool factory failed to create a new object.");
+                }
+
+                return Wrap(created.release());
+            }
+
+            if (boost::chrono::steady_clock::now() >= deadline) {
+                throw CoreLib::Exception<std::string>("Timed out acquiring object from the pool.");
+            }
+
+            boost::this_thread::yield();
+        }
+    }
+
+    /// Number of idle objects; only a snapshot while other threads are busy
+    std::size_t Size() const {
+        const std::size_t enqueued = m_enqueuePosition.load(std::memory_order_relaxed);
+        const std::size_t dequeued = m_dequeuePosition.load(std::memory_order_relaxed);
+        return enqueued > dequeued ? enqueued - dequeued : 0;
+    }
+
+    bool Empty() const {
+        return Size() == 0;
+    }
+
+    /// Number of live objects, both idle and borrowed
+    std::size_t Total() const {
+        return m_total.load(std::memory_order_relaxed);
+    }
+
+    std::size_t Capacity() const {
+        return m_mask + 1;
+    }
+
+private:
+    static std::size_t RoundUp(const std::size_t capacity) {
+        std::size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        return size;
+    }
+
+    /// Claims room for one more live object
+    bool Reserve() {
+        std::size_t total = m_total.load(std::memory_order_relaxed);
+        do {
+            if (total > m_mask) {
+                return false;
+            }
+        } while (!m_total.compare_exchange_weak(total, total + 1,
+                                                std::memory_order_relaxed));
+        return true;
+    }
+
+    ptrType Wrap(_T *object) {
+        return ptrType(object,
+                       ReturnToPoolDeleter{
+                           std::weak_ptr<LockFreeObjectPool<_T, _D> *>{m_thisPtr}});
+    }
+
+    void Return(uptrType &uptr) {
+        Push(uptr.release());
+    }
+
+    /// Never fails since the live objects never outnumber the cells
+    void Push(_T *object) {
+        std::size_t position = m_enqueuePosition.load(std::memory_order_relaxed);
+
+        for (;;) {
+            Cell &cell = m_cells[position & m_mask];
+            const std::size_t sequence = cell.Sequence.load(std::memory_order_acquire);
+            const std::ptrdiff_t delta = static_cast<std::ptrdiff_t>(sequence)
+                    - static_cast<std::ptrdiff_t>(position);
+
+            if (delta == 0) {
+                if (m_enqueuePosition.compare_exchange_weak(position, position + 1,
+                                                            std::memory_order_relaxed)) {
+                    cell.Object = object;
+                    cell.Sequence.store(position + 1, std::memory_order_release);
+                    return;
+                }
+            } else if (delta < 0) {
+                /// Full; a borrower which has just popped this cell is about
+                /// to release it.
+                boost::this_thread::yield();
+                position = m_enqueuePosition.load(std::memory_order_relaxed);
+            } else {
+                position = m_enqueuePosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool Pop(_T *&object) {
+        std::size_t position = m_dequeuePosition.load(std::memory_order_relaxed);
+
+        for (;;) {
+            Cell &cell = m_cells[position & m_mask];
+            const std::size_t sequence = cell.Sequence.load(std::memory_order_acquire);
+            const std::ptrdiff_t delta = static_cast<std::ptrdiff_t>(sequence)
+                    - static_cast<std::ptrdiff_t>(position + 1);
+
+            if (delta == 0) {
+                if (m_dequeuePosition.compare_exchange_weak(position, position + 1,
+                                                            std::memory_order_relaxed)) {
+                    object = cell.Object;
+                    cell.Sequence.store(position + m_mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (delta < 0) {
+                return false;
+            } else {
+                position = m_dequeuePosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+};
+
+
+#endif /* CORELIB_LOCK_FREE_OBJECT_POOL_HPP */
@@ -33,14 +33,18 @@
  */
 
 
-#include <chrono>
+#include <algorithm>
+#include <atomic>
 #include <queue>
+#include <vector>
 #include <boost/bind.hpp>
 #include <boost/chrono/chrono.hpp>
 #include <boost/exception/diagnostic_information.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <boost/thread/lock_guard.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/once.hpp>
 #include <boost/thread/thread.hpp>
 #if defined ( _WIN32 )
 #include <vmime/platforms/windows/windowsHandler.hpp>
@@ -51,9 +55,17 @@
 #include "make_unique.hpp"
 #include "Log.hpp"
 #include "Mail.hpp"
+#include "MailSpool.hpp"
+#include "SharedObjectPool.hpp"
 #include "Utility.hpp"
 
-#define     WORKER_THREAD_STOP_IDLE_MILLISECONDS        10000.0
+#define     DEFAULT_MAX_WORKER_THREADS                  4
+#define     SMTP_URL                                    "smtp://localhost"
+#define     SMTP_MAX_CONNECTIONS                        8
+#define     SMTP_CONNECTION_ACQUISITION_TIMEOUT         30000       // milliseconds
+#define     SMTP_CONNECTION_IDLE_TIMEOUT                60000       // milliseconds
+#define     SMTP_CONNECTION_MAX_LIFETIME                600000      // milliseconds
+#define     SMTP_CONNECTION_VALIDATION_THRESHOLD        10000       // milliseconds
 #define     UNKNOWN_ERROR                               "Unknown error!"
 
 using namespace std;
@@ -62,17 +74,41 @@ using namespace CoreLib;
 
 struct Mail::Impl
 {
+public:
+    /// An open SMTP session, kept across messages; vmime resets the
+    /// transaction with RSET before reusing it for the next one.
+    struct SmtpConnection
+    {
+        vmime::shared_ptr<vmime::net::session> Session;
+        vmime::shared_ptr<vmime::net::transport> Transport;
+        bool Broken;
+
+        SmtpConnection();
+        ~SmtpConnection();
+    };
+
 public:
     static std::queue<Mail *> MailQueue;
     static std::queue<Mail::SendCallback> MailCallbackQueue;
-    static bool WorkerThreadIsRunning;
+    static std::size_t MaxWorkerThreads;
+    /// Workers live until StopWorkers(), blocked on MailCondition while the
+    /// queue is empty
+    static std::vector<std::unique_ptr<boost::thread>> WorkerThreads;
+    static std::size_t IdleWorkerThreads;
+    static bool StopRequested;
     static boost::mutex MailMutex;
-    static boost::mutex WorkerMutex;
-    static std::unique_ptr<boost::thread> WorkerThread;
+    static boost::condition_variable MailCondition;
+    static std::atomic<MailSpool *> Spool;
 
 public:
     static void DoWork();
 
+    static SharedObjectPool<SmtpConnection> &Connections();
+    static std::unique_ptr<SmtpConnection> Connect();
+    static bool ValidateOnBorrow(SmtpConnection &connection,
+                                 const boost::chrono::milliseconds &idle);
+    static bool ValidateOnReturn(SmtpConnection &connection);
+
 public:
     std::string From;
     std::string To;
@@ -89,101 +125,192 @@ public:
 
 std::queue<Mail *> Mail::Impl::MailQueue;
 std::queue<Mail::SendCallback> Mail::Impl::MailCallbackQueue;
-bool Mail::Impl::WorkerThreadIsRunning = false;
+std::size_t Mail::Impl::MaxWorkerThreads = DEFAULT_MAX_WORKER_THREADS;
+std::vector<std::unique_ptr<boost::thread>> Mail::Impl::WorkerThreads;
+std::size_t Mail::Impl::IdleWorkerThreads = 0;
+bool Mail::Impl::StopRequested = false;
 boost::mutex Mail::Impl::MailMutex;
-boost::mutex Mail::Impl::WorkerMutex;
-std::unique_ptr<boost::thread> Mail::Impl::WorkerThread;
+boost::condition_variable Mail::Impl::MailCondition;
+std::atomic<MailSpool *> Mail::Impl::Spool(nullptr);
 
-void Mail::Impl::DoWork()
+Mail::Impl::SmtpConnection::SmtpConnection()
+    : Broken(false)
 {
-    LOG_INFO("Mail worker thread started");
 
+}
+
+Mail::Impl::SmtpConnection::~SmtpConnection()
+{
     try {
-        auto lastJobTime = std::chrono::high_resolution_clock::now();
+        if (Transport && Transport->isConnected()) {
+            Transport->disconnect();
+        }
+    }
 
-        bool isMailQueueEmpty = false;
-        Mail *mail = nullptr;
-        Mail::SendCallback callback = nullptr;
+    catch (...) {
+        /// The relay might have hung up on us already
+    }
+}
 
-        for (;;) {
-            boost::this_thread::interruption_point();
+SharedObjectPool<Mail::Impl::SmtpConnection> &Mail::Impl::Connections()
+{
+    static SharedObjectPool<SmtpConnection> instance;
 
-            {
-                boost::lock_guard<boost::mutex> lock(WorkerMutex);
-                (void)lock;
+    static boost::once_flag setupFlag = BOOST_ONCE_INIT;
+    boost::call_once(setupFlag, [] {
+#if defined (_WIN32)
+        vmime::platform::setHandler<vmime::platforms::windows::windowsHandler>();
+#else
+        vmime::platform::setHandler<vmime::platforms::posix::posixHandler>();
+#endif /* defined (_WIN32) */
 
-                if (!WorkerThreadIsRunning)
-                    break;
-            }
+        instance.SetLimits(0, SMTP_MAX_CONNECTIONS);
+        instance.SetIdleTimeout(boost::chrono::milliseconds(SMTP_CONNECTION_IDLE_TIMEOUT));
+        instance.SetMaxLifetime(boost::chrono::milliseconds(SMTP_CONNECTION_MAX_LIFETIME));
+        instance.SetFactory(&Mail::Impl::Connect);
+        instance.SetBorrowValidator(&Mail::Impl::ValidateOnBorrow);
+        instance.SetReturnValidator(&Mail::Impl::ValidateOnReturn);
+    });
 
-            boost::this_thread::disable_interruption di;
+    return instance;
+}
 
-            {
-                boost::lock_guard<boost::mutex> lock(MailMutex);
-                (void)lock;
+std::unique_ptr<Mail::Impl::SmtpConnection> Mail::Impl::Connect()
+{
+    std::unique_ptr<SmtpConnection> connection(make_unique<SmtpConnection>());
 
-                isMailQueueEmpty = !(MailQueue.size() > 0);
+    vmime::utility::url url(SMTP_URL);
+#if VMIME_API_MODE == VMIME_LEGACY_API
+    connection->Session = vmime::make_shared<vmime::net::session>();
+#else
+    connection->Session = vmime::net::session::create();
+#endif  // VMIME_API_MODE == VMIME_LEGACY_API
 
-                if (!isMailQueueEmpty) {
-                    mail = MailQueue.front();
-                    callback = MailCallbackQueue.front();
-                }
-            }
+    /// Batches MAIL FROM, RCPT TO and DATA into a single round trip whenever
+    /// the relay advertises PIPELINING; vmime falls back to lock-step otherwise
+    connection->Session->getProperties()["transport.smtp.options.pipelining"] = true;
 
-            if (!isMailQueueEmpty) {
-                string error;
-                bool rc = mail->Send(error);
-                if (callback != nullptr) {
-                    callback(rc, error);
-                }
+    connection->Transport = connection->Session->getTransport(url);
+    connection->Transport->connect();
 
-                {
-                    boost::lock_guard<boost::mutex> lock(MailMutex);
-                    (void)lock;
+    return connection;
+}
 
-                    MailQueue.pop();
-                    MailCallbackQueue.pop();
-                }
+bool Mail::Impl::ValidateOnBorrow(SmtpConnection &connection,
+                                  const boost::chrono::milliseconds &idle)
+{
+    if (connection.Broken || !connection.Transport->isConnected()) {
+        return false;
+    }
 
-                if (mail->GetDeleteLater()) {
-                    delete mail;
-                }
+    /// A recently used connection is most likely alive, so spare the round trip
+    if (idle < boost::chrono::milliseconds(SMTP_CONNECTION_VALIDATION_THRESHOLD)) {
+        return true;
+    }
 
-                lastJobTime = std::chrono::high_resolution_clock::now();
-            }
+    try {
+        connection.Transport->noop();
+        return true;
+    }
+
+    catch (vmime::exception &ex) {
+        LOG_WARNING("Discarding a broken SMTP connection!", ex.what());
+    }
+
+    catch (std::exception &ex) {
+        LOG_WARNING("Discarding a broken SMTP connection!", ex.what());
+    }
+
+    catch (...) {
+        LOG_WARNING("Discarding a broken SMTP connection!", UNKNOWN_ERROR);
+    }
+
+    return false;
+}
 
-            boost::this_thread::restore_interruption ri(di);
-            (void)ri;
-            boost::this_thread::interruption_point();
+bool Mail::Impl::ValidateOnReturn(SmtpConnection &connection)
+{
+    return !connection.Broken && connection.Transport->isConnected();
+}
 
-            boost::this_thread::sleep_for(boost::chrono::nanoseconds(1));
+void Mail::Impl::DoWork()
+{
+    LOG_INFO("Mail worker thread started");
 
-            if (isMailQueueEmpty) {
-                if ((std::chrono::duration<double, std::milli>(
-                         std::chrono::high_resolution_clock::now() - lastJobTime)).count() // elapsed in milliseconds
-                        > WORKER_THREAD_STOP_IDLE_MILLISECONDS) {
-                    {
-                        boost::lock_guard<boost::mutex> lock(WorkerMutex);
-                        (void)lock;
+    for (;;) {
+        Mail *mail = nullptr;
+        Mail::SendCallback callback = nullptr;
 
-                        WorkerThreadIsRunning = false;
-                        break;
-                    }
+        {
+            boost::unique_lock<boost::mutex> lock(MailMutex);
+
+            while (MailQueue.empty() && !StopRequested) {
+                ++IdleWorkerThreads;
+                const bool timedOut = MailCondition.wait_for(
+                            lock, boost::chrono::milliseconds(SMTP_CONNECTION_IDLE_TIMEOUT))
+                        == boost::cv_status::timeout;
+                --IdleWorkerThreads;
+
+                /// Nobody else would look at the relay connections
+                /// parked by the sleeping workers
+                if (timedOut && MailQueue.empty()) {
+                    lock.unlock();
+                    Connections().Reap();
+                    lock.lock();
                 }
             }
+
+            /// What is already queued still goes out before stopping
+            if (MailQueue.empty())
+                break;
+
+            mail = MailQueue.front();
+            callback = MailCallbackQueue.front();
+
+            MailQueue.pop();
+            MailCallbackQueue.pop();
         }
-    }
 
-    catch (boost::exception &ex) {
-        LOG_ERROR(boost::diagnostic_information(ex));
-    }
+        /// One bad mail must not take the worker down with it; the thread
+        /// would stay counted in WorkerThreads and its slot be lost for good
+        string error;
+        bool notified = false;
 
-    catch (std::exception &ex) {
-        LOG_ERROR(ex.what());
-    }
+        try {
+            bool rc = mail->Send(error);
+            notified = true;
+            if (callback != nullptr) {
+                callback(rc, error);
+            }
+        }
 
-    catch (...) {
-        LOG_ERROR(UNKNOWN_ERROR);
+        catch (boost::exception &ex) {
+            error = boost::diagnostic_information(ex);
+            LOG_ERROR(error);
+        }
+
+        catch (std::exception &ex) {
+            error = ex.what();
+            LOG_ERROR(error);
+        }
+
+        catch (...) {
+            error = UNKNOWN_ERROR;
+            LOG_ERROR(error);
+        }
+
+        /// Whoever waits on the mail still hears about the failure
+        if (!notified && callback != nullptr) {
+            try {
+                callback(false, error);
+            } catch (...) {
+                LOG_ERROR(UNKNOWN_ERROR);
+            }
+        }
+
+        if (mail->GetDeleteLater()) {
+            delete mail;
+        }
     }
 
     LOG_INFO("Mail worker thread stopped");
@@ -281,11 +408,8 @@ bool Mail::Send() const
 bool Mail::Send(std::string &out_error) const
 {
     try {
-#if defined (_WIN32)
-        vmime::platform::setHandler<vmime::platforms::windows::windowsHandler>();
-#else
-        vmime::platform::setHandler<vmime::platforms::posix::posixHandler>();
-#endif /* defined (_WIN32) */
+        /// Also installs the vmime platform handler on first use
+        SharedObjectPool<Impl::SmtpConnection> &connections = Impl::Connections();
 
         vmime::messageBuilder mb;
 
@@ -309,17 +433,13 @@ bool Mail::Send(std::string &out_error) const
 
         vmime::shared_ptr<vmime::message> msg = mb.construct();
 
-        vmime::utility::url url("smtp://localhost");
-#if VMIME_API_MODE == VMIME_LEGACY_API
-        vmime::shared_ptr<vmime::net::session> sess = vmime::make_shared<vmime::net::session>();
-#else
-        vmime::shared_ptr<vmime::net::session> sess = vmime::net::session::create();
-#endif  // VMIME_API_MODE == VMIME_LEGACY_API
-        vmime::shared_ptr<vmime::net::transport> tr = sess->getTransport(url);
+        auto connection = connections.Acquire(boost::chrono::milliseconds(SMTP_CONNECTION_ACQUISITION_TIMEOUT));
 
-        tr->connect();
-        tr->send(msg);
-        tr->disconnect();
+        /// Whatever state a failed transaction left the session in, it must
+        /// not be handed to the next message
+        connection->Broken = true;
+        connection->Transport->send(msg);
+        connection->Broken = false;
 
         return true;
     }
@@ -339,40 +459,110 @@ bool Mail::Send(std::string &out_error) const
     return false;
 }
 
+void Mail::SetMaxWorkers(const std::size_t workers)
+{
+    boost::lock_guard<boost::mutex> lock(Impl::MailMutex);
+    (void)lock;
+
+    Impl::MaxWorkerThreads = std::max<std::size_t>(workers, 1);
+}
+
+void Mail::StopWorkers()
+{
+    std::vector<std::unique_ptr<boost::thread>> workers;
+
+    {
+        boost::lock_guard<boost::mutex> lock(Impl::MailMutex);
+        (void)lock;
+
+        Impl::StopRequested = true;
+        workers.swap(Impl::WorkerThreads);
+    }
+
+    Impl::MailCondition.notify_all();
+
+    for (auto &worker : workers) {
+        worker->join();
+    }
+
+    {
+        boost::lock_guard<boost::mutex> lock(Impl::MailMutex);
+        (void)lock;
+
+        Impl::StopRequested = false;
+    }
+
+    Impl::Connections().Drain();
+}
+
+void Mail::SetSpool(MailSpool *spool)
+{
+    Impl::Spool.store(spool);
+}
+
 void Mail::SendAsync(const SendCallback callback)
 {
+    string error;
+
     try {
-        {
-            boost::lock_guard<boost::mutex> lock(Impl::MailMutex);
-            (void)lock;
+        /// Callbacks cannot survive a restart, so those mails stay in memory;
+        /// so does a mail the spool failed to take
+        MailSpool *spool = Impl::Spool.load();
+        if (callback == nullptr && spool != nullptr && spool->Enqueue(*this)) {
+            if (GetDeleteLater()) {
+                delete this;
+            }
 
-            Impl::MailQueue.push(this);
-            Impl::MailCallbackQueue.push(callback);
+            return;
         }
 
-        {
-            boost::lock_guard<boost::mutex> lock(Impl::WorkerMutex);
-            (void)lock;
-
-            if (!Impl::WorkerThreadIsRunning) {
-                Impl::WorkerThreadIsRunning = true;
+        boost::lock_guard<boost::mutex> lock(Impl::MailMutex);
+        (void)lock;
 
-                Impl::WorkerThread = make_unique<boost::thread>(Mail::Impl::DoWork);
-                Impl::WorkerThread->detach();
+        if (!Impl::StopRequested) {
+            /// Another worker only gets started when the sleeping ones are not
+            /// enough for what is waiting; it stays around afterwards. It is
+            /// started first, so a failure leaves nothing behind in the queue.
+            if (Impl::IdleWorkerThreads <= Impl::MailQueue.size()
+                    && Impl::WorkerThreads.size() < Impl::MaxWorkerThreads) {
+                Impl::WorkerThreads.push_back(make_unique<boost::thread>(Mail::Impl::DoWork));
             }
+
+            Impl::MailQueue.push(this);
+            Impl::MailCallbackQueue.push(callback);
+
+            Impl::MailCondition.notify_one();
+
+            return;
         }
+
+        /// The workers may have drained the queue for the last time already
+        error = "Mail workers are stopping!";
+        LOG_ERROR(error, GetTo());
     }
 
     catch (boost::exception &ex) {
-        LOG_ERROR(boost::diagnostic_information(ex));
+        error = boost::diagnostic_information(ex);
+        LOG_ERROR(error);
     }
 
     catch (std::exception &ex) {
-        LOG_ERROR(ex.what());
+        error = ex.what();
+        LOG_ERROR(error);
     }
 
     catch (...) {
-        LOG_ERROR(UNKNOWN_ERROR);
+        error = UNKNOWN_ERROR;
+        LOG_ERROR(error);
+    }
+
+    /// Whoever waits on the mail still has to hear about it
+    if (callback != nullptr) {
+        callback(false, error);
+    }
+
+    if (GetDeleteLater()) {
+        delete this;
     }
 }
 
@@ -37,6 +37,7 @@
 #define CORELIB_MAILER_HPP
 
 
+#include <cstddef>
 #include <functional>
 #include <memory>
 #include <string>
@@ -44,6 +45,7 @@
 
 namespace CoreLib {
 class Mail;
+class MailSpool;
 }
 
 class CoreLib::Mail
@@ -81,7 +83,21 @@ public:
     bool Send() const;
     bool Send(std::string &out_error) const;
 
+    /// callback gets called exactly once, with an error if the mail could not
+    /// even be queued, e.g. while the workers are stopping
     void SendAsync(const SendCallback callback = nullptr);
+
+    /// Upper bound on the threads draining the SendAsync() queue in parallel;
+    /// they are started on demand and sleep while the queue is empty
+    static void SetMaxWorkers(const std::size_t workers);
+
+    /// Sends out whatever is still queued, then joins the workers and closes
+    /// the relay connections
+    static void StopWorkers();
+
+    /// Once set, SendAsync() without a callback persists the mail in the spool
+    /// instead of the in-memory queue; pass nullptr to go back
+    static void SetSpool(MailSpool *spool);
 };
 
 
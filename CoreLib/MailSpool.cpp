@@ -0,0 +1,379 @@
+/**
+ * @file
+ * @author  Mamadou Babaei <info@babaei.net>
+ * @version 0.1.0
+ *
+ * @section LICENSE
+ *
+ * (The MIT License)
+ *
+ * Copyright (c) 2016 - 2021 Mamadou Babaei
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * A durable mail queue kept in a database table. Any number of processes may
+ * drain the same table; each worker leases a batch of rows at a time, skipping
+ * the ones leased by others, and deletes them once they are sent. Rows of a
+ * worker that died come back once their lease runs out, so every mail goes
+ * out at least once.
+ */
+
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <boost/algorithm/string.hpp>
+#include <boost/exception/diagnostic_information.hpp>
+#include <boost/format.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <pqxx/pqxx>
+#include "make_unique.hpp"
+#include "Log.hpp"
+#include "Mail.hpp"
+#include "MailSpool.hpp"
+#include "Random.hpp"
+#include "Stopwatch.hpp"
+
+#define     UNKNOWN_ERROR           "Unknown error!"
+
+using namespace std;
+using namespace boost;
+using namespace CoreLib;
+
+struct MailSpool::Impl
+{
+    struct Entry
+    {
+        std::string Id;
+        std::string From;
+        std::string To;
+        std::string Subject;
+        std::string Body;
+        std::vector<std::string> Attachments;
+        std::size_t Attempts;
+    };
+
+    Database &DatabaseInstance;
+    const std::string TableId;
+    const std::size_t BatchSize;
+    const boost::chrono::milliseconds LeaseTimeout;
+    const boost::chrono::milliseconds PollInterval;
+    const std::size_t MaxAttempts;
+
+    bool Running;
+    std::vector<std::unique_ptr<boost::thread>> Workers;
+
+    boost::mutex Mutex;
+    boost::condition_variable WorkCondition;
+
+    Impl(Database &database,
+         const std::string &tableId,
+         const std::size_t batchSize,
+         const boost::chrono::milliseconds &leaseTimeout,
+         const boost::chrono::milliseconds &pollInterval,
+         const std::size_t maxAttempts);
+
+    void DoWork();
+
+    /// Returns the number of mails claimed, sent or not
+    std::size_t ProcessBatch();
+    bool Claim(const std::string &token, std::vector<Entry> &out_entries);
+    void Settle(const std::string &token,
+                const std::vector<std::string> &sent,
+                const std::vector<std::pair<std::string, std::string>> &failed);
+};
+
+MailSpool::MailSpool(Database &database,
+                     const std::string &tableId,
+                     const std::size_t batchSize,
+                     const boost::chrono::milliseconds &leaseTimeout,
+                     const boost::chrono::milliseconds &pollInterval,
+                     const std::size_t maxAttempts)
+    : m_pimpl(make_unique<MailSpool::Impl>(database, tableId, batchSize,
+                                           leaseTimeout, pollInterval, maxAttempts))
+{
+
+}
+
+MailSpool::~MailSpool()
+{
+    Stop();
+}
+
+bool MailSpool::Enqueue(Mail &mail)
+{
+    const bool succeed = m_pimpl->DatabaseInstance.Insert(
+                m_pimpl->TableId,
+                DATABASE_COLUMNS("sender, recipient, subject, body, attachments"),
+                mail.GetFrom(), mail.GetTo(), mail.GetSubject(), mail.GetBody(),
+                algorithm::join(mail.GetAttachments(), "\n"));
+
+    /// Inside a unit of work the row is not visible yet, in which case the
+    /// worker simply finds nothing and goes back to sleep
+    if (succeed)
+        m_pimpl->WorkCondition.notify_one();
+
+    return succeed;
+}
+
+void MailSpool::Start(const std::size_t workers)
+{
+    boost::lock_guard<boost::mutex> lock(m_pimpl->Mutex);
+    (void)lock;
+
+    if (m_pimpl->Running)
+        return;
+
+    m_pimpl->Running = true;
+
+    for (std::size_t i = 0; i < std::max<std::size_t>(workers, 1); ++i) {
+        m_pimpl->Workers.push_back(make_unique<boost::thread>(&MailSpool::Impl::DoWork,
+                                                              m_pimpl.get()));
+    }
+}
+
+void MailSpool::Stop()
+{
+    std::vector<std::unique_ptr<boost::thread>> workers;
+
+    {
+        boost::lock_guard<boost::mutex> lock(m_pimpl->Mutex);
+        (void)lock;
+
+        if (!m_pimpl->Running)
+            return;
+
+        m_pimpl->Running = false;
+        workers.swap(m_pimpl->Workers);
+    }
+
+    m_pimpl->WorkCondition.notify_all();
+
+    for (auto &worker : workers) {
+        worker->join();
+    }
+}
+
+MailSpool::Impl::Impl(Database &database,
+                      const std::string &tableId,
+                      const std::size_t batchSize,
+                      const boost::chrono::milliseconds &leaseTimeout,
+                      const boost::chrono::milliseconds &pollInterval,
+                      const std::size_t maxAttempts)
+    : DatabaseInstance(database),
+      TableId(tableId),
+      BatchSize(batchSize > 0 ? batchSize : 1),
+      LeaseTimeout(leaseTimeout),
+      PollInterval(pollInterval),
+      MaxAttempts(maxAttempts > 0 ? maxAttempts : 1),
+      Running(false)
+{
+
+}
+
+void MailSpool::Impl::DoWork()
+{
+    LOG_INFO("Mail spool worker thread started");
+
+    boost::unique_lock<boost::mutex> lock(Mutex);
+
+    while (Running) {
+        lock.unlock();
+        const std::size_t claimed = ProcessBatch();
+        lock.lock();
+
+        /// A full batch means there is probably more waiting, so only a short
+        /// one puts the worker to sleep; other processes' mails are only
+        /// noticed on the timer
+        if (claimed < BatchSize && Running)
+            WorkCondition.wait_for(lock, PollInterval);
+    }
+
+    LOG_INFO("Mail spool worker thread stopped");
+}
+
+std::size_t MailSpool::Impl::ProcessBatch()
+{
+    std::string token;
+    Random::Uuid(token);
+
+    std::vector<Entry> entries;
+    if (!Claim(token, entries))
+        return 0;
+
+    std::vector<std::string> sent;
+    std::vector<std::pair<std::string, std::string>> failed;
+
+    for (const auto &entry : entries) {
+        /// Every claim counts as an attempt, so a mail which keeps taking its
+        /// worker down never gets the chance to report a failure
+        if (entry.Attempts > MaxAttempts) {
+            failed.emplace_back(entry.Id, "Lease ran out on every attempt!");
+            continue;
+        }
+
+        Mail mail(entry.From, entry.To, entry.Subject, entry.Body, entry.Attachments);
+
+        std::string error;
+        if (mail.Send(error)) {
+            sent.push_back(entry.Id);
+        } else {
+            failed.emplace_back(entry.Id, error);
+        }
+    }
+
+    Settle(token, sent, failed);
+
+    return entries.size();
+}
+
+bool MailSpool::Impl::Claim(const std::string &token, std::vector<Entry> &out_entries)
+{
+    out_entries.clear();
+
+    try {
+        auto conn = DatabaseInstance.Connection();
+        pqxx::work txn(*conn.get());
+
+        /// available_at doubles as the lease expiry, so rows of a dead worker
+        /// become available again on their own
+        const std::string table(txn.esc(DatabaseInstance.GetTableName(TableId)));
+
+        Stopwatch<> stopwatch;
+        pqxx::result r = txn.exec_params(
+                    (format("UPDATE \"%1%\" SET lease_token = $1::UUID,"
+                            " available_at = NOW() + $2::BIGINT * INTERVAL '1 millisecond',"
+                            " attempts = attempts + 1"
+                            " WHERE id IN ( SELECT id FROM \"%1%\" WHERE available_at <= NOW()"
+                            " ORDER BY available_at LIMIT $3::BIGINT FOR UPDATE SKIP LOCKED )"
+                            " RETURNING id, sender, recipient, subject, body, attachments, attempts;")
+                     % table).str(),
+                    token,
+                    static_cast<long long>(LeaseTimeout.count()),
+                    static_cast<long long>(BatchSize));
+        DatabaseInstance.RecordMetric(Database::Metric::Execute, TableId, stopwatch.Stop());
+
+        DatabaseInstance.Commit(txn, TableId);
+
+        out_entries.reserve(r.size());
+        for (const auto &row : r) {
+            Entry entry;
+            entry.Id = row["id"].c_str();
+            entry.From = row["sender"].c_str();
+            entry.To = row["recipient"].c_str();
+            entry.Subject = row["subject"].c_str();
+            entry.Body = row["body"].c_str();
+            if (!row["attachments"].is_null() && row["attachments"].size() > 0) {
+                algorithm::split(entry.Attachments, row["attachments"].c_str(), is_any_of("\n"));
+            }
+            entry.Attempts = row["attempts"].as<std::size_t>();
+            out_entries.push_back(std::move(entry));
+        }
+
+        return !out_entries.empty();
+    }
+
+    catch (const pqxx::sql_error &ex) {
+        LOG_ERROR(ex.what(), ex.query());
+    }
+
+    catch (const boost::exception &ex) {
+        LOG_ERROR(boost::diagnostic_information(ex));
+    }
+
+    catch (const std::exception &ex) {
+        LOG_ERROR(ex.what());
+    }
+
+    catch (...) {
+        LOG_ERROR(UNKNOWN_ERROR);
+    }
+
+    return false;
+}
+
+void MailSpool::Impl::Settle(const std::string &token,
+                             const std::vector<std::string> &sent,
+                             const std::vector<std::pair<std::string, std::string>> &failed)
+{
+    try {
+        auto conn = DatabaseInstance.Connection();
+        pqxx::work txn(*conn.get());
+
+        const std::string table(txn.esc(DatabaseInstance.GetTableName(TableId)));
+
+        Stopwatch<> stopwatch;
+
+        /// A worker whose lease ran out meanwhile touches nothing; the mail is
+        /// someone else's by now and goes out once more
+        if (!sent.empty()) {
+            txn.exec_params((format("DELETE FROM \"%1%\""
+                                    " WHERE id = ANY ( $1::BIGINT[] ) AND lease_token = $2::UUID;")
+                             % table).str(),
+                            "{" + algorithm::join(sent, ",") + "}",
+                            token);
+        }
+
+        for (const auto &f : failed) {
+            pqxx::result r = txn.exec_params(
+                        (format("UPDATE \"%1%\" SET lease_token = NULL, last_error = $3,"
+                                " available_at = CASE WHEN attempts >= $4::BIGINT"
+                                " THEN TIMESTAMPTZ 'infinity'"
+                                " ELSE NOW() + LEAST(attempts * attempts, 60) * INTERVAL '1 minute' END"
+                                " WHERE id = $1::BIGINT AND lease_token = $2::UUID"
+                                " RETURNING recipient, attempts;")
+                         % table).str(),
+                        f.first, token, f.second,
+                        static_cast<long long>(MaxAttempts));
+
+            if (!r.empty() && r[0]["attempts"].as<std::size_t>() >= MaxAttempts) {
+                LOG_ERROR("Mail parked in the spool for good!", f.first, r[0]["recipient"].c_str(), f.second);
+            }
+        }
+
+        DatabaseInstance.RecordMetric(Database::Metric::Execute, TableId, stopwatch.Stop());
+
+        DatabaseInstance.Commit(txn, TableId);
+
+        return;
+    }
+
+    catch (const pqxx::sql_error &ex) {
+        LOG_ERROR(ex.what(), ex.query());
+    }
+
+    catch (const boost::exception &ex) {
+        LOG_ERROR(boost::diagnostic_information(ex));
+    }
+
+    catch (const std::exception &ex) {
+        LOG_ERROR(ex.what());
+    }
+
+    catch (...) {
+        LOG_ERROR(UNKNOWN_ERROR);
+    }
+
+    LOG_WARNING("Mail spool batch left to its lease!", (format("Sent: %1%, Failed: %2%")
+                                                        % sent.size() % failed.size()).str());
+}
@@ -0,0 +1,93 @@
+/**
+ * @file
+ * @author  Mamadou Babaei <info@babaei.net>
+ * @version 0.1.0
+ *
+ * @section LICENSE
+ *
+ * (The MIT License)
+ *
+ * Copyright (c) 2016 - 2021 Mamadou Babaei
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * A durable mail queue kept in a database table. Any number of processes may
+ * drain the same table; each worker leases a batch of rows at a time, skipping
+ * the ones leased by others, and deletes them once they are sent. Rows of a
+ * worker that died come back once their lease runs out, so every mail goes
+ * out at least once.
+ */
+
+
+#ifndef CORELIB_MAIL_SPOOL_HPP
+#define CORELIB_MAIL_SPOOL_HPP
+
+
+#include <memory>
+#include <string>
+#include <cstddef>
+#include <boost/chrono/chrono.hpp>
+#include "Database.hpp"
+
+namespace CoreLib {
+class Mail;
+class MailSpool;
+}
+
+class CoreLib::MailSpool
+{
+private:
+    struct Impl;
+    std::unique_ptr<Impl> m_pimpl;
+
+public:
+    /// The table registered as tableId must provide the columns
+    ///   id BIGSERIAL PRIMARY KEY, sender TEXT, recipient TEXT, subject TEXT,
+    ///   body TEXT, attachments TEXT, available_at TIMESTAMPTZ DEFAULT NOW(),
+    ///   attempts INTEGER DEFAULT 0, lease_token UUID, last_error TEXT
+    /// leaseTimeout has to cover sending a whole batch; a mail still failing
+    /// after maxAttempts is parked for good with its last error.
+    MailSpool(Database &database,
+              const std::string &tableId,
+              const std::size_t batchSize,
+              const boost::chrono::milliseconds &leaseTimeout,
+              const boost::chrono::milliseconds &pollInterval,
+              const std::size_t maxAttempts);
+    virtual ~MailSpool();
+
+    MailSpool(const MailSpool &) = delete;
+    MailSpool &operator=(const MailSpool &) = delete;
+
+public:
+    /// Inside a unit of work the mail is only spooled if the unit commits.
+    /// Attachments are stored as paths, so they have to be reachable by every
+    /// process draining the spool.
+    bool Enqueue(Mail &mail);
+
+    /// Starts the workers of this process; does nothing if already started
+    void Start(const std::size_t workers);
+    /// Finishes the batches in flight and joins the workers; whatever is left
+    /// stays in the table for the next run or another process
+    void Stop();
+};
+
+
+#endif /* CORELIB_MAIL_SPOOL_HPP */
@@ -37,10 +37,21 @@
 #define CORELIB_SHARED_OBJECT_POOL_HPP
 
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
 #include <memory>
-#include <stack>
 #include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/chrono/chrono.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <boost/thread/lock_guard.hpp>
+#include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
 #include "Exception.hpp"
 
@@ -53,81 +64,735 @@ template <typename _T, typename _D>
 class CoreLib::SharedObjectPool
 {
 private:
+    typedef boost::chrono::steady_clock Clock;
+
     struct ReturnToPoolDeleter {
     private:
         std::weak_ptr<SharedObjectPool<_T, _D> *> m_pool;
+        Clock::time_point m_birth;
 
     public:
-        explicit ReturnToPoolDeleter(const std::weak_ptr<SharedObjectPool<_T, _D> *> pool = { })
-            : m_pool(pool) {
+        explicit ReturnToPoolDeleter(const std::weak_ptr<SharedObjectPool<_T, _D> *> pool = { },
+                                     const Clock::time_point &birth = Clock::time_point())
+            : m_pool(pool),
+              m_birth(birth) {
 
         }
 
         void operator()(_T *ptr) {
             if (auto poolPtr = m_pool.lock()) {
                 std::unique_ptr<_T, _D> uptr{ptr};
-                (*poolPtr.get())->Add(uptr);
+                (*poolPtr.get())->Return(uptr, m_birth);
             } else {
                 _D{}(ptr);
             }
         }
     };
 
+    struct Entry {
+        std::unique_ptr<_T, _D> Object;
+        Clock::time_point IdleSince;
+    };
+
+    /// Holds at most one idle object for the threads mapped to it. The
+    /// pointer doubles as a tiny lock: whoever swaps in the busy marker owns
+    /// the time stamps until it stores the next value.
+    struct CacheSlot {
+        std::atomic<_T *> Object;
+        Clock::time_point IdleSince;
+        Clock::time_point Birth;
+
+        CacheSlot()
+            : Object(nullptr) {
+
+        }
+
+        _T *Busy() const {
+            return reinterpret_cast<_T *>(const_cast<CacheSlot *>(this));
+        }
+
+        bool Occupied() const {
+            _T *object = Object.load();
+            return object != nullptr && object != Busy();
+        }
+
+        bool TryPut(std::unique_ptr<_T, _D> &uptr, const Clock::time_point &idleSince,
+                    const Clock::time_point &birth) {
+            _T *expected = nullptr;
+            if (!Object.compare_exchange_strong(expected, Busy())) {
+                return false;
+            }
+
+            IdleSince = idleSince;
+            Birth = birth;
+            Object.store(uptr.release());
+
+            return true;
+        }
+
+        bool TryTake(std::unique_ptr<_T, _D> &uptr, Clock::time_point &idleSince,
+                     Clock::time_point &birth) {
+            _T *object = Object.load();
+            if (object == nullptr || object == Busy()
+                    || !Object.compare_exchange_strong(object, Busy())) {
+                return false;
+            }
+
+            idleSince = IdleSince;
+            birth = Birth;
+            Object.store(nullptr);
+
+            uptr.reset(object);
+
+            return true;
+        }
+    };
+
+    /// Threads get a slot each in the order they first touch a pool, so up to
+    /// this many threads never share one.
+    static constexpr std::size_t CACHE_SLOTS = 64;
+
 public:
     using ptrType = std::unique_ptr<_T, ReturnToPoolDeleter>;
+    using uptrType = std::unique_ptr<_T, _D>;
+
+    typedef std::function<uptrType()> FactoryType;
+    typedef std::function<void(_T &)> DisposerType;
+    typedef std::function<bool(_T &, const boost::chrono::milliseconds &)> BorrowValidatorType;
+    typedef std::function<bool(_T &)> ReturnValidatorType;
 
 private:
     std::shared_ptr<SharedObjectPool<_T, _D> *> m_thisPtr;
-    std::stack<std::unique_ptr<_T, _D>> m_pool;
-    boost::mutex m_mutex;
+
+    /// Most recently returned objects sit at the back and are handed out
+    /// first, so the ones at the front are the longest idle.
+    std::deque<Entry> m_pool;
+    mutable boost::mutex m_mutex;
+
+    /// An object returned on a thread is parked in that thread's slot, so the
+    /// next acquire on the same thread gets it back without the mutex.
+    std::array<CacheSlot, CACHE_SLOTS> m_cache;
+
+    /// Blocked callers are served strictly in arrival order, so the deque
+    /// holds their tickets and only the front one may take an object.
+    boost::condition_variable m_condition;
+    std::deque<std::uint64_t> m_waiters;
+    std::uint64_t m_nextTicket;
+
+    /// Callers on the locked path; while there are any, returned objects
+    /// skip the cache slots and go where the waiters can see them.
+    std::atomic<std::size_t> m_waiting;
+
+    /// Every live object, whether idle or borrowed, and its creation time
+    std::unordered_map<const _T *, Clock::time_point> m_births;
+    /// Objects being created by the factory outside the lock
+    std::size_t m_pending;
+
+    std::atomic<std::uint64_t> m_acquisitions;
+    std::atomic<std::uint64_t> m_cacheHits;
+    std::atomic<std::uint64_t> m_locks;
+    std::atomic<std::uint64_t> m_contentions;
+
+    FactoryType m_factory;
+    DisposerType m_disposer;
+    BorrowValidatorType m_borrowValidator;
+    ReturnValidatorType m_returnValidator;
+    std::size_t m_minSize;
+    std::size_t m_maxSize;
+    boost::chrono::milliseconds m_idleTimeout;
+    boost::chrono::milliseconds m_maxLifetime;
 
 public:
     SharedObjectPool()
-        : m_thisPtr(std::make_shared<SharedObjectPool<_T, _D> *>(this)) {
+        : m_thisPtr(std::make_shared<SharedObjectPool<_T, _D> *>(this)),
+          m_nextTicket(0),
+          m_waiting(0),
+          m_pending(0),
+          m_acquisitions(0),
+          m_cacheHits(0),
+          m_locks(0),
+          m_contentions(0),
+          m_minSize(0),
+          m_maxSize(std::numeric_limits<std::size_t>::max()),
+          m_idleTimeout(boost::chrono::milliseconds::zero()),
+          m_maxLifetime(boost::chrono::milliseconds::zero()) {
 
     }
 
     virtual ~SharedObjectPool(){
-
+        for (auto &slot : m_cache) {
+            uptrType object;
+            Clock::time_point idleSince;
+            Clock::time_point birth;
+            slot.TryTake(object, idleSince, birth);
+        }
     }
 
 public:
-    void Add(std::unique_ptr<_T, _D> &uptr) {
+    /// Creates new objects on demand once the idle ones run out, as long as
+    /// the pool has not reached its maximum size.
+    void SetFactory(const FactoryType &factory) {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        (void)lock;
+
+        m_factory = factory;
+    }
+
+    /// Gets called right before an object gets destroyed by the pool
+    void SetDisposer(const DisposerType &disposer) {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        (void)lock;
+
+        m_disposer = disposer;
+    }
+
+    /// Gets called outside the lock with how long the object sat idle before
+    /// it is handed out; returning false discards the object and moves on.
+    void SetBorrowValidator(const BorrowValidatorType &validator) {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        (void)lock;
+
+        m_borrowValidator = validator;
+    }
+
+    /// Gets called outside the lock once an object is given back; returning
+    /// false discards the object instead of putting it back into the pool.
+    void SetReturnValidator(const ReturnValidatorType &validator) {
         boost::lock_guard<boost::mutex> lock(m_mutex);
         (void)lock;
 
-        m_pool.push(std::move(uptr));
+        m_returnValidator = validator;
+    }
+
+    void SetLimits(const std::size_t minSize, const std::size_t maxSize) {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        (void)lock;
+
+        m_minSize = minSize;
+        m_maxSize = std::max(minSize, maxSize);
+    }
+
+    /// A zero duration disables idle reaping
+    void SetIdleTimeout(const boost::chrono::milliseconds &timeout) {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        (void)lock;
+
+        m_idleTimeout = timeout;
+    }
+
+    /// A zero duration lets objects live forever
+    void SetMaxLifetime(const boost::chrono::milliseconds &lifetime) {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        (void)lock;
+
+        m_maxLifetime = lifetime;
+    }
+
+    void Add(uptrType &uptr) {
+        {
+            boost::unique_lock<boost::mutex> lock(m_mutex, boost::defer_lock);
+            Lock(lock);
+
+            const Clock::time_point now = Clock::now();
+            m_births.emplace(uptr.get(), now);
+            m_pool.push_back(Entry{ std::move(uptr), now });
+        }
+
+        m_condition.notify_all();
     }
 
     ptrType Acquire() {
+        return Acquire(boost::chrono::milliseconds::zero());
+    }
+
+    /// Blocks until an object is available or the timeout expires, in which
+    /// case an exception is thrown. Waiters are served in FIFO order.
+    ptrType Acquire(const boost::chrono::milliseconds &timeout) {
+        const Clock::time_point deadline = Clock::now() + timeout;
+
+        ++m_acquisitions;
+
+        for (;;) {
+            uptrType object;
+            boost::chrono::milliseconds idle(boost::chrono::milliseconds::zero());
+            Clock::time_point birth;
+
+            bool created = false;
+            if (TakeCached(object, idle, birth)) {
+                ++m_cacheHits;
+            } else {
+                created = Take(deadline, object, idle, birth);
+            }
+
+            /// Fresh objects are trusted, reused ones have to pass the check
+            if (!created && m_borrowValidator && !m_borrowValidator(*object.get(), idle)) {
+                Discard(object);
+                continue;
+            }
+
+            return ptrType(object.release(),
+                           ReturnToPoolDeleter{
+                               std::weak_ptr<SharedObjectPool<_T, _D> *>{m_thisPtr}, birth});
+        }
+    }
+
+    /// Hands out an idle object right away, or an empty pointer if there is
+    /// none; never waits, never jumps the queue of blocked callers and never
+    /// calls the factory.
+    ptrType TryAcquire() {
+        ++m_acquisitions;
+
+        for (;;) {
+            uptrType object;
+            boost::chrono::milliseconds idle(boost::chrono::milliseconds::zero());
+            Clock::time_point birth;
+
+            if (TakeCached(object, idle, birth)) {
+                ++m_cacheHits;
+            } else if (!TakeIdle(object, idle, birth)) {
+                return ptrType();
+            }
+
+            if (m_borrowValidator && !m_borrowValidator(*object.get(), idle)) {
+                Discard(object);
+                continue;
+            }
+
+            return ptrType(object.release(),
+                           ReturnToPoolDeleter{
+                               std::weak_ptr<SharedObjectPool<_T, _D> *>{m_thisPtr}, birth});
+        }
+    }
+
+    /// Destroys the idle objects past their idle timeout or lifetime
+    void Reap() {
+        std::vector<uptrType> expired;
+
+        {
+            boost::unique_lock<boost::mutex> lock(m_mutex, boost::defer_lock);
+            Lock(lock);
+
+            Reap(expired);
+        }
+
+        /// Objects moved out of the cache slots are visible to waiters now
+        m_condition.notify_all();
+
+        Dispose(expired);
+    }
+
+    /// Hands all the idle objects over to the caller
+    std::vector<uptrType> Drain() {
         boost::lock_guard<boost::mutex> lock(m_mutex);
         (void)lock;
 
-        if (m_pool.empty()) {
-            throw CoreLib::Exception<std::string>("Cannot acquire object from an empty pool.");
+        std::vector<uptrType> objects;
+        objects.reserve(m_pool.size());
+
+        for (auto &e : m_pool) {
+            m_births.erase(e.Object.get());
+            objects.push_back(std::move(e.Object));
         }
+        m_pool.clear();
+
+        for (auto &slot : m_cache) {
+            uptrType object;
+            Clock::time_point idleSince;
+            Clock::time_point birth;
 
-        ptrType tmp(m_pool.top().release(),
-                    ReturnToPoolDeleter{
-                        std::weak_ptr<SharedObjectPool<_T, _D> *>{m_thisPtr}});
-        m_pool.pop();
+            if (slot.TryTake(object, idleSince, birth)) {
+                m_births.erase(object.get());
+                objects.push_back(std::move(object));
+            }
+        }
 
-        return std::move(tmp);
+        return objects;
     }
 
     bool Empty() const
     {
-        return m_pool.empty();
+        return Size() == 0;
     }
 
+    /// Number of idle objects, including the ones parked in the cache slots
     std::size_t Size() const
     {
-        return m_pool.size();
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        (void)lock;
+
+        std::size_t size = m_pool.size();
+        for (auto &slot : m_cache) {
+            if (slot.Occupied()) {
+                ++size;
+            }
+        }
+
+        return size;
+    }
+
+    /// Number of live objects, both idle and borrowed
+    std::size_t Total() const
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        (void)lock;
+
+        return m_births.size() + m_pending;
     }
 
-    std::stack<std::unique_ptr<_T, _D>> &Pool()
+    std::size_t Waiters() const
     {
-        return m_pool;
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        (void)lock;
+
+        return m_waiters.size();
+    }
+
+    /// Number of acquire calls so far
+    std::uint64_t Acquisitions() const
+    {
+        return m_acquisitions.load(std::memory_order_relaxed);
+    }
+
+    /// Number of acquire calls served from the caller's own cache slot
+    std::uint64_t CacheHits() const
+    {
+        return m_cacheHits.load(std::memory_order_relaxed);
+    }
+
+    /// Number of times the acquire and return paths took the mutex
+    std::uint64_t Locks() const
+    {
+        return m_locks.load(std::memory_order_relaxed);
+    }
+
+    /// Number of those times the mutex was already held by another thread
+    std::uint64_t Contentions() const
+    {
+        return m_contentions.load(std::memory_order_relaxed);
+    }
+
+private:
+    static std::size_t ThreadSlot() {
+        static std::atomic<std::size_t> next(0);
+        thread_local const std::size_t slot = next++ % CACHE_SLOTS;
+        return slot;
+    }
+
+    /// Counts how often the mutex had to be waited for
+    void Lock(boost::unique_lock<boost::mutex> &lock) {
+        ++m_locks;
+
+        if (!lock.try_lock()) {
+            ++m_contentions;
+            lock.lock();
+        }
+    }
+
+    bool Expired(const Clock::time_point &now, const Clock::time_point &idleSince,
+                 const Clock::time_point &birth) const {
+        return (m_maxLifetime != boost::chrono::milliseconds::zero()
+                && now - birth >= m_maxLifetime)
+                || (m_idleTimeout != boost::chrono::milliseconds::zero()
+                    && now - idleSince >= m_idleTimeout);
+    }
+
+    /// The lock-free path: takes the object parked in the calling thread's
+    /// slot, if any. Stale objects are handed to the locked path, which
+    /// knows whether the pool can afford to drop them.
+    bool TakeCached(uptrType &object, boost::chrono::milliseconds &idle,
+                    Clock::time_point &birth) {
+        Clock::time_point idleSince;
+
+        if (!m_cache[ThreadSlot()].TryTake(object, idleSince, birth)) {
+            return false;
+        }
+
+        const Clock::time_point now = Clock::now();
+
+        if (Expired(now, idleSince, birth)) {
+            {
+                boost::unique_lock<boost::mutex> lock(m_mutex, boost::defer_lock);
+                Lock(lock);
+
+                m_pool.push_front(Entry{ std::move(object), idleSince });
+            }
+
+            m_condition.notify_all();
+
+            return false;
+        }
+
+        idle = boost::chrono::duration_cast<boost::chrono::milliseconds>(now - idleSince);
+
+        return true;
+    }
+
+    void Return(uptrType &uptr, const Clock::time_point &birth) {
+        if (m_returnValidator && !m_returnValidator(*uptr.get())) {
+            Discard(uptr);
+            return;
+        }
+
+        const Clock::time_point now = Clock::now();
+
+        if (m_waiting == 0
+                && (m_maxLifetime == boost::chrono::milliseconds::zero()
+                    || now - birth < m_maxLifetime)) {
+            CacheSlot &slot = m_cache[ThreadSlot()];
+
+            if (slot.TryPut(uptr, now, birth)) {
+                /// Someone may have started waiting before the object became
+                /// visible in the slot, so move it to the shared pool then.
+                Clock::time_point idleSince;
+                Clock::time_point cachedBirth;
+                if (m_waiting == 0 || !slot.TryTake(uptr, idleSince, cachedBirth)) {
+                    return;
+                }
+            }
+        }
+
+        std::vector<uptrType> expired;
+
+        {
+            boost::unique_lock<boost::mutex> lock(m_mutex, boost::defer_lock);
+            Lock(lock);
+
+            auto it = m_births.find(uptr.get());
+
+            if (it != m_births.end()
+                    && m_maxLifetime != boost::chrono::milliseconds::zero()
+                    && now - it->second >= m_maxLifetime) {
+                m_births.erase(it);
+                expired.push_back(std::move(uptr));
+            } else {
+                if (it == m_births.end()) {
+                    m_births.emplace(uptr.get(), now);
+                }
+                m_pool.push_back(Entry{ std::move(uptr), now });
+            }
+
+            Reap(expired);
+        }
+
+        m_condition.notify_all();
+
+        Dispose(expired);
+    }
+
+    /// Returns true if the object has been freshly created by the factory
+    bool Take(const Clock::time_point &deadline, uptrType &object,
+              boost::chrono::milliseconds &idle, Clock::time_point &birth) {
+        std::vector<uptrType> expired;
+        bool created = false;
+
+        {
+            boost::unique_lock<boost::mutex> lock(m_mutex, boost::defer_lock);
+            Lock(lock);
+
+            const std::uint64_t ticket = m_nextTicket++;
+            m_waiters.push_back(ticket);
+            ++m_waiting;
+
+            bool timedOut = false;
+            for (;;) {
+                if (m_waiters.front() == ticket) {
+                    Reap(expired);
+
+                    if (!m_pool.empty()) {
+                        idle = boost::chrono::duration_cast<boost::chrono::milliseconds>(
+                                    Clock::now() - m_pool.back().IdleSince);
+                        object = std::move(m_pool.back().Object);
+                        m_pool.pop_back();
+                        birth = m_births[object.get()];
+                        break;
+                    }
+
+                    /// Objects parked by other threads are idle too
+                    if (Steal(object, idle, birth)) {
+                        break;
+                    }
+
+                    if (m_factory && m_births.size() + m_pending < m_maxSize) {
+                        /// Reserve the slot now, the object is born outside the lock
+                        ++m_pending;
+                        created = true;
+                        break;
+                    }
+                }
+
+                if (timedOut) {
+                    break;
+                }
+
+                timedOut = (m_condition.wait_until(lock, deadline) == boost::cv_status::timeout);
+            }
+
+            --m_waiting;
+            m_waiters.erase(std::find(m_waiters.begin(), m_waiters.end(), ticket));
+        }
+
+        /// Whoever is next in line might be able to proceed now
+        m_condition.notify_all();
+
+        Dispose(expired);
+
+        if (created) {
+            try {
+                object = Create(birth);
+            } catch (...) {
+                {
+                    boost::unique_lock<boost::mutex> lock(m_mutex, boost::defer_lock);
+                    Lock(lock);
+
+                    --m_pending;
+                }
+
+                m_condition.notify_all();
+                throw;
+            }
+        }
+
+        if (!object) {
+            throw CoreLib::Exception<std::string>("Timed out acquiring object from the pool.");
+        }
+
+        return created;
+    }
+
+    /// The non-blocking counterpart of Take(); only ever hands out idle objects
+    bool TakeIdle(uptrType &object, boost::chrono::milliseconds &idle,
+                  Clock::time_point &birth) {
+        std::vector<uptrType> expired;
+        bool taken = false;
+
+        {
+            boost::unique_lock<boost::mutex> lock(m_mutex, boost::defer_lock);
+            Lock(lock);
+
+            if (m_waiters.empty()) {
+                Reap(expired);
+
+                if (!m_pool.empty()) {
+                    idle = boost::chrono::duration_cast<boost::chrono::milliseconds>(
+                                Clock::now() - m_pool.back().IdleSince);
+                    object = std::move(m_pool.back().Object);
+                    m_pool.pop_back();
+                    birth = m_births[object.get()];
+                    taken = true;
+                } else {
+                    taken = Steal(object, idle, birth);
+                }
+            }
+        }
+
+        Dispose(expired);
+
+        return taken;
+    }
+
+    /// Must be called with the lock held
+    bool Steal(uptrType &object, boost::chrono::milliseconds &idle,
+               Clock::time_point &birth) {
+        for (auto &slot : m_cache) {
+            Clock::time_point idleSince;
+
+            if (slot.TryTake(object, idleSince, birth)) {
+                idle = boost::chrono::duration_cast<boost::chrono::milliseconds>(
+                            Clock::now() - idleSince);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /// Destroys an object which is not idle in the pool anymore
+    void Discard(uptrType &uptr) {
+        {
+            boost::unique_lock<boost::mutex> lock(m_mutex, boost::defer_lock);
+            Lock(lock);
+
+            m_births.erase(uptr.get());
+        }
+
+        /// Its slot is free now, so a waiter may create a replacement
+        m_condition.notify_all();
+
+        std::vector<uptrType> objects;
+        objects.push_back(std::move(uptr));
+        Dispose(objects);
+    }
+
+    uptrType Create(Clock::time_point &birth) {
+        uptrType object(m_factory());
+
+        if (!object) {
+            throw CoreLib::Exception<std::string>("Pool factory failed to create a new object.");
+        }
+
+        boost::unique_lock<boost::mutex> lock(m_mutex, boost::defer_lock);
+        Lock(lock);
+
+        --m_pending;
+        birth = Clock::now();
+        m_births.emplace(object.get(), birth);
+
+        return object;
+    }
+
+    /// Must be called with the lock held
+    void Reap(std::vector<uptrType> &expired) {
+        const Clock::time_point now = Clock::now();
+
+        /// Parked objects of threads which went quiet would never be looked
+        /// at otherwise, so the stale ones move to the front of the shared
+        /// pool to be judged along with the rest.
+        if (m_maxLifetime != boost::chrono::milliseconds::zero()
+                || m_idleTimeout != boost::chrono::milliseconds::zero()) {
+            for (auto &slot : m_cache) {
+                uptrType object;
+                Clock::time_point idleSince;
+                Clock::time_point birth;
+
+                if (!slot.Occupied() || !slot.TryTake(object, idleSince, birth)) {
+                    continue;
+                }
+
+                if (!Expired(now, idleSince, birth)
+                        && slot.TryPut(object, idleSince, birth)) {
+                    continue;
+                }
+
+                m_pool.push_front(Entry{ std::move(object), idleSince });
+            }
+        }
+
+        for (auto it = m_pool.begin(); it != m_pool.end(); ) {
+            const bool tooOld = m_maxLifetime != boost::chrono::milliseconds::zero()
+                    && now - m_births[it->Object.get()] >= m_maxLifetime
+                    && m_births.size() + m_pending > m_minSize;
+            const bool tooIdle = m_idleTimeout != boost::chrono::milliseconds::zero()
+                    && now - it->IdleSince >= m_idleTimeout
+                    && m_births.size() + m_pending > m_minSize;
+
+            if (tooOld || tooIdle) {
+                m_births.erase(it->Object.get());
+                expired.push_back(std::move(it->Object));
+                it = m_pool.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void Dispose(std::vector<uptrType> &objects) {
+        for (auto &o : objects) {
+            if (m_disposer) {
+                m_disposer(*o.get());
+            }
+            o.reset();
+        }
+        objects.clear();
     }
 };
 
@@ -111,6 +111,10 @@ public:
                 void ToJson(std::string &out_string) const;
                 std::string ToJson() const;
 
+                /// Column values of a GEO_SNAPSHOTS row, snapshot_id first; the id
+                /// is derived from the rest, so equal locations share one row
+                bool ToSnapshot(std::vector<std::string> &out_values) const;
+
             private:
                 friend class cereal::access;
                 template<class Archive>
@@ -38,6 +38,7 @@
 #include <boost/format.hpp>
 #include <pqxx/pqxx>
 #include <Wt/WApplication>
+#include <Wt/WServer>
 #include <Wt/WContainerWidget>
 #include <Wt/WSignalMapper>
 #include <Wt/WStackedWidget>
@@ -81,6 +82,9 @@ public:
 
     SysMon *SystemMonitor;
 
+    /// Async completions check it before touching this object
+    std::shared_ptr<bool> Alive;
+
 public:
     Impl();
     ~Impl();
@@ -92,6 +96,8 @@ public:
     void ValidateSession();
 
 private:
+    void OnSessionValidated(const CoreLib::Database::AsyncResult &result);
+
     void ForceExit();
 };
 
@@ -102,6 +108,10 @@ Cms::Cms()
     WApplication *app = WApplication::instance();
     app->setTitle(tr("cms-page-title"));
 
+    /// Session validation completes asynchronously and may have to push a
+    /// forced exit to the browser
+    app->enableUpdates(true);
+
     this->clear();
     this->setId("CmsPage");
     this->setStyleClass("cms-page container-fluid");
@@ -226,7 +236,8 @@ WWidget *Cms::Layout()
 }
 
 Cms::Impl::Impl()
-    : LastSelectedMenuItem(nullptr)
+    : LastSelectedMenuItem(nullptr),
+      Alive(std::make_shared<bool>(true))
 {
 
 }
@@ -293,36 +304,67 @@ void Cms::Impl::ValidateSession()
     CgiEnv *cgiEnv = cgiRoot->GetCgiEnvInstance();
 
     try {
-        auto conn = Pool::Database().Connection();
-        pqxx::work txn(*conn.get());
+        /// The query runs on the server's event loop and the outcome is posted
+        /// back to this session, so no worker thread sits waiting on it
+        WServer *server = WServer::instance();
+        const string sessionId(WApplication::instance()->sessionId());
+        const std::weak_ptr<bool> alive(Alive);
+
+        LOG_INFO("Running prepared statement...", "ROOT_SESSIONS_SELECT_EXPIRY_BY_TOKEN", cgiEnv->GetInformation().ToJson());
+
+        Pool::Database().ExecutePreparedAsync("ROOT_SESSIONS_SELECT_EXPIRY_BY_TOKEN",
+        { cgiEnv->GetInformation().Client.Session.Token },
+        [server, sessionId](const std::function<void()> &function) {
+            server->post(sessionId, function);
+        },
+        [this, alive](const CoreLib::Database::AsyncResult &result) {
+            if (alive.expired())
+                return;
+
+            this->OnSessionValidated(result);
+        });
+    }
 
-        string query((boost::format("SELECT EXTRACT ( EPOCH FROM expiry::TIMESTAMPTZ ) as expiry FROM \"%1%\""
-                                    " WHERE token = %2%;")
-                      % txn.esc(Service::Pool::Database().GetTableName("ROOT_SESSIONS"))
-                      % txn.quote(cgiEnv->GetInformation().Client.Session.Token)).str());
-        LOG_INFO("Running query...", query, cgiEnv->GetInformation().ToJson());
+    catch (const boost::exception &ex) {
+        LOG_ERROR(boost::diagnostic_information(ex), cgiEnv->GetInformation().ToJson());
+    }
 
-        result r = txn.exec(query);
+    catch (const std::exception &ex) {
+        LOG_ERROR(ex.what(), cgiEnv->GetInformation().ToJson());
+    }
+
+    catch (...) {
+        LOG_ERROR(UNKNOWN_ERROR, cgiEnv->GetInformation().ToJson());
+    }
+}
+
+void Cms::Impl::OnSessionValidated(const CoreLib::Database::AsyncResult &result)
+{
+    CgiRoot *cgiRoot = static_cast<CgiRoot *>(WApplication::instance());
+    CgiEnv *cgiEnv = cgiRoot->GetCgiEnvInstance();
+
+    try {
+        if (!result.Succeeded()) {
+            LOG_ERROR(result.Error(), cgiEnv->GetInformation().ToJson());
+            return;
+        }
 
         string expiry("0");
-        if (!r.empty()) {
-            const pqxx::row row(r[0]);
-            expiry = row["expiry"].c_str();
+        if (result.Rows() > 0) {
+            expiry = result.Value(0, "expiry");
         }
 
         time_t rawTime = lexical_cast<time_t>(expiry);
-        CDate::Now n(CDate::Timezone::UTC);
 
         /// 0 means force exit the current session
         /// if you don't know why,
         /// see Service::RootLogin::PreserveSessionData method
         if (rawTime == 0) {
             ForceExit();
-        }
-    }
 
-    catch (const pqxx::sql_error &ex) {
-        LOG_ERROR(ex.what(), ex.query(), cgiEnv->GetInformation().ToJson());
+            /// We are outside of a request, so push the change to the browser
+            WApplication::instance()->triggerUpdate();
+        }
     }
 
     catch (const boost::exception &ex) {
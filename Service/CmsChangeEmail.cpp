@@ -238,7 +238,7 @@ void CmsChangeEmail::Impl::OnEmailChangeFormSubmitted()
 
         r = txn.exec(query);
 
-        txn.commit();
+        Pool::Database().Commit(txn, "ROOT");
 
         cgiEnv->SetSessionEmail(email);
 
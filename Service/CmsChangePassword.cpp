@@ -269,7 +269,7 @@ void CmsChangePassword::Impl::OnPasswordChangeFormSubmitted()
 
         r = txn.exec(query);
 
-        txn.commit();
+        Pool::Database().Commit(txn, "ROOT_CREDENTIALS");
 
         CurrentPasswordLineEdit->setText("");
         NewPasswordLineEdit->setText("");
@@ -240,8 +240,8 @@ void CmsContacts::Impl::OnAddContactFormSubmitted()
     try {
         string recipient(RecipientEnLineEdit->text().trim().toUTF8());
 
-        auto conn = Pool::Database().Connection();
-        pqxx::work txn(*conn.get());
+        CoreLib::Database::UnitOfWork unit(Pool::Database());
+        pqxx::transaction_base &txn = unit.Transaction();
 
         string query((format("SELECT recipient FROM \"%1%\""
                              " WHERE recipient = %2%;")
@@ -262,22 +262,23 @@ void CmsContacts::Impl::OnAddContactFormSubmitted()
 
         if (IsDefaultRecipientCheckBox->isChecked()) {
             Pool::Database().Update("CONTACTS",
-                                     "1",
-                                     "1",
-                                     "is_default=?",
-                                     { "FALSE" });
+                                     "is_default", true,
+                                     DATABASE_SQL("is_default=?"),
+                                     false);
         }
 
         Pool::Database().Insert("CONTACTS",
-                                 "recipient, recipient_fa, address, is_default",
-                                 { recipient, recipient_fa, email,
-                                   lexical_cast<string>(IsDefaultRecipientCheckBox->isChecked()) });
+                                 DATABASE_COLUMNS("recipient, recipient_fa, address, is_default"),
+                                 recipient, recipient_fa, email,
+                                 IsDefaultRecipientCheckBox->isChecked());
 
         RecipientEnLineEdit->setText("");
         RecipientFaLineEdit->setText("");
         EmailLineEdit->setText("");
         RecipientEnLineEdit->setFocus();
 
+        unit.Commit("CONTACTS");
+
         FillContactsDataTable();
     }
 
@@ -311,8 +312,8 @@ void CmsContacts::Impl::OnCellSaveButtonPressed(Wt::WInPlaceEdit *inPlaceEdit)
     try {
         string recipient(inPlaceEdit->attributeValue("db-key").toUTF8());
 
-        auto conn = Pool::Database().Connection();
-        pqxx::work txn(*conn.get());
+        CoreLib::Database::UnitOfWork unit(Pool::Database());
+        pqxx::transaction_base &txn = unit.Transaction();
 
         string query((format("SELECT recipient FROM \"%1%\""
                              " WHERE recipient = %2%;")
@@ -371,10 +372,12 @@ void CmsContacts::Impl::OnCellSaveButtonPressed(Wt::WInPlaceEdit *inPlaceEdit)
                                  "recipient",
                                  recipient,
                                  (format("%1%=?") % field ).str(),
-                                 { value });
+                                 value);
 
         m_parent->HtmlInfo(L"", EditContactsMessageArea);
 
+        unit.Commit("CONTACTS");
+
         FillContactsDataTable();
     }
 
@@ -403,8 +406,8 @@ void CmsContacts::Impl::OnSetDefaultCheckBoxStateChanged(Wt::WCheckBox *checkbox
     try {
         string recipient(checkbox->attributeValue("db-key").toUTF8());
 
-        auto conn = Pool::Database().Connection();
-        pqxx::work txn(*conn.get());
+        CoreLib::Database::UnitOfWork unit(Pool::Database());
+        pqxx::transaction_base &txn = unit.Transaction();
 
         string query((format("SELECT recipient FROM \"%1%\""
                              " WHERE recipient = %2%;")
@@ -417,19 +420,20 @@ void CmsContacts::Impl::OnSetDefaultCheckBoxStateChanged(Wt::WCheckBox *checkbox
         if (!r.empty()) {
             if (checkbox->isChecked()) {
                 Pool::Database().Update("CONTACTS",
-                                         "1",
-                                         "1",
-                                         "is_default=?",
-                                         { "FALSE" });
+                                         "is_default", true,
+                                         DATABASE_SQL("is_default=?"),
+                                         false);
             }
 
             Pool::Database().Update("CONTACTS",
                                      "recipient",
                                      recipient,
-                                     "is_default=?",
-                                     { boost::lexical_cast<string>(checkbox->isChecked()) });
+                                     DATABASE_SQL("is_default=?"),
+                                     checkbox->isChecked());
         }
 
+        unit.Commit("CONTACTS");
+
         FillContactsDataTable();
     }
 
@@ -461,8 +465,8 @@ void CmsContacts::Impl::OnEraseButtonPressed(Wt::WPushButton *button)
         WString question;
         if (cgiEnv->GetInformation().Client.Language.Code
                 == CgiEnv::InformationRecord::ClientRecord::LanguageCode::Fa) {
-            auto conn = Pool::Database().Connection();
-            pqxx::work txn(*conn.get());
+            CoreLib::Database::UnitOfWork unit(Pool::Database());
+            pqxx::transaction_base &txn = unit.Transaction();
 
             string query((format("SELECT recipient_fa FROM \"%1%\""
                                  " WHERE recipient = %2%;")
@@ -519,8 +523,8 @@ void CmsContacts::Impl::OnEraseDialogClosed(Wt::StandardButton button)
         if (button == Ok) {
             string recipient(EraseMessageBox->attributeValue("db-key").toUTF8());
 
-            auto conn = Pool::Database().Connection();
-            pqxx::work txn(*conn.get());
+            CoreLib::Database::UnitOfWork unit(Pool::Database());
+            pqxx::transaction_base &txn = unit.Transaction();
 
             string query((format("SELECT recipient FROM \"%1%\""
                                  " WHERE recipient = %2%;")
@@ -533,6 +537,8 @@ void CmsContacts::Impl::OnEraseDialogClosed(Wt::StandardButton button)
             if (!r.empty()) {
                 Pool::Database().Delete("CONTACTS", "recipient", recipient);
             }
+            unit.Commit("CONTACTS");
+
             FillContactsDataTable();
         }
     }
@@ -574,8 +580,8 @@ void CmsContacts::Impl::FillContactsDataTable()
     CgiEnv *cgiEnv = cgiRoot->GetCgiEnvInstance();
 
     try {
-        auto conn = Pool::Database().Connection();
-        pqxx::work txn(*conn.get());
+        CoreLib::Database::UnitOfWork unit(Pool::Database());
+        pqxx::transaction_base &txn = unit.Transaction();
 
         string query((format("SELECT recipient, recipient_fa, address, is_default"
                              " FROM \"%1%\" ORDER BY recipient ASC;")
@@ -230,7 +230,7 @@ void CmsDashboard::Impl::OnForceTerminateAllSessionsDialogClosed(Wt::StandardBut
 
             txn.exec(query);
 
-            txn.commit();
+            Pool::Database().Commit(txn, "ROOT_SESSIONS");
 
             ForceTerminateAllSessionsMessageBox.reset();
 
@@ -44,6 +44,7 @@
 #include <Wt/WLineEdit>
 #include <Wt/WMessageBox>
 #include <Wt/WPushButton>
+#include <Wt/WServer>
 #include <Wt/WSignalMapper>
 #include <Wt/WString>
 #include <Wt/WTable>
@@ -55,12 +56,12 @@
 #include <CoreLib/Database.hpp>
 #include <CoreLib/FileSystem.hpp>
 #include <CoreLib/Log.hpp>
-#include <CoreLib/Mail.hpp>
 #include <CoreLib/make_unique.hpp>
 #include "CgiEnv.hpp"
 #include "CgiRoot.hpp"
 #include "CmsNewsletter.hpp"
 #include "Div.hpp"
+#include "NewsletterCampaign.hpp"
 #include "Pool.hpp"
 
 using namespace std;
@@ -77,6 +78,7 @@ public:
     WTextEdit *BodyTextEdit;
     WPushButton *SendPushButton;
     WPushButton *ClearPushButton;
+    WText *ProgressText;
 
     std::unique_ptr<Wt::WMessageBox> SendMessageBox;
     std::unique_ptr<Wt::WMessageBox> ClearMessageBox;
@@ -85,6 +87,12 @@ public:
 private:
     CmsNewsletter *m_parent;
 
+    /// Progress reports may arrive after the page is gone
+    std::shared_ptr<bool> m_alive;
+    NewsletterCampaign::SubscriptionId m_subscription;
+    /// Only the campaign started from this page gets reported on it
+    std::string m_campaignId;
+
 public:
     explicit Impl(CmsNewsletter *parent);
     ~Impl();
@@ -96,6 +104,10 @@ public:
     void OnClearButtonPressed();
     void OnClearConfirmDialogClosed(Wt::StandardButton button);
     void OnSendSuccessDialogClosed(Wt::StandardButton button);
+    void OnCampaignProgress(const NewsletterCampaign::Progress &progress);
+
+public:
+    void SubscribeToProgress();
 
 public:
     void SetFormEnable(const bool status);
@@ -205,6 +217,8 @@ WWidget *CmsNewsletter::Layout()
             m_pimpl->ClearPushButton = new WPushButton(tr("cms-newsletter-clear"));
             m_pimpl->ClearPushButton->setStyleClass("btn btn-default");
 
+            m_pimpl->ProgressText = new WText();
+
             m_pimpl->SetFormEnable(false);
             m_pimpl->ResetTheForm();
 
@@ -224,6 +238,7 @@ WWidget *CmsNewsletter::Layout()
 
             tmpl->bindWidget("send-button", m_pimpl->SendPushButton);
             tmpl->bindWidget("clear-button", m_pimpl->ClearPushButton);
+            tmpl->bindWidget("progress-text", m_pimpl->ProgressText);
 
             m_pimpl->RecipientsComboBox->sactivated().connect(
                         m_pimpl.get(), &CmsNewsletter::Impl::OnRecipientsComboBoxSelectionChanged);
@@ -232,6 +247,8 @@ WWidget *CmsNewsletter::Layout()
             m_pimpl->ClearPushButton->clicked().connect(
                         m_pimpl.get(), &CmsNewsletter::Impl::OnClearButtonPressed);
 
+            m_pimpl->SubscribeToProgress();
+
             m_pimpl->RecipientsComboBox->setFocus();
         }
     }
@@ -252,12 +269,20 @@ WWidget *CmsNewsletter::Layout()
 }
 
 CmsNewsletter::Impl::Impl(CmsNewsletter *parent)
-    : m_parent(parent)
+    : ProgressText(nullptr),
+      m_parent(parent),
+      m_alive(std::make_shared<bool>(true)),
+      m_subscription(0)
 {
 
 }
 
-CmsNewsletter::Impl::~Impl() = default;
+CmsNewsletter::Impl::~Impl()
+{
+    if (m_subscription != 0) {
+        NewsletterCampaign::Unsubscribe(m_subscription);
+    }
+}
 
 void CmsNewsletter::Impl::OnRecipientsComboBoxSelectionChanged(Wt::WString recipients)
 {
@@ -348,8 +373,8 @@ void CmsNewsletter::Impl::OnSendConfirmDialogClosed(Wt::StandardButton button)
                     return;
                 }
 
-                auto conn = Pool::Database().Connection();
-                pqxx::work txn(*conn.get());
+                auto conn = Pool::Database().Connection(CoreLib::Database::Access::ReadOnly);
+                pqxx::read_transaction txn(*conn.get());
 
                 string query((format("SELECT %1% FROM \"%2%\""
                                      " WHERE pseudo_id = '0';")
@@ -374,65 +399,34 @@ void CmsNewsletter::Impl::OnSendConfirmDialogClosed(Wt::StandardButton button)
                 if (!ends_with(unsubscribeLink, "/"))
                     unsubscribeLink += "/";
 
+                NewsletterCampaign::Recipients campaignRecipients;
                 if (recipients == tr("cms-newsletter-all-recipients")) {
                     unsubscribeLink += "?subscribe=-1&recipient=${uuid}&subscription=en,fa";
-
-                    query.assign((format("SELECT inbox, uuid FROM \"%1%\""
-                                         " WHERE subscription <> 'none';")
-                                  % Pool::Database().GetTableName("SUBSCRIBERS")).str());
+                    campaignRecipients = NewsletterCampaign::Recipients::All;
                 } else if (recipients == tr("cms-newsletter-english-recipients")) {
                     unsubscribeLink += "?lang=${lang}&subscribe=-1&recipient=${uuid}&subscription=en";
-
-                    query.assign((format("SELECT inbox, uuid FROM \"%1%\""
-                                         " WHERE subscription = 'en_fa' OR subscription = 'en';")
-                                  % Pool::Database().GetTableName("SUBSCRIBERS")).str());
+                    campaignRecipients = NewsletterCampaign::Recipients::English;
                 } else if (recipients == tr("cms-newsletter-farsi-recipients")) {
                     unsubscribeLink += "?lang=${lang}&subscribe=-1&recipient=${uuid}&subscription=fa";
-
-                    query.assign((format("SELECT inbox, uuid FROM \"%1%\""
-                                         " WHERE subscription = 'en_fa' OR subscription = 'fa';")
-                                  % Pool::Database().GetTableName("SUBSCRIBERS")).str());
+                    campaignRecipients = NewsletterCampaign::Recipients::Farsi;
                 } else {
                     LOG_DEBUG("Ops!");
                     return;
                 }
 
-                string enUnsubscribeLink(replace_all_copy(unsubscribeLink, "${lang}", "en"));
-                string faUnsubscribeLink(replace_all_copy(unsubscribeLink, "${lang}", "fa"));
-
-                string message;
-                string inbox;
-                string uuid;
-
-                LOG_INFO("Running query...", query, cgiEnv->GetInformation().ToJson());
-
-                r = txn.exec(query);
-
-                for (const auto & row : r) {
-                    inbox.assign(row["inbox"].c_str());
-                    uuid.assign(row["uuid"].c_str());
+                /// The campaign is sent in the background; this handler only
+                /// snapshots the recipients and returns
+                const string campaignId(NewsletterCampaign::Create(
+                                            campaignRecipients,
+                                            cgiEnv->GetInformation().Server.NoReplyAddress,
+                                            cgiEnv->GetInformation().Client.Session.Email,
+                                            subject, htmlData, unsubscribeLink));
 
-                    message.assign(htmlData);
-                    replace_all(message, "${unsubscribe-link-en}", replace_all_copy(enUnsubscribeLink, "${uuid}", uuid));
-                    replace_all(message, "${unsubscribe-link-fa}", replace_all_copy(faUnsubscribeLink, "${uuid}", uuid));
-
-                    CoreLib::Mail *mail = new CoreLib::Mail(
-                                cgiEnv->GetInformation().Server.NoReplyAddress, inbox,
-                                subject, message);
-                    mail->SetDeleteLater(true);
-                    mail->SendAsync();
-                }
-
-                message.assign(htmlData);
-                replace_all(message, "${unsubscribe-link-en}", "javascript:;");
-                replace_all(message, "${unsubscribe-link-fa}", "javascript:;");
+                if (campaignId.empty())
+                    return;
 
-                CoreLib::Mail *mail = new CoreLib::Mail(
-                            cgiEnv->GetInformation().Server.NoReplyAddress,
-                            cgiEnv->GetInformation().Client.Session.Email,
-                            subject, message);
-                mail->SetDeleteLater(true);
-                mail->SendAsync();
+                m_campaignId = campaignId;
+                NewsletterCampaign::Start(campaignId);
 
                 SuccessMessageBox =
                         std::make_unique<WMessageBox>(tr("cms-newsletter-sent-successfully-title"),
@@ -500,6 +494,42 @@ void CmsNewsletter::Impl::OnSendSuccessDialogClosed(Wt::StandardButton button)
     SuccessMessageBox.reset();
 }
 
+void CmsNewsletter::Impl::OnCampaignProgress(const NewsletterCampaign::Progress &progress)
+{
+    if (progress.CampaignId != m_campaignId)
+        return;
+
+    if (progress.Finished) {
+        ProgressText->setText(tr("cms-newsletter-progress-finished")
+                              .arg(progress.Sent).arg(progress.Total).arg(progress.Failed));
+    } else {
+        ProgressText->setText(tr("cms-newsletter-progress")
+                              .arg(progress.Sent).arg(progress.Total).arg(progress.Failed));
+    }
+
+    /// We are outside of a request, so push the change to the browser
+    WApplication::instance()->triggerUpdate();
+}
+
+void CmsNewsletter::Impl::SubscribeToProgress()
+{
+    /// Reports come in on the dispatcher threads and are posted over to this
+    /// session, which pushes them to the browser
+    WServer *server = WServer::instance();
+    const string sessionId(WApplication::instance()->sessionId());
+    const std::weak_ptr<bool> alive(m_alive);
+
+    m_subscription = NewsletterCampaign::Subscribe(
+                [this, server, sessionId, alive](const NewsletterCampaign::Progress &progress) {
+        server->post(sessionId, [this, alive, progress]() {
+            if (alive.expired())
+                return;
+
+            this->OnCampaignProgress(progress);
+        });
+    });
+}
+
 void CmsNewsletter::Impl::ResetTheForm()
 {
     CgiRoot *cgiRoot = static_cast<CgiRoot *>(WApplication::instance());
@@ -246,13 +246,11 @@ void CmsSettings::Impl::OnSaveSettingsFormSubmitted()
 
         Pool::Database().Update("SETTINGS",
                                  "pseudo_id", "0",
-                                 "homepage_url_en=?, homepage_url_fa=?, homepage_title_en=?, homepage_title_fa=?",
-                                 {
-                                     homepage_url_en,
-                                     homepage_url_fa,
-                                     homepage_title_en,
-                                     homepage_title_fa
-                                 });
+                                 DATABASE_SQL("homepage_url_en=?, homepage_url_fa=?, homepage_title_en=?, homepage_title_fa=?"),
+                                 homepage_url_en,
+                                 homepage_url_fa,
+                                 homepage_title_en,
+                                 homepage_title_fa);
 
         EnHomePageUrlLineEdit->setFocus();
 
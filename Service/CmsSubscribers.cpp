@@ -33,6 +33,8 @@
  */
 
 
+#include <algorithm>
+#include <tuple>
 #include <vector>
 #include <cmath>
 #include <ctime>
@@ -79,6 +81,16 @@ public:
         Inactive
     };
 
+    /// Keyset pagination; pages are fetched relative to the first or the last
+    /// inbox of the current page instead of by OFFSET
+    enum class Seek : unsigned char {
+        First,
+        Previous,
+        Current,
+        Next,
+        Last
+    };
+
 public:
     WContainerWidget *SubscribersTableContainer;
 
@@ -89,6 +101,8 @@ public:
     uint_fast64_t PaginationTotalItems;
     uint_fast64_t PaginationItemOffset;
     uint_fast64_t PaginationPageOffset;
+    std::string PaginationFirstInbox;
+    std::string PaginationLastInbox;
     Div *PaginationButtonsContainer;
 
 public:
@@ -109,7 +123,8 @@ private:
     void GetDate(const std::string &timeSinceEpoch, Wt::WString &out_date);
     void GetSubscriptionTypeName(const std::string &type, Wt::WString &out_name);
 
-    void FillDataTable(const CmsSubscribers::Impl::Table &table);
+    void FillDataTable(const CmsSubscribers::Impl::Table &table,
+                       const CmsSubscribers::Impl::Seek &seek = Seek::First);
 
     void ReEvaluatePaginationButtons();
 };
@@ -250,7 +265,9 @@ CmsSubscribers::Impl::Impl()
       PaginationItemsPerPageLimit(-1),
       PaginationTotalItems(0),
       PaginationItemOffset(0),
-      PaginationPageOffset(0)
+      PaginationPageOffset(0),
+      PaginationFirstInbox(),
+      PaginationLastInbox()
 {
 
 }
@@ -335,10 +352,9 @@ void CmsSubscribers::Impl::OnItemsPerPageComboBoxChanged(Wt::WComboBox *comboBox
         this->PaginationPageOffset = static_cast<uint_fast64_t>(
                     std::floor(this->PaginationItemOffset
                                / static_cast<double>(this->PaginationItemsPerPageLimit)));
-        this->PaginationItemOffset = this->PaginationPageOffset
-                * static_cast<uint_fast64_t>(this->PaginationItemsPerPageLimit);
 
-        this->FillDataTable(this->PaginationTableType);
+        /// Show the page that holds the current first row
+        this->FillDataTable(this->PaginationTableType, Seek::Current);
     }
 
     catch (const boost::exception &ex) {
@@ -360,14 +376,28 @@ void CmsSubscribers::Impl::OnPaginiationButtonPressed(Wt::WPushButton *button)
     CgiEnv *cgiEnv = cgiRoot->GetCgiEnvInstance();
 
     try {
-        const string pageOffset = button->attributeValue("page-offset").toUTF8();
+        const string seek = button->attributeValue("seek").toUTF8();
+        const uint_fast64_t limit = static_cast<uint_fast64_t>(this->PaginationItemsPerPageLimit);
+        const uint_fast64_t numberOfPages = static_cast<uint_fast64_t>(
+                    std::ceil(this->PaginationTotalItems / static_cast<double>(limit)));
 
-        this->PaginationPageOffset =
-                boost::lexical_cast<uint_fast64_t>(pageOffset);
-        this->PaginationItemOffset = this->PaginationPageOffset
-                * static_cast<uint_fast64_t>(this->PaginationItemsPerPageLimit);
-
-        this->FillDataTable(this->PaginationTableType);
+        if (seek == "first") {
+            this->PaginationPageOffset = 0;
+            this->PaginationItemOffset = 0;
+            this->FillDataTable(this->PaginationTableType, Seek::First);
+        } else if (seek == "previous") {
+            this->PaginationPageOffset = this->PaginationPageOffset > 0 ? this->PaginationPageOffset - 1 : 0;
+            this->PaginationItemOffset = this->PaginationItemOffset > limit ? this->PaginationItemOffset - limit : 0;
+            this->FillDataTable(this->PaginationTableType, Seek::Previous);
+        } else if (seek == "next") {
+            ++this->PaginationPageOffset;
+            this->PaginationItemOffset += limit;
+            this->FillDataTable(this->PaginationTableType, Seek::Next);
+        } else if (seek == "last") {
+            this->PaginationPageOffset = numberOfPages > 0 ? numberOfPages - 1 : 0;
+            this->PaginationItemOffset = this->PaginationPageOffset * limit;
+            this->FillDataTable(this->PaginationTableType, Seek::Last);
+        }
     }
 
     catch (const boost::exception &ex) {
@@ -457,55 +487,134 @@ void CmsSubscribers::Impl::FillDataTable(const CmsSubscribers::Impl::Table &tabl
         table->elementAt(0, 6)->addWidget(new WText(tr("cms-subscribers-update-date")));
         table->elementAt(0, 7)->addWidget(new WText(tr("cms-subscribers-uuid")));
 
-        std::string paginationPhrase;
-        if (this->PaginationItemsPerPageLimit > -1) {
-            paginationPhrase = (format("LIMIT %1% OFFSET %2%")
-                                % boost::lexical_cast<std::string>(this->PaginationItemsPerPageLimit)
-                                % boost::lexical_cast<std::string>(this->PaginationItemOffset)).str();
-        }
-
-        string query;
+        string filter;
+        string subscription;
         switch (tableType) {
         case Table::All:
-            query.assign((format("SELECT count(*) over(), inbox, uuid, subscription, pending_confirm, pending_cancel, join_date, update_date"
-                                 " FROM \"%1%\" ORDER BY inbox ASC %2%;")
-                          % Pool::Database().GetTableName("SUBSCRIBERS") % paginationPhrase).str());
             break;
         case Table::EnFa:
-            query.assign((format("SELECT count(*) over(), inbox, uuid, subscription, pending_confirm, pending_cancel, join_date, update_date"
-                                 " FROM \"%1%\" WHERE subscription = 'en_fa' ORDER BY inbox ASC %2%;")
-                          % Pool::Database().GetTableName("SUBSCRIBERS") % paginationPhrase).str());
+            subscription.assign("en_fa");
             break;
         case Table::En:
-            query.assign((format("SELECT count(*) over(), inbox, uuid, subscription, pending_confirm, pending_cancel, join_date, update_date"
-                                 " FROM \"%1%\" WHERE subscription = 'en' ORDER BY inbox ASC %2%;")
-                          % Pool::Database().GetTableName("SUBSCRIBERS") % paginationPhrase).str());
+            subscription.assign("en");
             break;
         case Table::Fa:
-            query.assign((format("SELECT count(*) over(), inbox, uuid, subscription, pending_confirm, pending_cancel, join_date, update_date"
-                                 " FROM \"%1%\" WHERE subscription = 'fa' ORDER BY inbox ASC %2%;")
-                          % Pool::Database().GetTableName("SUBSCRIBERS") % paginationPhrase).str());
+            subscription.assign("fa");
             break;
         case Table::Inactive:
-            query.assign((format("SELECT count(*) over(), inbox, uuid, subscription, pending_confirm, pending_cancel, join_date, update_date"
-                                 " FROM \"%1%\" WHERE subscription = 'none' ORDER BY inbox ASC %2%;")
-                          % Pool::Database().GetTableName("SUBSCRIBERS") % paginationPhrase).str());
+            subscription.assign("none");
             break;
         }
 
-        LOG_INFO("Running query...", query, cgiEnv->GetInformation().ToJson());
+        if (!subscription.empty()) {
+            filter.assign((format("subscription = '%1%'") % subscription).str());
+        }
+
+        auto conn = Pool::Database().Connection(CoreLib::Database::Access::ReadOnly);
+        pqxx::read_transaction txn(*conn.get());
 
-        auto conn = Pool::Database().Connection();
-        pqxx::work txn(*conn.get());
+        /// The total comes from the trigger-maintained counters, so the cost of
+        /// a page does not depend on the size of the list
+        string query((format("SELECT COALESCE ( SUM ( total ), 0 ) AS count FROM \"%1%\"%2%;")
+                      % Pool::Database().GetTableName("SUBSCRIBERS_COUNTS")
+                      % (filter.empty() ? "" : " WHERE " + filter)).str());
+
+        LOG_INFO("Running query...", query, cgiEnv->GetInformation().ToJson());
 
         result r = txn.exec(query);
 
+        this->PaginationTotalItems = !r.empty() ? r[0]["count"].as<uint_fast64_t>() : 0;
+
+        Seek effectiveSeek = this->PaginationItemsPerPageLimit > -1 ? seek : Seek::First;
+        if ((effectiveSeek == Seek::Previous && this->PaginationFirstInbox.empty())
+                || (effectiveSeek == Seek::Current && this->PaginationFirstInbox.empty())
+                || (effectiveSeek == Seek::Next && this->PaginationLastInbox.empty())) {
+            effectiveSeek = Seek::First;
+        }
+
+        string key;
+        string condition(filter);
+        string order("ASC");
+        uint_fast64_t limit = static_cast<uint_fast64_t>(std::max(this->PaginationItemsPerPageLimit, 0));
+
+        switch (effectiveSeek) {
+        case Seek::First:
+            this->PaginationPageOffset = 0;
+            this->PaginationItemOffset = 0;
+            break;
+        case Seek::Previous:
+            key = this->PaginationFirstInbox;
+            condition += (condition.empty() ? "" : " AND ") + string("inbox < $1");
+            order.assign("DESC");
+            break;
+        case Seek::Current:
+            key = this->PaginationFirstInbox;
+            if (limit > 0 && this->PaginationItemOffset > this->PaginationPageOffset * limit) {
+                /// The page size changed; step back to the start of the page that holds
+                /// the current first row, so row numbers agree with the page label
+                condition += (condition.empty() ? "" : " AND ")
+                        + (format("inbox >= COALESCE ( ( SELECT inbox FROM \"%1%\" WHERE %2%inbox < $1"
+                                  " ORDER BY inbox DESC OFFSET %3% LIMIT 1 ), '' )")
+                           % Pool::Database().GetTableName("SUBSCRIBERS")
+                           % (filter.empty() ? "" : filter + " AND ")
+                           % (this->PaginationItemOffset - this->PaginationPageOffset * limit - 1)).str();
+                this->PaginationItemOffset = this->PaginationPageOffset * limit;
+            } else {
+                condition += (condition.empty() ? "" : " AND ") + string("inbox >= $1");
+            }
+            break;
+        case Seek::Next:
+            key = this->PaginationLastInbox;
+            condition += (condition.empty() ? "" : " AND ") + string("inbox > $1");
+            break;
+        case Seek::Last:
+            order.assign("DESC");
+            if (this->PaginationTotalItems > this->PaginationItemOffset) {
+                limit = this->PaginationTotalItems - this->PaginationItemOffset;
+            }
+            break;
+        }
+
+        string paginationPhrase;
+        if (this->PaginationItemsPerPageLimit > -1) {
+            paginationPhrase = (format(" LIMIT %1%") % limit).str();
+        }
+
+        query.assign((format("SELECT inbox, uuid, subscription, pending_confirm, pending_cancel, join_date, update_date"
+                             " FROM \"%1%\"%2% ORDER BY inbox %3%%4%;")
+                      % Pool::Database().GetTableName("SUBSCRIBERS")
+                      % (condition.empty() ? "" : " WHERE " + condition)
+                      % order
+                      % paginationPhrase).str());
+
+        LOG_INFO("Running query...", query, key, cgiEnv->GetInformation().ToJson());
+
+        r = key.empty() ? txn.exec(query) : txn.exec_params(query, key);
+
+        if (r.empty() && effectiveSeek != Seek::First) {
+            /// Rows moved under our feet; start over from the top
+            this->FillDataTable(tableType, Seek::First);
+            return;
+        }
+
+        /// Backward seeks come in reverse order
+        std::vector<pqxx::row> rows(r.begin(), r.end());
+        if (order == "DESC") {
+            std::reverse(rows.begin(), rows.end());
+        }
+
+        if (!rows.empty()) {
+            this->PaginationFirstInbox.assign(rows.front()["inbox"].c_str());
+            this->PaginationLastInbox.assign(rows.back()["inbox"].c_str());
+        } else {
+            this->PaginationFirstInbox.clear();
+            this->PaginationLastInbox.clear();
+        }
+
         int i = 0;
-        for (const auto & row : r) {
+        for (const auto & row : rows) {
             ++i;
 
-            this->PaginationTotalItems = boost::lexical_cast<uint_fast64_t>(row["count"].c_str());
-
             const string inbox(row["inbox"].c_str());
             const string uuid(row["uuid"].c_str());
             const string subscription(row["subscription"].c_str());
@@ -581,24 +690,25 @@ void CmsSubscribers::Impl::ReEvaluatePaginationButtons()
         uint_fast64_t numberOfPages = static_cast<uint_fast64_t>(
                     std::ceil(this->PaginationTotalItems
                               / static_cast<double>(this->PaginationItemsPerPageLimit)));
-        for (uint_fast64_t i = 0; i < numberOfPages; ++i) {
-            WString pageNumber;
-            if (cgiEnv->GetInformation().Client.Language.Code
-                    != CgiEnv::InformationRecord::ClientRecord::LanguageCode::Fa) {
-                pageNumber = WString(lexical_cast<wstring>(i + 1));
-            } else {
-                pageNumber = WString(CDate::DateConv::FormatToPersianNums(lexical_cast<wstring>(i +1)));
-            }
+        if (numberOfPages < 2) {
+            return;
+        }
 
-            WPushButton *button = new WPushButton(pageNumber);
-            button->setAttributeValue(
-                        "page-offset", WString::fromUTF8(lexical_cast<string>(i)));
+        const bool hasPrevious = this->PaginationPageOffset > 0;
+        const bool hasNext = this->PaginationPageOffset + 1 < numberOfPages;
 
-            if (i != this->PaginationPageOffset) {
-                button->setStyleClass("btn btn-default");
-            } else {
-                button->setStyleClass("btn btn-primary");
-            }
+        const std::vector<std::tuple<std::string, Wt::WString, bool>> buttons {
+            std::make_tuple("first", tr("cms-subscribers-pagination-first"), hasPrevious),
+            std::make_tuple("previous", tr("cms-subscribers-pagination-previous"), hasPrevious),
+            std::make_tuple("next", tr("cms-subscribers-pagination-next"), hasNext),
+            std::make_tuple("last", tr("cms-subscribers-pagination-last"), hasNext)
+        };
+
+        for (const auto &b : buttons) {
+            WPushButton *button = new WPushButton(std::get<1>(b));
+            button->setAttributeValue("seek", WString::fromUTF8(std::get<0>(b)));
+            button->setStyleClass("btn btn-default");
+            button->setEnabled(std::get<2>(b));
 
             this->PaginationButtonsContainer->addWidget(button);
 
@@ -606,6 +716,20 @@ void CmsSubscribers::Impl::ReEvaluatePaginationButtons()
             buttonSignalMapper->mapped().connect(this, &CmsSubscribers::Impl::OnPaginiationButtonPressed);
             buttonSignalMapper->mapConnect(button->clicked(), button);
         }
+
+        WString currentPage;
+        WString totalPages;
+        if (cgiEnv->GetInformation().Client.Language.Code
+                != CgiEnv::InformationRecord::ClientRecord::LanguageCode::Fa) {
+            currentPage = WString(lexical_cast<wstring>(this->PaginationPageOffset + 1));
+            totalPages = WString(lexical_cast<wstring>(numberOfPages));
+        } else {
+            currentPage = WString(CDate::DateConv::FormatToPersianNums(lexical_cast<wstring>(this->PaginationPageOffset + 1)));
+            totalPages = WString(CDate::DateConv::FormatToPersianNums(lexical_cast<wstring>(numberOfPages)));
+        }
+
+        this->PaginationButtonsContainer->addWidget(
+                    new WText(tr("cms-subscribers-pagination-page").arg(currentPage).arg(totalPages)));
     }
 
     catch (const boost::exception &ex) {
@@ -335,12 +335,12 @@ void ContactForm::Impl::OnContactFormSubmitted()
 
         string email;
         if (!UseRootEmailAsRecipient) {
-            string recipientColumn;
+            string recipientStatement;
             if (cgiEnv->GetInformation().Client.Language.Code
                     == CgiEnv::InformationRecord::ClientRecord::LanguageCode::Fa) {
-                recipientColumn = "recipient_fa";
+                recipientStatement = "CONTACTS_SELECT_ADDRESS_BY_RECIPIENT_FA";
             } else {
-                recipientColumn = "recipient";
+                recipientStatement = "CONTACTS_SELECT_ADDRESS_BY_RECIPIENT";
             }
 
             string recipient = RecipientComboBox->currentText().trim().toUTF8();
@@ -348,14 +348,9 @@ void ContactForm::Impl::OnContactFormSubmitted()
             auto conn = Pool::Database().Connection();
             pqxx::work txn(*conn.get());
 
-            string query((format("SELECT address FROM \"%1%\""
-                                 " WHERE \"%2%\" = %3%;")
-                          % Pool::Database().GetTableName("CONTACTS")
-                          % recipientColumn
-                          % txn.quote(recipient)).str());
-            LOG_INFO("Running query...", query, cgiEnv->GetInformation().ToJson());
+            LOG_INFO("Running prepared statement...", recipientStatement, cgiEnv->GetInformation().ToJson());
 
-            result r = txn.exec(query);
+            result r = Pool::Database().ExecutePrepared(txn, recipientStatement, recipient);
 
             if (!r.empty()) {
                 const pqxx::row row(r[0]);
@@ -365,13 +360,10 @@ void ContactForm::Impl::OnContactFormSubmitted()
             auto conn = Pool::Database().Connection();
             pqxx::work txn(*conn.get());
 
-            string query((format("SELECT email FROM \"%1%\""
-                                 " WHERE username = %2%;")
-                          % Pool::Database().GetTableName("CONTACTS")
-                          % txn.quote(Service::Pool::Storage().RootUsername())).str());
-            LOG_INFO("Running query...", query, cgiEnv->GetInformation().ToJson());
+            LOG_INFO("Running prepared statement...", "ROOT_SELECT_EMAIL_BY_USERNAME", cgiEnv->GetInformation().ToJson());
 
-            result r = txn.exec(query);
+            result r = Pool::Database().ExecutePrepared(txn, "ROOT_SELECT_EMAIL_BY_USERNAME",
+                                                        Service::Pool::Storage().RootUsername());
 
             if (!r.empty()) {
                 const pqxx::row row(r[0]);
@@ -0,0 +1,99 @@
+/**
+ * @file
+ * @author  Mamadou Babaei <info@babaei.net>
+ * @version 0.1.0
+ *
+ * @section LICENSE
+ *
+ * (The MIT License)
+ *
+ * Copyright (c) 2016 - 2021 Mamadou Babaei
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * Turns a geo-location record into a GEO_SNAPSHOTS row. Kept apart from the
+ * rest of CgiEnv, which depends on Wt and libmaxminddb, so that it can be
+ * built and checked on its own.
+ */
+
+
+#include <boost/algorithm/string.hpp>
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/range/iterator_range.hpp>
+#include <CoreLib/Crypto.hpp>
+#include "CgiEnv.hpp"
+
+#define     EMPTY_RAW_DATA          "{}"
+
+using namespace std;
+using namespace boost;
+using namespace CoreLib;
+using namespace Service;
+
+bool CgiEnv::InformationRecord::ClientRecord::GeoLocationRecord::ToSnapshot(std::vector<std::string> &out_values) const
+{
+    /// Same column order as GEO_SNAPSHOTS
+    out_values = {
+        "",
+        CountryCode,
+        CountryCode3,
+        CountryName,
+        Region,
+        City,
+        PostalCode,
+        lexical_cast<string>(Latitude),
+        lexical_cast<string>(Longitude),
+        lexical_cast<string>(MetroCode),
+        lexical_cast<string>(DmaCode),
+        lexical_cast<string>(AreaCode),
+        lexical_cast<string>(Charset),
+        ContinentCode,
+        lexical_cast<string>(Netmask),
+        lexical_cast<string>(ASN),
+        ASO,
+        RawData
+    };
+
+    /// The first 128 bits of the digest make up the snapshot id
+    string digest;
+    if (!Crypto::Hash(algorithm::join(
+                          boost::make_iterator_range(out_values.begin() + 1, out_values.end()), "\x1f"),
+                      digest)) {
+        out_values.clear();
+        return false;
+    }
+
+    algorithm::to_lower(digest);
+    out_values[0] = (boost::format("%1%-%2%-%3%-%4%-%5%")
+                     % digest.substr(0, 8) % digest.substr(8, 4) % digest.substr(12, 4)
+                     % digest.substr(16, 4) % digest.substr(20, 12)).str();
+
+    /// A failed lookup leaves no raw data, which raw_data being JSONB won't
+    /// take as is; it is substituted after hashing so the id stays the same
+    /// as the one legacy rows got during the upgrade
+    if (out_values.back().empty()) {
+        out_values.back() = EMPTY_RAW_DATA;
+    }
+
+    return true;
+}
@@ -0,0 +1,714 @@
+/**
+ * @file
+ * @author  Mamadou Babaei <info@babaei.net>
+ * @version 0.1.0
+ *
+ * @section LICENSE
+ *
+ * (The MIT License)
+ *
+ * Copyright (c) 2016 - 2021 Mamadou Babaei
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Newsletter campaigns sent out in the background. A campaign keeps its own
+ * copy of the recipients along with the outcome for each of them, so an
+ * interrupted run picks up where it left off.
+ */
+
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <vector>
+#include <boost/algorithm/string.hpp>
+#include <boost/chrono/chrono.hpp>
+#include <boost/exception/diagnostic_information.hpp>
+#include <boost/format.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/lock_guard.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <pqxx/pqxx>
+#include <CoreLib/Database.hpp>
+#include <CoreLib/Log.hpp>
+#include <CoreLib/Mail.hpp>
+#include <CoreLib/make_unique.hpp>
+#include <CoreLib/Random.hpp>
+#include "NewsletterCampaign.hpp"
+#include "Pool.hpp"
+
+#define     NEWSLETTER_POLL_INTERVAL            5000
+
+using namespace std;
+using namespace boost;
+using namespace Service;
+
+struct NewsletterCampaign::Impl
+{
+public:
+    struct Campaign
+    {
+        std::string Id;
+        std::string Sender;
+        std::string CopyTo;
+        std::string Subject;
+        std::string Body;
+        std::string UnsubscribeLinkEn;
+        std::string UnsubscribeLinkFa;
+    };
+
+    struct Recipient
+    {
+        std::string Inbox;
+        std::string Uuid;
+    };
+
+    /// Outcome of the mails of a batch, filled in by the mail workers
+    struct Batch
+    {
+        boost::mutex Mutex;
+        boost::condition_variable Condition;
+        std::size_t Remaining;
+        std::vector<bool> Reported;
+        std::vector<bool> Succeeded;
+        std::vector<std::string> Errors;
+    };
+
+public:
+    static boost::mutex Mutex;
+    static boost::condition_variable StopCondition;
+    static bool StopRequested;
+    static std::set<std::string> RunningCampaigns;
+    static std::vector<std::unique_ptr<boost::thread>> Dispatchers;
+    static std::map<SubscriptionId, ProgressHandler> Subscribers;
+    static SubscriptionId NextSubscriptionId;
+
+public:
+    static void Dispatch(const std::string campaignId);
+    static bool Load(const std::string &campaignId, Campaign &out_campaign);
+    /// Returns false once the campaign is finished
+    static bool DispatchBatch(const Campaign &campaign, Progress &out_progress);
+    static void Claim(const std::string &campaignId, const std::string &token,
+                      std::vector<Recipient> &out_recipients);
+    static void Renew(const std::string &campaignId, const std::string &token,
+                      const std::size_t remaining);
+    static void Settle(const std::string &campaignId, const std::string &token,
+                       const std::vector<Recipient> &recipients, const Batch &batch,
+                       Progress &out_progress);
+    /// Returns false once the campaign is marked finished, true while some of
+    /// it is still leased by a batch in flight
+    static bool Finish(const Campaign &campaign, Progress &out_progress);
+    static void Count(pqxx::transaction_base &txn, const std::string &campaignId,
+                      Progress &out_progress);
+    static void Publish(const Progress &progress);
+};
+
+boost::mutex NewsletterCampaign::Impl::Mutex;
+boost::condition_variable NewsletterCampaign::Impl::StopCondition;
+bool NewsletterCampaign::Impl::StopRequested = false;
+std::set<std::string> NewsletterCampaign::Impl::RunningCampaigns;
+std::vector<std::unique_ptr<boost::thread>> NewsletterCampaign::Impl::Dispatchers;
+std::map<NewsletterCampaign::SubscriptionId, NewsletterCampaign::ProgressHandler> NewsletterCampaign::Impl::Subscribers;
+NewsletterCampaign::SubscriptionId NewsletterCampaign::Impl::NextSubscriptionId = 0;
+
+std::string NewsletterCampaign::Create(const Recipients recipients,
+                                       const std::string &sender,
+                                       const std::string &copyTo,
+                                       const std::string &subject,
+                                       const std::string &body,
+                                       const std::string &unsubscribeLink)
+{
+    string where;
+    switch (recipients) {
+    case Recipients::All:
+        where = "subscription <> 'none'";
+        break;
+    case Recipients::English:
+        where = "subscription = 'en_fa' OR subscription = 'en'";
+        break;
+    case Recipients::Farsi:
+        where = "subscription = 'en_fa' OR subscription = 'fa'";
+        break;
+    }
+
+    try {
+        auto conn = Pool::Database().Connection();
+        pqxx::work txn(*conn.get());
+
+        pqxx::result r = Pool::Database().InsertReturning(txn,
+                                                          "NEWSLETTER_CAMPAIGNS",
+                                                          DATABASE_COLUMNS("campaign_id, sender, copy_to, subject, body, unsubscribe_link"),
+                                                          DATABASE_SQL("gen_random_uuid(), ?, ?, ?, ?, ?"),
+                                                          "campaign_id",
+                                                          sender, copyTo, subject, body, unsubscribeLink);
+        const string campaignId(r[0]["campaign_id"].c_str());
+
+        /// The snapshot is taken in the same transaction, so later signups or
+        /// cancellations do not change who the campaign goes to
+        r = txn.exec_params((format("INSERT INTO \"%1%\" ( campaign_id, inbox, uuid )"
+                                    " SELECT $1::UUID, inbox, uuid FROM \"%2%\" WHERE %3%;")
+                             % txn.esc(Pool::Database().GetTableName("NEWSLETTER_DELIVERIES"))
+                             % txn.esc(Pool::Database().GetTableName("SUBSCRIBERS"))
+                             % where).str(),
+                            campaignId);
+
+        Pool::Database().Commit(txn, "NEWSLETTER_CAMPAIGNS");
+
+        LOG_INFO("Newsletter campaign created!", campaignId, (format("Recipients: %1%") % r.affected_rows()).str());
+
+        return campaignId;
+    }
+
+    catch (const pqxx::sql_error &ex) {
+        LOG_ERROR(ex.what(), ex.query());
+    }
+
+    catch (const boost::exception &ex) {
+        LOG_ERROR(boost::diagnostic_information(ex));
+    }
+
+    catch (const std::exception &ex) {
+        LOG_ERROR(ex.what());
+    }
+
+    catch (...) {
+        LOG_ERROR(UNKNOWN_ERROR);
+    }
+
+    return "";
+}
+
+void NewsletterCampaign::Start(const std::string &campaignId)
+{
+    boost::lock_guard<boost::mutex> lock(Impl::Mutex);
+    (void)lock;
+
+    if (Impl::StopRequested || !Impl::RunningCampaigns.insert(campaignId).second)
+        return;
+
+    /// Dispatchers of finished campaigns are joined here, so the list only
+    /// grows with the campaigns running at the same time
+    Impl::Dispatchers.erase(std::remove_if(Impl::Dispatchers.begin(), Impl::Dispatchers.end(),
+                                           [](const std::unique_ptr<boost::thread> &dispatcher) {
+        return dispatcher->try_join_for(boost::chrono::milliseconds(0));
+    }), Impl::Dispatchers.end());
+
+    Impl::Dispatchers.push_back(make_unique<boost::thread>(&Impl::Dispatch, campaignId));
+}
+
+void NewsletterCampaign::ResumeAll()
+{
+    std::vector<std::string> campaigns;
+
+    try {
+        auto conn = Pool::Database().Connection();
+        pqxx::read_transaction txn(*conn.get());
+
+        pqxx::result r = txn.exec((format("SELECT campaign_id FROM \"%1%\""
+                                          " WHERE completion_time IS NULL ORDER BY creation_time;")
+                                   % txn.esc(Pool::Database().GetTableName("NEWSLETTER_CAMPAIGNS"))).str());
+
+        for (const auto &row : r) {
+            campaigns.push_back(row["campaign_id"].c_str());
+        }
+    }
+
+    catch (const pqxx::sql_error &ex) {
+        LOG_ERROR(ex.what(), ex.query());
+    }
+
+    catch (const boost::exception &ex) {
+        LOG_ERROR(boost::diagnostic_information(ex));
+    }
+
+    catch (const std::exception &ex) {
+        LOG_ERROR(ex.what());
+    }
+
+    catch (...) {
+        LOG_ERROR(UNKNOWN_ERROR);
+    }
+
+    for (const auto &campaignId : campaigns) {
+        LOG_INFO("Resuming newsletter campaign...", campaignId);
+        Start(campaignId);
+    }
+}
+
+void NewsletterCampaign::StopAll()
+{
+    std::vector<std::unique_ptr<boost::thread>> dispatchers;
+
+    {
+        boost::lock_guard<boost::mutex> lock(Impl::Mutex);
+        (void)lock;
+
+        Impl::StopRequested = true;
+        dispatchers.swap(Impl::Dispatchers);
+    }
+
+    Impl::StopCondition.notify_all();
+
+    for (auto &dispatcher : dispatchers) {
+        dispatcher->join();
+    }
+
+    {
+        boost::lock_guard<boost::mutex> lock(Impl::Mutex);
+        (void)lock;
+
+        Impl::StopRequested = false;
+    }
+}
+
+NewsletterCampaign::SubscriptionId NewsletterCampaign::Subscribe(const ProgressHandler &handler)
+{
+    boost::lock_guard<boost::mutex> lock(Impl::Mutex);
+    (void)lock;
+
+    const SubscriptionId id = ++Impl::NextSubscriptionId;
+    Impl::Subscribers[id] = handler;
+
+    return id;
+}
+
+void NewsletterCampaign::Unsubscribe(const SubscriptionId id)
+{
+    boost::lock_guard<boost::mutex> lock(Impl::Mutex);
+    (void)lock;
+
+    Impl::Subscribers.erase(id);
+}
+
+void NewsletterCampaign::Impl::Dispatch(const std::string campaignId)
+{
+    LOG_INFO("Newsletter campaign dispatcher started", campaignId);
+
+    try {
+        Campaign campaign;
+        if (Load(campaignId, campaign)) {
+            Progress progress { campaignId, 0, 0, 0, false };
+
+            /// Counted once; the batches keep the numbers up to date from then on
+            {
+                auto conn = Pool::Database().Connection();
+                pqxx::read_transaction txn(*conn.get());
+                Count(txn, campaignId, progress);
+            }
+
+            Publish(progress);
+
+            for (;;) {
+                {
+                    boost::lock_guard<boost::mutex> lock(Mutex);
+                    (void)lock;
+
+                    if (StopRequested)
+                        break;
+                }
+
+                if (!DispatchBatch(campaign, progress))
+                    break;
+            }
+        }
+    }
+
+    catch (const pqxx::sql_error &ex) {
+        LOG_ERROR(ex.what(), ex.query(), campaignId);
+    }
+
+    catch (const boost::exception &ex) {
+        LOG_ERROR(boost::diagnostic_information(ex), campaignId);
+    }
+
+    catch (const std::exception &ex) {
+        LOG_ERROR(ex.what(), campaignId);
+    }
+
+    catch (...) {
+        LOG_ERROR(UNKNOWN_ERROR, campaignId);
+    }
+
+    {
+        boost::lock_guard<boost::mutex> lock(Mutex);
+        (void)lock;
+
+        RunningCampaigns.erase(campaignId);
+    }
+
+    LOG_INFO("Newsletter campaign dispatcher stopped", campaignId);
+}
+
+bool NewsletterCampaign::Impl::Load(const std::string &campaignId, Campaign &out_campaign)
+{
+    /// Read from the primary; a replica may not have seen a campaign that
+    /// was created a moment ago
+    auto conn = Pool::Database().Connection();
+    pqxx::read_transaction txn(*conn.get());
+
+    pqxx::result r = txn.exec_params((format("SELECT sender, copy_to, subject, body, unsubscribe_link"
+                                             " FROM \"%1%\" WHERE campaign_id = $1 AND completion_time IS NULL;")
+                                      % txn.esc(Pool::Database().GetTableName("NEWSLETTER_CAMPAIGNS"))).str(),
+                                     campaignId);
+
+    if (r.empty())
+        return false;
+
+    const string unsubscribeLink(r[0]["unsubscribe_link"].c_str());
+
+    out_campaign.Id = campaignId;
+    out_campaign.Sender = r[0]["sender"].c_str();
+    out_campaign.CopyTo = r[0]["copy_to"].c_str();
+    out_campaign.Subject = r[0]["subject"].c_str();
+    out_campaign.Body = r[0]["body"].c_str();
+    out_campaign.UnsubscribeLinkEn = replace_all_copy(unsubscribeLink, "${lang}", "en");
+    out_campaign.UnsubscribeLinkFa = replace_all_copy(unsubscribeLink, "${lang}", "fa");
+
+    return true;
+}
+
+bool NewsletterCampaign::Impl::DispatchBatch(const Campaign &campaign, Progress &out_progress)
+{
+    std::string token;
+    CoreLib::Random::Uuid(token);
+
+    std::vector<Recipient> recipients;
+    Claim(campaign.Id, token, recipients);
+
+    if (recipients.empty())
+        return Finish(campaign, out_progress);
+
+    /// The mail workers send the batch in parallel, with no transaction open;
+    /// the dispatcher only waits for them to report back
+    auto batch = std::make_shared<Batch>();
+    batch->Remaining = recipients.size();
+    batch->Reported.resize(recipients.size(), false);
+    batch->Succeeded.resize(recipients.size(), false);
+    batch->Errors.resize(recipients.size());
+
+    string message;
+    for (std::size_t i = 0; i < recipients.size(); ++i) {
+        message.assign(campaign.Body);
+        replace_all(message, "${unsubscribe-link-en}", replace_all_copy(campaign.UnsubscribeLinkEn, "${uuid}", recipients[i].Uuid));
+        replace_all(message, "${unsubscribe-link-fa}", replace_all_copy(campaign.UnsubscribeLinkFa, "${uuid}", recipients[i].Uuid));
+
+        CoreLib::Mail *mail = new CoreLib::Mail(campaign.Sender, recipients[i].Inbox,
+                                                campaign.Subject, message);
+        mail->SetDeleteLater(true);
+        mail->SendAsync([batch, i](bool succeeded, const std::string &error) {
+            boost::lock_guard<boost::mutex> lock(batch->Mutex);
+            (void)lock;
+
+            batch->Reported[i] = true;
+            batch->Succeeded[i] = succeeded;
+            batch->Errors[i] = error;
+
+            if (--batch->Remaining == 0)
+                batch->Condition.notify_all();
+        });
+    }
+
+    /// Every mail reports back, sent or not, so the batch is waited for in
+    /// full while its lease gets renewed; only a dispatcher that dies on the
+    /// way leaves its rows to be sent again. StopAll() waits for this too.
+    Batch outcome;
+    {
+        boost::unique_lock<boost::mutex> lock(batch->Mutex);
+        while (!batch->Condition.wait_for(lock, boost::chrono::milliseconds(NEWSLETTER_LEASE_TIMEOUT / 2), [&batch] {
+            return batch->Remaining == 0;
+        })) {
+            const std::size_t remaining = batch->Remaining;
+
+            lock.unlock();
+            Renew(campaign.Id, token, remaining);
+            lock.lock();
+        }
+
+        outcome.Remaining = batch->Remaining;
+        outcome.Reported = batch->Reported;
+        outcome.Succeeded = batch->Succeeded;
+        outcome.Errors = batch->Errors;
+    }
+
+    Settle(campaign.Id, token, recipients, outcome, out_progress);
+    Publish(out_progress);
+
+    return true;
+}
+
+void NewsletterCampaign::Impl::Claim(const std::string &campaignId, const std::string &token,
+                                     std::vector<Recipient> &out_recipients)
+{
+    out_recipients.clear();
+
+    auto conn = Pool::Database().Connection();
+    pqxx::work txn(*conn.get());
+
+    /// The lease replaces holding row locks while sending; another process
+    /// resuming the same campaign skips leased rows, and rows of a dispatcher
+    /// that died come back once their lease runs out
+    pqxx::result r = txn.exec_params((format("UPDATE \"%1%\" SET status = 'sending', lease_token = $2::UUID,"
+                                             " lease_expiry = NOW() + $3::BIGINT * INTERVAL '1 millisecond'"
+                                             " WHERE campaign_id = $1::UUID AND inbox IN ( SELECT inbox FROM \"%1%\""
+                                             " WHERE campaign_id = $1::UUID AND ( status = 'pending'"
+                                             " OR ( status = 'sending' AND lease_expiry <= NOW() ) )"
+                                             " ORDER BY inbox LIMIT $4::BIGINT FOR UPDATE SKIP LOCKED )"
+                                             " RETURNING inbox, uuid;")
+                                      % txn.esc(Pool::Database().GetTableName("NEWSLETTER_DELIVERIES"))).str(),
+                                     campaignId,
+                                     token,
+                                     static_cast<long long>(NEWSLETTER_LEASE_TIMEOUT),
+                                     static_cast<long long>(NEWSLETTER_BATCH_SIZE));
+
+    Pool::Database().Commit(txn, "NEWSLETTER_DELIVERIES");
+
+    out_recipients.reserve(r.size());
+    for (const auto &row : r) {
+        out_recipients.push_back({ row["inbox"].c_str(), row["uuid"].c_str() });
+    }
+}
+
+void NewsletterCampaign::Impl::Renew(const std::string &campaignId, const std::string &token,
+                                     const std::size_t remaining)
+{
+    try {
+        auto conn = Pool::Database().Connection();
+        pqxx::work txn(*conn.get());
+
+        pqxx::result r = txn.exec_params((format("UPDATE \"%1%\" SET lease_expiry = NOW() + $3::BIGINT * INTERVAL '1 millisecond'"
+                                                 " WHERE campaign_id = $1::UUID AND lease_token = $2::UUID AND status = 'sending';")
+                                          % txn.esc(Pool::Database().GetTableName("NEWSLETTER_DELIVERIES"))).str(),
+                                         campaignId,
+                                         token,
+                                         static_cast<long long>(NEWSLETTER_LEASE_TIMEOUT));
+
+        Pool::Database().Commit(txn, "NEWSLETTER_DELIVERIES");
+
+        LOG_INFO("Newsletter batch lease renewed", campaignId,
+                 (format("Unreported: %1%, Renewed: %2%") % remaining % r.affected_rows()).str());
+
+        return;
+    }
+
+    catch (const pqxx::sql_error &ex) {
+        LOG_ERROR(ex.what(), ex.query(), campaignId);
+    }
+
+    catch (const boost::exception &ex) {
+        LOG_ERROR(boost::diagnostic_information(ex), campaignId);
+    }
+
+    catch (const std::exception &ex) {
+        LOG_ERROR(ex.what(), campaignId);
+    }
+
+    catch (...) {
+        LOG_ERROR(UNKNOWN_ERROR, campaignId);
+    }
+
+    /// The next attempt is half a lease away, so one failure is survivable
+    LOG_WARNING("Newsletter batch lease not renewed!", campaignId);
+}
+
+void NewsletterCampaign::Impl::Settle(const std::string &campaignId, const std::string &token,
+                                      const std::vector<Recipient> &recipients, const Batch &batch,
+                                      Progress &out_progress)
+{
+    try {
+        auto conn = Pool::Database().Connection();
+        pqxx::work txn(*conn.get());
+
+        const string deliveries(txn.esc(Pool::Database().GetTableName("NEWSLETTER_DELIVERIES")));
+
+        std::size_t sent = 0;
+        std::size_t failed = 0;
+
+        /// A dispatcher whose lease ran out meanwhile touches nothing; the
+        /// rows are someone else's by now
+        {
+            CoreLib::Database::Pipeline pipeline(txn);
+
+            std::vector<std::pair<CoreLib::Database::Pipeline::QueryId, bool>> queries;
+            for (std::size_t i = 0; i < recipients.size(); ++i) {
+                if (!batch.Reported[i])
+                    continue;
+
+                queries.emplace_back(
+                            pipeline.Queue((format("UPDATE \"%1%\" SET status = %2%, error = %3%, delivery_time = NOW(),"
+                                                   " lease_token = NULL, lease_expiry = NULL"
+                                                   " WHERE campaign_id = %4% AND inbox = %5% AND lease_token = %6%;")
+                                            % deliveries
+                                            % (batch.Succeeded[i] ? "'sent'" : "'failed'")
+                                            % (batch.Succeeded[i] ? "NULL" : txn.quote(batch.Errors[i]))
+                                            % txn.quote(campaignId)
+                                            % txn.quote(recipients[i].Inbox)
+                                            % txn.quote(token)).str()),
+                            batch.Succeeded[i]);
+            }
+
+            for (const auto &q : queries) {
+                const std::size_t affected = static_cast<std::size_t>(pipeline.Retrieve(q.first).affected_rows());
+                (q.second ? sent : failed) += affected;
+            }
+
+            pipeline.Complete();
+        }
+
+        Pool::Database().Commit(txn, "NEWSLETTER_DELIVERIES");
+
+        out_progress.Sent += sent;
+        out_progress.Failed += failed;
+
+        return;
+    }
+
+    catch (const pqxx::sql_error &ex) {
+        LOG_ERROR(ex.what(), ex.query(), campaignId);
+    }
+
+    catch (const boost::exception &ex) {
+        LOG_ERROR(boost::diagnostic_information(ex), campaignId);
+    }
+
+    catch (const std::exception &ex) {
+        LOG_ERROR(ex.what(), campaignId);
+    }
+
+    catch (...) {
+        LOG_ERROR(UNKNOWN_ERROR, campaignId);
+    }
+
+    LOG_WARNING("Newsletter batch left to its lease!", campaignId);
+}
+
+bool NewsletterCampaign::Impl::Finish(const Campaign &campaign, Progress &out_progress)
+{
+    {
+        auto conn = Pool::Database().Connection();
+        pqxx::work txn(*conn.get());
+
+        const string deliveries(txn.esc(Pool::Database().GetTableName("NEWSLETTER_DELIVERIES")));
+
+        /// Whatever is left is leased by a batch in flight, ours or another
+        /// process's; whoever runs out of rows last finishes the campaign
+        pqxx::result left = txn.exec_params((format("SELECT 1 FROM \"%1%\" WHERE campaign_id = $1::UUID"
+                                                    " AND ( status = 'pending' OR status = 'sending' ) LIMIT 1;")
+                                             % deliveries).str(),
+                                            campaign.Id);
+
+        if (left.empty()) {
+            pqxx::result finished = txn.exec_params((format("UPDATE \"%1%\" SET completion_time = NOW()"
+                                                            " WHERE campaign_id = $1::UUID AND completion_time IS NULL"
+                                                            " RETURNING campaign_id;")
+                                                     % txn.esc(Pool::Database().GetTableName("NEWSLETTER_CAMPAIGNS"))).str(),
+                                                    campaign.Id);
+
+            /// Other processes may have sent part of it, so count once more
+            Count(txn, campaign.Id, out_progress);
+            Pool::Database().Commit(txn, "NEWSLETTER_CAMPAIGNS");
+
+            out_progress.Finished = true;
+            Publish(out_progress);
+
+            LOG_INFO("Newsletter campaign finished!", campaign.Id,
+                     (format("Sent: %1%, Failed: %2%") % out_progress.Sent % out_progress.Failed).str());
+
+            /// Only the process which marked it finished sends the copy
+            if (!finished.empty()) {
+                string message(campaign.Body);
+                replace_all(message, "${unsubscribe-link-en}", "javascript:;");
+                replace_all(message, "${unsubscribe-link-fa}", "javascript:;");
+
+                CoreLib::Mail *mail = new CoreLib::Mail(campaign.Sender, campaign.CopyTo,
+                                                        campaign.Subject, message);
+                mail->SetDeleteLater(true);
+                mail->SendAsync();
+            }
+
+            return false;
+        }
+    }
+
+    boost::unique_lock<boost::mutex> lock(Mutex);
+    StopCondition.wait_for(lock, boost::chrono::milliseconds(NEWSLETTER_POLL_INTERVAL), [] {
+        return StopRequested;
+    });
+
+    return true;
+}
+
+void NewsletterCampaign::Impl::Count(pqxx::transaction_base &txn, const std::string &campaignId,
+                                     Progress &out_progress)
+{
+    pqxx::result r = txn.exec_params((format("SELECT status, COUNT(*) AS total FROM \"%1%\""
+                                             " WHERE campaign_id = $1 GROUP BY status;")
+                                      % txn.esc(Pool::Database().GetTableName("NEWSLETTER_DELIVERIES"))).str(),
+                                     campaignId);
+
+    out_progress.Total = 0;
+    out_progress.Sent = 0;
+    out_progress.Failed = 0;
+
+    for (const auto &row : r) {
+        const string status(row["status"].c_str());
+        const std::size_t total = row["total"].as<std::size_t>();
+
+        out_progress.Total += total;
+        if (status == "sent") {
+            out_progress.Sent = total;
+        } else if (status == "failed") {
+            out_progress.Failed = total;
+        }
+    }
+}
+
+void NewsletterCampaign::Impl::Publish(const Progress &progress)
+{
+    std::vector<ProgressHandler> handlers;
+
+    {
+        boost::lock_guard<boost::mutex> lock(Mutex);
+        (void)lock;
+
+        for (const auto &subscriber : Subscribers) {
+            handlers.push_back(subscriber.second);
+        }
+    }
+
+    for (const auto &handler : handlers) {
+        try {
+            handler(progress);
+        }
+
+        catch (const boost::exception &ex) {
+            LOG_ERROR(boost::diagnostic_information(ex));
+        }
+
+        catch (const std::exception &ex) {
+            LOG_ERROR(ex.what());
+        }
+
+        catch (...) {
+            LOG_ERROR(UNKNOWN_ERROR);
+        }
+    }
+}
@@ -0,0 +1,103 @@
+/**
+ * @file
+ * @author  Mamadou Babaei <info@babaei.net>
+ * @version 0.1.0
+ *
+ * @section LICENSE
+ *
+ * (The MIT License)
+ *
+ * Copyright (c) 2016 - 2021 Mamadou Babaei
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Newsletter campaigns sent out in the background. A campaign keeps its own
+ * copy of the recipients along with the outcome for each of them, so an
+ * interrupted run picks up where it left off.
+ */
+
+
+#ifndef SERVICE_NEWSLETTER_CAMPAIGN_HPP
+#define SERVICE_NEWSLETTER_CAMPAIGN_HPP
+
+
+#include <functional>
+#include <string>
+#include <cstddef>
+
+namespace Service {
+class NewsletterCampaign;
+}
+
+class Service::NewsletterCampaign
+{
+public:
+    enum class Recipients : unsigned char {
+        All,
+        English,
+        Farsi
+    };
+
+    struct Progress
+    {
+        std::string CampaignId;
+        std::size_t Total;
+        std::size_t Sent;
+        std::size_t Failed;
+        bool Finished;
+    };
+
+    /// Called on a dispatcher thread, never inside a Wt session
+    typedef std::function<void(const Progress &)> ProgressHandler;
+    typedef std::size_t SubscriptionId;
+
+private:
+    struct Impl;
+
+public:
+    /// Stores the campaign and a snapshot of its recipients in one go and
+    /// returns its id, or an empty string on failure. body and
+    /// unsubscribeLink are filled in per recipient: body through
+    /// ${unsubscribe-link-en} and ${unsubscribe-link-fa}, unsubscribeLink
+    /// through ${lang} and ${uuid}. copyTo gets a copy once all is sent.
+    static std::string Create(const Recipients recipients,
+                              const std::string &sender,
+                              const std::string &copyTo,
+                              const std::string &subject,
+                              const std::string &body,
+                              const std::string &unsubscribeLink);
+
+    /// Does nothing for a campaign already being sent by this process
+    static void Start(const std::string &campaignId);
+    /// Starts every campaign left unfinished by a previous run
+    static void ResumeAll();
+    /// Lets the batches in flight finish and joins the dispatchers; blocks
+    /// until each of their mails reports back, so it must be called while
+    /// the mail workers are still running
+    static void StopAll();
+
+    /// Reports every campaign of this process after each batch
+    static SubscriptionId Subscribe(const ProgressHandler &handler);
+    static void Unsubscribe(const SubscriptionId id);
+};
+
+
+#endif /* SERVICE_NEWSLETTER_CAMPAIGN_HPP */
@@ -37,9 +37,11 @@
 #include <boost/format.hpp>
 #include <boost/thread/once.hpp>
 #include <CoreLib/make_unique.hpp>
+#include <CoreLib/AuditWriter.hpp>
 #include <CoreLib/Crypto.hpp>
 #include <CoreLib/Database.hpp>
 #include <CoreLib/Log.hpp>
+#include <CoreLib/MailSpool.hpp>
 #include "Pool.hpp"
 
 using namespace std;
@@ -262,7 +264,43 @@ CoreLib::Database &Pool::Database()
                  % trim_copy(std::string(PGSQL_USER))
                  % trim_copy(std::string(PGSQL_PASSWORD))).str());
 #endif  // defined ( PGSQL_CONNECTION_STRING )
-    static CoreLib::Database instance(CONNECTION_STRING);
+    static CoreLib::Database instance(CONNECTION_STRING,
+                                      PGSQL_MIN_CONNECTIONS, PGSQL_MAX_CONNECTIONS,
+                                      boost::chrono::milliseconds(PGSQL_CONNECTION_IDLE_TIMEOUT),
+                                      boost::chrono::milliseconds(PGSQL_CONNECTION_MAX_LIFETIME));
+
+#if defined ( PGSQL_REPLICA_CONNECTION_STRINGS )
+    static boost::once_flag replicasFlag = BOOST_ONCE_INIT;
+    boost::call_once(replicasFlag, [] {
+        vector<string> replicas;
+        split(replicas, std::string(PGSQL_REPLICA_CONNECTION_STRINGS), is_any_of("|"), token_compress_on);
+
+        for (const auto &replica : replicas) {
+            if (trim_copy(replica) != "") {
+                instance.AddReplica(trim_copy(replica));
+            }
+        }
+    });
+#endif  // defined ( PGSQL_REPLICA_CONNECTION_STRINGS )
 
     return instance;
 }
+
+CoreLib::AuditWriter &Pool::AuditWriter()
+{
+    static CoreLib::AuditWriter instance(Database(),
+                                         AUDIT_WRITER_BATCH_SIZE,
+                                         boost::chrono::milliseconds(AUDIT_WRITER_FLUSH_INTERVAL),
+                                         AUDIT_WRITER_MAX_PENDING);
+    return instance;
+}
+
+CoreLib::MailSpool &Pool::MailSpool()
+{
+    static CoreLib::MailSpool instance(Database(), "MAIL_SPOOL",
+                                       MAIL_SPOOL_BATCH_SIZE,
+                                       boost::chrono::milliseconds(MAIL_SPOOL_LEASE_TIMEOUT),
+                                       boost::chrono::milliseconds(MAIL_SPOOL_POLL_INTERVAL),
+                                       MAIL_SPOOL_MAX_ATTEMPTS);
+    return instance;
+}
@@ -40,8 +40,10 @@
 #include <string>
 
 namespace CoreLib {
+class AuditWriter;
 class Crypto;
 class Database;
+class MailSpool;
 }
 
 namespace Service {
@@ -94,6 +96,8 @@ public:
     static StorageStruct &Storage();
     static CoreLib::Crypto &Crypto();
     static CoreLib::Database &Database();
+    static CoreLib::AuditWriter &AuditWriter();
+    static CoreLib::MailSpool &MailSpool();
 };
 
 
@@ -53,6 +53,7 @@
 #include <Wt/WString>
 #include <Wt/WTemplate>
 #include <Wt/WText>
+#include <CoreLib/AuditWriter.hpp>
 #include <CoreLib/CDate.hpp>
 #include <CoreLib/Crypto.hpp>
 #include <CoreLib/Database.hpp>
@@ -114,6 +115,15 @@ public:
     void GenerateCaptcha();
     void PasswordRecoveryForm();
     void PreserveSessionData(const CDate::Now &n, const bool saveLocally);
+    /// Queues the client's whereabouts for the row identified by token; the
+    /// row has to be committed by then
+    void WriteAudit(const std::string &id, const std::string &token);
+    /// Queues the client's geo-location and returns its content address, or
+    /// an empty string on failure
+    std::string WriteGeoSnapshot();
+    /// Same, but the row is written inside txn, for rows that reference it
+    /// right away; database errors are left to the caller's transaction
+    std::string WriteGeoSnapshot(pqxx::transaction_base &txn);
 
     void SendLoginAlertEmail(const CDate::Now &n);
     void SendPasswordRecoveryEmail(const std::string &email,
@@ -146,16 +156,23 @@ RootLogin::RootLogin()
             Pool::Crypto().Decrypt(token, token);
 
             try {
-                auto conn = Pool::Database().Connection();
-                pqxx::work txn(*conn.get());
-
-                string query((boost::format("SELECT EXTRACT ( EPOCH FROM expiry::TIMESTAMPTZ ) as expiry"
-                                            " FROM \"%1%\" WHERE token = %2%;")
-                              % txn.esc(Service::Pool::Database().GetTableName("ROOT_SESSIONS"))
-                              % txn.quote(token)).str());
-                LOG_INFO("Running query...", query, cgiEnv->GetInformation().ToJson());
-
-                result r = txn.exec(query);
+                CoreLib::Database::UnitOfWork unit(Pool::Database());
+                pqxx::transaction_base &txn = unit.Transaction();
+
+                LOG_INFO("Running pipelined statements...", "ROOT_SESSIONS_SELECT_EXPIRY_BY_TOKEN", "ROOT_SESSIONS_SELECT_LAST_LOGIN_BY_USERNAME", cgiEnv->GetInformation().ToJson());
+
+                /// The last login is only needed for a valid session, but fetching it
+                /// alongside the expiry is cheaper than a second round trip
+                result r;
+                result lastLogin;
+                {
+                    CoreLib::Database::Pipeline pipeline(txn);
+                    auto expiryQuery = pipeline.QueuePrepared("ROOT_SESSIONS_SELECT_EXPIRY_BY_TOKEN", token);
+                    auto lastLoginQuery = pipeline.QueuePrepared("ROOT_SESSIONS_SELECT_LAST_LOGIN_BY_USERNAME",
+                                                                 Pool::Storage().RootUsername());
+                    r = pipeline.Retrieve(expiryQuery);
+                    lastLogin = pipeline.Retrieve(lastLoginQuery);
+                }
 
                 string expiry("0");
                 if (!r.empty()) {
@@ -168,25 +185,7 @@ RootLogin::RootLogin()
                 CDate::Now n(CDate::Timezone::UTC);
                 if (rawTime >= n.RawTime()) {
                     try {
-                        query.assign((format("SELECT t1.user_id, t1.username, t1.email,"
-                                             " EXTRACT ( EPOCH FROM t2.login_time::TIMESTAMPTZ ) as login_time,"
-                                             " t2.ip_address, t2.location_country_code, t2.location_country_code3,"
-                                             " t2.location_country_name, t2.location_region, t2.location_city,"
-                                             " t2.location_postal_code, t2.location_latitude, t2.location_longitude,"
-                                             " t2.location_metro_code, t2.location_dma_code, t2.location_area_code,"
-                                             " t2.location_charset, t2.location_continent_code, t2.location_netmask,"
-                                             " t2.location_asn, t2.location_aso, t2.location_raw_data, "
-                                             " t2.user_agent, t2.referer"
-                                             " FROM \"%1%\" t1"
-                                             " INNER JOIN \"%2%\" t2 ON t1.user_id = t2.user_id"
-                                             " WHERE t1.username = %3%"
-                                             " ORDER BY t2.login_time DESC LIMIT 1;")
-                                      % txn.esc(Pool::Database().GetTableName("ROOT"))
-                                      % txn.esc(Pool::Database().GetTableName("ROOT_SESSIONS"))
-                                      % txn.quote(Pool::Storage().RootUsername())).str());
-                        LOG_INFO("Running query...", query, cgiEnv->GetInformation().ToJson());
-
-                        r = txn.exec(query);
+                        r = lastLogin;
 
                         if (!r.empty()) {
                             const pqxx::row row(r[0]);
@@ -221,10 +220,14 @@ RootLogin::RootLogin()
 
                             LOG_INFO("Successful login!", cgiEnv->GetInformation().ToJson());
 
-                            txn.abort();
+                            unit.Rollback();
 
                             m_pimpl->PreserveSessionData(n, true);
 
+                            unit.Commit("ROOT_SESSIONS", CoreLib::Database::Durability::Relaxed);
+
+                            m_pimpl->WriteAudit("ROOT_SESSIONS", cgiEnv->GetInformation().Client.Session.Token);
+
                             m_pimpl->SendLoginAlertEmail(n);
 
                             hasValidSession = true;
@@ -421,28 +424,27 @@ void RootLogin::Impl::OnLoginFormSubmitted()
     CgiEnv *cgiEnv = cgiRoot->GetCgiEnvInstance();
 
     try {
-        auto conn = Pool::Database().Connection();
-        pqxx::work txn(*conn.get());
+        CoreLib::Database::UnitOfWork unit(Pool::Database());
+        pqxx::transaction_base &txn = unit.Transaction();
 
         string userId;
         string username = UsernameLineEdit->text().toUTF8();
         string email;
         bool success = false;
 
-        string query((format("SELECT t1.user_id, t1.username, t1.email, t2.pwd, t3.new_pwd,"
-                             " EXTRACT ( EPOCH FROM t3.expiry::TIMESTAMPTZ ) as expiry"
-                             " FROM \"%1%\" t1"
-                             " INNER JOIN \"%2%\" t2 ON t1.user_id = t2.user_id"
-                             " LEFT OUTER JOIN \"%3%\" t3 ON t1.user_id = t3.user_id"
-                             " WHERE t1.username = %4%"
-                             " ORDER BY t3.request_time DESC LIMIT 1;")
-                      % txn.esc(Pool::Database().GetTableName("ROOT"))
-                      % txn.esc(Pool::Database().GetTableName("ROOT_CREDENTIALS"))
-                      % txn.esc(Pool::Database().GetTableName("ROOT_CREDENTIALS_RECOVERY"))
-                      % txn.quote(username)).str());
-        LOG_INFO("Running query...", query, cgiEnv->GetInformation().ToJson());
-
-        result r = txn.exec(query);
+        LOG_INFO("Running pipelined statements...", "ROOT_SELECT_CREDENTIALS_BY_USERNAME", "ROOT_SESSIONS_SELECT_LAST_LOGIN_BY_USERNAME", cgiEnv->GetInformation().ToJson());
+
+        /// Usernames are unique, so the previous session can be looked up by
+        /// username together with the credentials in a single round trip
+        result r;
+        result lastLogin;
+        {
+            CoreLib::Database::Pipeline pipeline(txn);
+            auto credentialsQuery = pipeline.QueuePrepared("ROOT_SELECT_CREDENTIALS_BY_USERNAME", username);
+            auto lastLoginQuery = pipeline.QueuePrepared("ROOT_SESSIONS_SELECT_LAST_LOGIN_BY_USERNAME", username);
+            r = pipeline.Retrieve(credentialsQuery);
+            lastLogin = pipeline.Retrieve(lastLoginQuery);
+        }
 
         if (!r.empty()) {
             const pqxx::row row(r[0]);
@@ -473,40 +475,18 @@ void RootLogin::Impl::OnLoginFormSubmitted()
                 success = true;
                 LOG_INFO("Legit recovery password!", username, cgiEnv->GetInformation().ToJson());
 
-                query.assign((boost::format("UPDATE ONLY \"%1%\""
+                const string snapshotId(WriteGeoSnapshot(txn));
+
+                string query((boost::format("UPDATE ONLY \"%1%\""
                                             " SET expiry = '19700101'::TIMESTAMPTZ,"
                                             " utilization_time = TO_TIMESTAMP( %2% )::TIMESTAMPTZ, utilization_ip_address = %3%,"
-                                            " utilization_location_country_code = %4%, utilization_location_country_code3 = %5%,"
-                                            " utilization_location_country_name = %6%, utilization_location_region = %7%,"
-                                            " utilization_location_city = %8%, utilization_location_postal_code = %9%,"
-                                            " utilization_location_latitude = %10%, utilization_location_longitude = %11%,"
-                                            " utilization_location_metro_code = %12%, utilization_location_dma_code = %13%,"
-                                            " utilization_location_area_code = %14%, utilization_location_charset = %15%,"
-                                            " utilization_location_continent_code = %16%, utilization_location_netmask = %17%,"
-                                            " utilization_location_asn = %18%, utilization_location_aso = %19%,"
-                                            " utilization_location_raw_data = %20%,"
-                                            " utilization_user_agent = %21%, utilization_referer = %22%"
-                                            " WHERE user_id = %23%;")
+                                            " utilization_geo_snapshot_id = %4%,"
+                                            " utilization_user_agent = %5%, utilization_referer = %6%"
+                                            " WHERE user_id = %7%;")
                               % txn.esc(Service::Pool::Database().GetTableName("ROOT_CREDENTIALS_RECOVERY"))
                               % txn.esc(lexical_cast<string>(n.RawTime()))
                               % txn.quote(cgiEnv->GetInformation().Client.IPAddress)
-                              % txn.quote(cgiEnv->GetInformation().Client.GeoLocation.CountryCode)
-                              % txn.quote(cgiEnv->GetInformation().Client.GeoLocation.CountryCode3)
-                              % txn.quote(cgiEnv->GetInformation().Client.GeoLocation.CountryName)
-                              % txn.quote(cgiEnv->GetInformation().Client.GeoLocation.Region)
-                              % txn.quote(cgiEnv->GetInformation().Client.GeoLocation.City)
-                              % txn.quote(cgiEnv->GetInformation().Client.GeoLocation.PostalCode)
-                              % txn.quote(lexical_cast<string>(cgiEnv->GetInformation().Client.GeoLocation.Latitude))
-                              % txn.quote(lexical_cast<string>(cgiEnv->GetInformation().Client.GeoLocation.Longitude))
-                              % txn.quote(lexical_cast<string>(cgiEnv->GetInformation().Client.GeoLocation.MetroCode))
-                              % txn.quote(lexical_cast<string>(cgiEnv->GetInformation().Client.GeoLocation.DmaCode))
-                              % txn.quote(lexical_cast<string>(cgiEnv->GetInformation().Client.GeoLocation.AreaCode))
-                              % txn.quote(lexical_cast<string>(cgiEnv->GetInformation().Client.GeoLocation.Charset))
-                              % txn.quote(cgiEnv->GetInformation().Client.GeoLocation.ContinentCode)
-                              % txn.quote(lexical_cast<string>(cgiEnv->GetInformation().Client.GeoLocation.Netmask))
-                              % txn.quote(lexical_cast<string>(cgiEnv->GetInformation().Client.GeoLocation.ASN))
-                              % txn.quote(cgiEnv->GetInformation().Client.GeoLocation.ASO)
-                              % txn.quote(cgiEnv->GetInformation().Client.GeoLocation.RawData)
+                              % (snapshotId.empty() ? string("NULL") : txn.quote(snapshotId))
                               % txn.quote(cgiEnv->GetInformation().Client.UserAgent)
                               % txn.quote(cgiEnv->GetInformation().Client.Referer)
                               % txn.quote(userId)).str());
@@ -515,9 +495,9 @@ void RootLogin::Impl::OnLoginFormSubmitted()
                 r = txn.exec(query);
 
                 Pool::Database().Update("ROOT_CREDENTIALS",
-                                         "user_id", userId,
-                                         "pwd=?",
-                                        { encryptedRecoveryPwd });
+                                        "user_id", userId,
+                                        DATABASE_SQL("pwd=?"),
+                                        encryptedRecoveryPwd);
             }
         } else {
             LOG_ERROR("Login query does not match!", username, cgiEnv->GetInformation().ToJson());
@@ -525,7 +505,7 @@ void RootLogin::Impl::OnLoginFormSubmitted()
 
         if (!success) {
             LOG_ERROR("Login failed!", username, cgiEnv->GetInformation().ToJson());
-            txn.abort();
+            unit.Rollback();
             m_parent->HtmlError(tr("root-login-fail"), LoginMessageArea);
             UsernameLineEdit->setFocus();
             GenerateCaptcha();
@@ -540,25 +520,7 @@ void RootLogin::Impl::OnLoginFormSubmitted()
         record.Email = email;
 
         try {
-            query.assign((format("SELECT t1.email,"
-                                 " EXTRACT ( EPOCH FROM t2.login_time::TIMESTAMPTZ ) as login_time,"
-                                 " t2.ip_address, t2.location_country_code, t2.location_country_code3,"
-                                 " t2.location_country_name, t2.location_region, t2.location_city,"
-                                 " t2.location_postal_code, t2.location_latitude, t2.location_longitude,"
-                                 " t2.location_metro_code, t2.location_dma_code, t2.location_area_code,"
-                                 " t2.location_charset, t2.location_continent_code, t2.location_netmask,"
-                                 " t2.location_asn, t2.location_aso, t2.location_raw_data,"
-                                 " t2.user_agent, t2.referer"
-                                 " FROM \"%1%\" t1"
-                                 " INNER JOIN \"%2%\" t2 ON t1.user_id = t2.user_id"
-                                 " WHERE t1.user_id = %3%"
-                                 " ORDER BY t2.login_time DESC LIMIT 1;")
-                          % txn.esc(Pool::Database().GetTableName("ROOT"))
-                          % txn.esc(Pool::Database().GetTableName("ROOT_SESSIONS"))
-                          % txn.quote(userId)).str());
-            LOG_INFO("Running query...", query, cgiEnv->GetInformation().ToJson());
-
-            r = txn.exec(query);
+            r = lastLogin;
 
             if (!r.empty()) {
                 const pqxx::row row(r[0]);
@@ -607,10 +569,14 @@ void RootLogin::Impl::OnLoginFormSubmitted()
 
         LOG_INFO("Successful login!", cgiEnv->GetInformation().ToJson());
 
-        txn.commit();
-
+        /// The new session joins the transaction, so it gets committed along
+        /// with any password recovery applied above
         PreserveSessionData(n, RememberMeCheckBox->checkState() == Wt::Checked);
 
+        unit.Commit("ROOT_SESSIONS");
+
+        WriteAudit("ROOT_SESSIONS", cgiEnv->GetInformation().Client.Session.Token);
+
         SendLoginAlertEmail(n);
 
         /// It's absolutely safe (even in case of throwing an exception in the constructor)
@@ -696,60 +662,32 @@ void RootLogin::Impl::OnPasswordRecoveryFormSubmitted()
         while (true) {
             CoreLib::Random::Uuid(token);
 
-            query.assign((boost::format("SELECT token FROM \"%1%\" WHERE token = %2%;")
-                          % txn.esc(Service::Pool::Database().GetTableName("ROOT_CREDENTIALS_RECOVERY"))
-                          % txn.quote(token)).str());
-            LOG_INFO("Running query...", query, cgiEnv->GetInformation().ToJson());
+            LOG_INFO("Running prepared statement...", "ROOT_CREDENTIALS_RECOVERY_SELECT_TOKEN", cgiEnv->GetInformation().ToJson());
 
-            r = txn.exec(query);
+            r = Pool::Database().ExecutePrepared(txn, "ROOT_CREDENTIALS_RECOVERY_SELECT_TOKEN", token);
 
             if (r.empty()) {
                 break;
             }
         }
 
+        /// Where the request came from is left to the audit writer
         query.assign((boost::format("INSERT INTO \"%1%\""
-                                    " ( token, user_id, expiry, new_pwd, request_time, request_ip_address,"
-                                    " request_location_country_code, request_location_country_code3,"
-                                    " request_location_country_name, request_location_region, request_location_city,"
-                                    " request_location_postal_code, request_location_latitude, request_location_longitude,"
-                                    " request_location_metro_code, request_location_dma_code, request_location_area_code,"
-                                    " request_location_charset, request_location_continent_code, request_location_netmask,"
-                                    " request_location_asn, request_location_aso, request_location_raw_data,"
-                                    " request_user_agent, request_referer )"
-                                    " VALUES ( %2%, %3%, TO_TIMESTAMP( %4% )::TIMESTAMPTZ, %5%, TO_TIMESTAMP( %6% )::TIMESTAMPTZ,"
-                                    " %7%, %8%, %9%, %10%, %11%, %12%, %13%, %14%, %15%, %16%, %17%, %18%, %19%, %20%, %21%, %22%, %23%, %24%, %25%, %26% );")
+                                    " ( token, user_id, expiry, new_pwd, request_time )"
+                                    " VALUES ( %2%, %3%, TO_TIMESTAMP( %4% )::TIMESTAMPTZ, %5%, TO_TIMESTAMP( %6% )::TIMESTAMPTZ );")
                       % txn.esc(Service::Pool::Database().GetTableName("ROOT_CREDENTIALS_RECOVERY"))
                       % txn.quote(token)
                       % txn.quote(userId)
                       % txn.esc(lexical_cast<string>(expiry))
                       % txn.quote(encryptedPwd)
-                      % txn.esc(lexical_cast<string>(n.RawTime()))
-                      % txn.quote(cgiEnv->GetInformation().Client.IPAddress)
-                      % txn.quote(cgiEnv->GetInformation().Client.GeoLocation.CountryCode)
-                      % txn.quote(cgiEnv->GetInformation().Client.GeoLocation.CountryCode3)
-                      % txn.quote(cgiEnv->GetInformation().Client.GeoLocation.CountryName)
-                      % txn.quote(cgiEnv->GetInformation().Client.GeoLocation.Region)
-                      % txn.quote(cgiEnv->GetInformation().Client.GeoLocation.City)
-                      % txn.quote(cgiEnv->GetInformation().Client.GeoLocation.PostalCode)
-                      % txn.quote(lexical_cast<string>(cgiEnv->GetInformation().Client.GeoLocation.Latitude))
-                      % txn.quote(lexical_cast<string>(cgiEnv->GetInformation().Client.GeoLocation.Longitude))
-                      % txn.quote(lexical_cast<string>(cgiEnv->GetInformation().Client.GeoLocation.MetroCode))
-                      % txn.quote(lexical_cast<string>(cgiEnv->GetInformation().Client.GeoLocation.DmaCode))
-                      % txn.quote(lexical_cast<string>(cgiEnv->GetInformation().Client.GeoLocation.AreaCode))
-                      % txn.quote(lexical_cast<string>(cgiEnv->GetInformation().Client.GeoLocation.Charset))
-                      % txn.quote(cgiEnv->GetInformation().Client.GeoLocation.ContinentCode)
-                      % txn.quote(lexical_cast<string>(cgiEnv->GetInformation().Client.GeoLocation.Netmask))
-                      % txn.quote(lexical_cast<string>(cgiEnv->GetInformation().Client.GeoLocation.ASN))
-                      % txn.quote(cgiEnv->GetInformation().Client.GeoLocation.ASO)
-                      % txn.quote(cgiEnv->GetInformation().Client.GeoLocation.RawData)
-                      % txn.quote(cgiEnv->GetInformation().Client.UserAgent)
-                      % txn.quote(cgiEnv->GetInformation().Client.Referer)).str());
+                      % txn.esc(lexical_cast<string>(n.RawTime()))).str());
         LOG_INFO("Running query...", query, cgiEnv->GetInformation().ToJson());
 
         r = txn.exec(query);
 
-        txn.commit();
+        Pool::Database().Commit(txn, "ROOT_CREDENTIALS_RECOVERY", CoreLib::Database::Durability::Relaxed);
+
+        WriteAudit("ROOT_CREDENTIALS_RECOVERY", token);
 
         SendPasswordRecoveryEmail(email, username, pwd, n);
 
@@ -788,25 +726,21 @@ void RootLogin::Impl::OnGoToHomePageButtonPressed()
     CgiEnv *cgiEnv = cgiRoot->GetCgiEnvInstance();
 
     try {
-        string homePageFields;
+        string homePageStatement;
 
         if (cgiEnv->GetInformation().Client.Language.Code
                 == CgiEnv::InformationRecord::ClientRecord::LanguageCode::Fa) {
-            homePageFields = "homepage_url_fa";
+            homePageStatement = "SETTINGS_SELECT_HOMEPAGE_FA";
         } else {
-            homePageFields = "homepage_url_en";
+            homePageStatement = "SETTINGS_SELECT_HOMEPAGE_EN";
         }
 
-        auto conn = Pool::Database().Connection();
-        pqxx::work txn(*conn.get());
+        auto conn = Pool::Database().Connection(CoreLib::Database::Access::ReadOnly);
+        pqxx::read_transaction txn(*conn.get());
 
-        string query((boost::format("SELECT %1% FROM \"%2%\""
-                                    " WHERE pseudo_id = '0';")
-                      % homePageFields
-                      % txn.esc(Service::Pool::Database().GetTableName("SETTINGS"))).str());
-        LOG_INFO("Running query...", query, cgiEnv->GetInformation().ToJson());
+        LOG_INFO("Running prepared statement...", homePageStatement, cgiEnv->GetInformation().ToJson());
 
-        result r = txn.exec(query);
+        result r = Pool::Database().ExecutePrepared(txn, homePageStatement);
 
         string homePageUrl;
         if (!r.empty()) {
@@ -925,19 +859,16 @@ void RootLogin::Impl::PreserveSessionData(const CDate::Now &n, const bool saveLo
     CgiEnv *cgiEnv = cgiRoot->GetCgiEnvInstance();
 
     try {
-        auto conn = Pool::Database().Connection();
-        pqxx::work txn(*conn.get());
+        CoreLib::Database::UnitOfWork unit(Pool::Database());
+        pqxx::transaction_base &txn = unit.Transaction();
 
         string token;
         while (true) {
             CoreLib::Random::Uuid(token);
 
-            string query((boost::format("SELECT token FROM \"%1%\" WHERE token = %2%;")
-                         % txn.esc(Service::Pool::Database().GetTableName("ROOT_SESSIONS"))
-                         % txn.quote(token)).str());
-            LOG_INFO("Running query...", query, cgiEnv->GetInformation().ToJson());
+            LOG_INFO("Running prepared statement...", "ROOT_SESSIONS_SELECT_TOKEN", cgiEnv->GetInformation().ToJson());
 
-            result r = txn.exec(query);
+            result r = Pool::Database().ExecutePrepared(txn, "ROOT_SESSIONS_SELECT_TOKEN", token);
 
             if (r.empty()) {
                 break;
@@ -957,47 +888,21 @@ void RootLogin::Impl::PreserveSessionData(const CDate::Now &n, const bool saveLo
         }
         /// expiry == 0 --> force exit the session
 
+        /// Where the login came from is left to the audit writer, which the
+        /// caller feeds once the row got committed
         string query((boost::format("INSERT INTO \"%1%\""
-                                    " ( token, user_id, expiry, login_time,"
-                                    " ip_address, location_country_code, location_country_code3,"
-                                    " location_country_name, location_region, location_city,"
-                                    " location_postal_code, location_latitude, location_longitude,"
-                                    " location_metro_code, location_dma_code, location_area_code,"
-                                    " location_charset, location_continent_code, location_netmask,"
-                                    " location_asn, location_aso, location_raw_data,"
-                                    " user_agent, referer )"
-                                    " VALUES ( %2%, %3%, TO_TIMESTAMP( %4% )::TIMESTAMPTZ, TO_TIMESTAMP( %5% )::TIMESTAMPTZ,"
-                                    " %6%, %7%, %8%, %9%, %10%, %11%, %12%, %13%, %14%, %15%, %16%, %17%, %18%, %19%, %20%, %21%, %22%, %23%, %24%, %25% );")
+                                    " ( token, user_id, expiry, login_time )"
+                                    " VALUES ( %2%, %3%, TO_TIMESTAMP( %4% )::TIMESTAMPTZ, TO_TIMESTAMP( %5% )::TIMESTAMPTZ );")
                       % txn.esc(Service::Pool::Database().GetTableName("ROOT_SESSIONS"))
                       % txn.quote(token)
                       % txn.quote(cgiEnv->GetInformation().Client.Session.UserId)
                       % txn.esc(lexical_cast<string>(expiry))
-                      % txn.esc(lexical_cast<string>(n.RawTime()))
-                      % txn.quote(cgiEnv->GetInformation().Client.IPAddress)
-                      % txn.quote(cgiEnv->GetInformation().Client.GeoLocation.CountryCode)
-                      % txn.quote(cgiEnv->GetInformation().Client.GeoLocation.CountryCode3)
-                      % txn.quote(cgiEnv->GetInformation().Client.GeoLocation.CountryName)
-                      % txn.quote(cgiEnv->GetInformation().Client.GeoLocation.Region)
-                      % txn.quote(cgiEnv->GetInformation().Client.GeoLocation.City)
-                      % txn.quote(cgiEnv->GetInformation().Client.GeoLocation.PostalCode)
-                      % txn.quote(lexical_cast<string>(cgiEnv->GetInformation().Client.GeoLocation.Latitude))
-                      % txn.quote(lexical_cast<string>(cgiEnv->GetInformation().Client.GeoLocation.Longitude))
-                      % txn.quote(lexical_cast<string>(cgiEnv->GetInformation().Client.GeoLocation.MetroCode))
-                      % txn.quote(lexical_cast<string>(cgiEnv->GetInformation().Client.GeoLocation.DmaCode))
-                      % txn.quote(lexical_cast<string>(cgiEnv->GetInformation().Client.GeoLocation.AreaCode))
-                      % txn.quote(lexical_cast<string>(cgiEnv->GetInformation().Client.GeoLocation.Charset))
-                      % txn.quote(cgiEnv->GetInformation().Client.GeoLocation.ContinentCode)
-                      % txn.quote(lexical_cast<string>(cgiEnv->GetInformation().Client.GeoLocation.Netmask))
-                      % txn.quote(lexical_cast<string>(cgiEnv->GetInformation().Client.GeoLocation.ASN))
-                      % txn.quote(cgiEnv->GetInformation().Client.GeoLocation.ASO)
-                      % txn.quote(cgiEnv->GetInformation().Client.GeoLocation.RawData)
-                      % txn.quote(cgiEnv->GetInformation().Client.UserAgent)
-                      % txn.quote(cgiEnv->GetInformation().Client.Referer)).str());
+                      % txn.esc(lexical_cast<string>(n.RawTime()))).str());
         LOG_INFO("Running query...", query, cgiEnv->GetInformation().ToJson());
 
         result r = txn.exec(query);
 
-        txn.commit();
+        unit.Commit("ROOT_SESSIONS", CoreLib::Database::Durability::Relaxed);
 
         if (saveLocally) {
             Pool::Crypto().Encrypt(token, token);
@@ -1030,6 +935,106 @@ void RootLogin::Impl::PreserveSessionData(const CDate::Now &n, const bool saveLo
     }
 }
 
+void RootLogin::Impl::WriteAudit(const std::string &id, const std::string &token)
+{
+    CgiRoot *cgiRoot = static_cast<CgiRoot *>(WApplication::instance());
+    CgiEnv *cgiEnv = cgiRoot->GetCgiEnvInstance();
+
+    try {
+        const auto &client = cgiEnv->GetInformation().Client;
+
+        const string snapshotId(WriteGeoSnapshot());
+        if (snapshotId.empty()) {
+            LOG_ERROR("Failed to take a geo-location snapshot!", id, cgiEnv->GetInformation().ToJson());
+            return;
+        }
+
+        /// Same column order as registered with the audit writer
+        Pool::AuditWriter().Write(id, {
+                                      token,
+                                      client.IPAddress,
+                                      snapshotId,
+                                      client.UserAgent,
+                                      client.Referer
+                                  });
+    }
+
+    catch (const boost::exception &ex) {
+        LOG_ERROR(boost::diagnostic_information(ex), cgiEnv->GetInformation().ToJson());
+    }
+
+    catch (const std::exception &ex) {
+        LOG_ERROR(ex.what(), cgiEnv->GetInformation().ToJson());
+    }
+
+    catch (...) {
+        LOG_ERROR(UNKNOWN_ERROR, cgiEnv->GetInformation().ToJson());
+    }
+}
+
+std::string RootLogin::Impl::WriteGeoSnapshot()
+{
+    CgiRoot *cgiRoot = static_cast<CgiRoot *>(WApplication::instance());
+    CgiEnv *cgiEnv = cgiRoot->GetCgiEnvInstance();
+
+    try {
+        /// Same column order as registered with the audit writer
+        CoreLib::AuditWriter::Record record;
+        if (!cgiEnv->GetInformation().Client.GeoLocation.ToSnapshot(record)) {
+            return "";
+        }
+
+        const string snapshotId(record[0]);
+        Pool::AuditWriter().Write("GEO_SNAPSHOTS", std::move(record));
+
+        return snapshotId;
+    }
+
+    catch (const boost::exception &ex) {
+        LOG_ERROR(boost::diagnostic_information(ex), cgiEnv->GetInformation().ToJson());
+    }
+
+    catch (const std::exception &ex) {
+        LOG_ERROR(ex.what(), cgiEnv->GetInformation().ToJson());
+    }
+
+    catch (...) {
+        LOG_ERROR(UNKNOWN_ERROR, cgiEnv->GetInformation().ToJson());
+    }
+
+    return "";
+}
+
+std::string RootLogin::Impl::WriteGeoSnapshot(pqxx::transaction_base &txn)
+{
+    CgiRoot *cgiRoot = static_cast<CgiRoot *>(WApplication::instance());
+    CgiEnv *cgiEnv = cgiRoot->GetCgiEnvInstance();
+
+    std::vector<std::string> values;
+    if (!cgiEnv->GetInformation().Client.GeoLocation.ToSnapshot(values)) {
+        return "";
+    }
+
+    const string snapshotId(values[0]);
+    for (auto &v : values) {
+        v = txn.quote(v);
+    }
+
+    string query((boost::format("INSERT INTO \"%1%\""
+                                " ( snapshot_id, country_code, country_code3, country_name,"
+                                " region, city, postal_code, latitude, longitude,"
+                                " metro_code, dma_code, area_code, charset, continent_code,"
+                                " netmask, asn, aso, raw_data )"
+                                " VALUES ( %2% ) ON CONFLICT DO NOTHING;")
+                  % txn.esc(Pool::Database().GetTableName("GEO_SNAPSHOTS"))
+                  % algorithm::join(values, ", ")).str());
+    LOG_INFO("Running query...", query, cgiEnv->GetInformation().ToJson());
+
+    txn.exec(query);
+
+    return snapshotId;
+}
+
 void RootLogin::Impl::SendLoginAlertEmail(const CDate::Now &n)
 {
     CgiRoot *cgiRoot = static_cast<CgiRoot *>(WApplication::instance());
@@ -59,7 +59,6 @@
 #include <CoreLib/Log.hpp>
 #include <CoreLib/Mail.hpp>
 #include <CoreLib/make_unique.hpp>
-#include <CoreLib/Random.hpp>
 #include "Captcha.hpp"
 #include "CgiEnv.hpp"
 #include "CgiRoot.hpp"
@@ -254,49 +253,24 @@ void Subscription::Impl::OnSubscribeFormSubmitted()
             pendingConfirm = "none";
         }
 
-        auto conn = Pool::Database().Connection();
-        pqxx::work txn(*conn.get());
-
-        string query((boost::format("SELECT uuid FROM \"%1%\""
-                                    " WHERE inbox = %2%;")
-                      % txn.esc(Service::Pool::Database().GetTableName("SUBSCRIBERS"))
-                      % txn.quote(inbox)).str());
-        LOG_INFO("Running query...", query, cgiEnv->GetInformation().ToJson());
-
-        result r = txn.exec(query);
-
-        string uuid;
-
-        if (r.empty()) {
-            while (true) {
-                CoreLib::Random::Uuid(uuid);
+        CoreLib::Database::UnitOfWork unit(Pool::Database());
 
-                query.assign((boost::format("SELECT inbox FROM \"%1%\""
-                                            " WHERE uuid = %2%;")
-                              % txn.esc(Service::Pool::Database().GetTableName("SUBSCRIBERS"))
-                              % txn.quote(uuid)).str());
-                LOG_INFO("Running query...", query, cgiEnv->GetInformation().ToJson());
+        LOG_INFO("Running upsert...", "SUBSCRIBERS", cgiEnv->GetInformation().ToJson());
 
-                r = txn.exec(query);
+        /// New subscribers get their UUID from the server; a known inbox
+        /// keeps its own and only has its pending state reset
+        result r = Pool::Database().Upsert(unit.Transaction(),
+                                           "SUBSCRIBERS",
+                                           DATABASE_COLUMNS("inbox, uuid, subscription, pending_confirm, pending_cancel, join_date, update_date"),
+                                           DATABASE_SQL("?, gen_random_uuid(), 'none', ?, 'none', ?, ?"),
+                                           "inbox",
+                                           DATABASE_SQL("pending_confirm = EXCLUDED.pending_confirm, pending_cancel = 'none'"),
+                                           "uuid",
+                                           inbox, pendingConfirm, date, date);
 
-                if (r.empty()) {
-                    break;
-                }
-            }
+        unit.Commit("SUBSCRIBERS");
 
-            Pool::Database().Insert("SUBSCRIBERS",
-                                    "inbox, uuid, subscription, pending_confirm, pending_cancel, join_date, update_date",
-            { inbox, uuid, "none", pendingConfirm, "none", date, date });
-        } else {
-            const pqxx::row row(r[0]);
-            uuid.assign(row["uuid"].c_str());
-
-            Pool::Database().Update("SUBSCRIBERS",
-                                    "inbox",
-                                    inbox,
-                                    "pending_confirm=?, pending_cancel=?",
-            { pendingConfirm, "none" });
-        }
+        const string uuid(r[0]["uuid"].c_str());
 
         SendMessage(Message::Confirm, uuid, inbox);
 
@@ -364,16 +338,11 @@ void Subscription::Impl::OnUnsubscribeFormSubmitted()
             pending_cancel = "none";
         }
 
-        auto conn = Pool::Database().Connection();
-        pqxx::work txn(*conn.get());
+        CoreLib::Database::UnitOfWork unit(Pool::Database());
 
-        string query((boost::format("SELECT inbox FROM \"%1%\""
-                                    " WHERE inbox = %2%;")
-                      % txn.esc(Service::Pool::Database().GetTableName("SUBSCRIBERS"))
-                      % txn.quote(inbox)).str());
-        LOG_INFO("Running query...", query, cgiEnv->GetInformation().ToJson());
+        LOG_INFO("Running prepared statement...", "SUBSCRIBERS_SELECT_BY_INBOX", cgiEnv->GetInformation().ToJson());
 
-        result r = txn.exec(query);
+        result r = Pool::Database().ExecutePrepared(unit.Transaction(), "SUBSCRIBERS_SELECT_BY_INBOX", inbox);
 
         if (r.empty()) {
             MessageBox = std::make_unique<WMessageBox>(tr("home-subscription-invalid-recipient-id-title"),
@@ -391,8 +360,10 @@ void Subscription::Impl::OnUnsubscribeFormSubmitted()
         Pool::Database().Update("SUBSCRIBERS",
                                 "inbox",
                                 inbox,
-                                "pending_cancel=?",
-        { pending_cancel });
+                                DATABASE_SQL("pending_cancel=?"),
+                                pending_cancel);
+
+        unit.Commit("SUBSCRIBERS");
 
         SendMessage(Message::Cancel, cgiEnv->GetInformation().Subscription.Uuid, inbox);
 
@@ -606,16 +577,29 @@ Wt::WWidget *Subscription::Impl::GetConfirmationPage()
             return tmpl;
         }
 
-        auto conn = Pool::Database().Connection();
-        pqxx::work txn(*conn.get());
+        CoreLib::Database::UnitOfWork unit(Pool::Database());
+        pqxx::transaction_base &txn = unit.Transaction();
 
-        string query((boost::format("SELECT inbox, subscription, pending_confirm FROM \"%1%\""
-                                    " WHERE uuid = %2%;")
-                      % txn.esc(Service::Pool::Database().GetTableName("SUBSCRIBERS"))
-                      % txn.quote(cgiEnv->GetInformation().Subscription.Uuid)).str());
-        LOG_INFO("Running query...", query, cgiEnv->GetInformation().ToJson());
+        string homePageStatement;
+        if (cgiEnv->GetInformation().Client.Language.Code
+                == CgiEnv::InformationRecord::ClientRecord::LanguageCode::Fa) {
+            homePageStatement = "SETTINGS_SELECT_HOMEPAGE_FA";
+        } else {
+            homePageStatement = "SETTINGS_SELECT_HOMEPAGE_EN";
+        }
 
-        pqxx::result r = txn.exec(query);
+        LOG_INFO("Running pipelined statements...", "SUBSCRIBERS_SELECT_BY_UUID", homePageStatement, cgiEnv->GetInformation().ToJson());
+
+        pqxx::result r;
+        pqxx::result homePage;
+        {
+            CoreLib::Database::Pipeline pipeline(txn);
+            auto subscriberQuery = pipeline.QueuePrepared("SUBSCRIBERS_SELECT_BY_UUID",
+                                                          cgiEnv->GetInformation().Subscription.Uuid);
+            auto homePageQuery = pipeline.QueuePrepared(homePageStatement);
+            r = pipeline.Retrieve(subscriberQuery);
+            homePage = pipeline.Retrieve(homePageQuery);
+        }
 
         if (r.empty()) {
             cgiRoot->setTitle(tr("home-subscription-invalid-recipient-id-title"));
@@ -702,29 +686,17 @@ Wt::WWidget *Subscription::Impl::GetConfirmationPage()
             Pool::Database().Update("SUBSCRIBERS",
                                     "inbox",
                                     inbox,
-                                    "subscription=?, pending_confirm=?, pending_cancel=?, update_date=?",
-            { finalSubscription, "none", "none", date });
+                                    DATABASE_SQL("subscription=?, pending_confirm=?, pending_cancel=?, update_date=?"),
+                                    finalSubscription, "none", "none", date);
+
+            unit.Commit("SUBSCRIBERS");
 
             SendMessage(Message::Confirmed, cgiEnv->GetInformation().Subscription.Uuid, inbox);
 
             tmpl->bindString("title", tr("home-subscription-confirmation-congratulation-title"));
             tmpl->bindString("message", tr("home-subscription-confirmation-congratulation-message"));
 
-            string homePageFields;
-            if (cgiEnv->GetInformation().Client.Language.Code
-                    == CgiEnv::InformationRecord::ClientRecord::LanguageCode::Fa) {
-                homePageFields = "homepage_url_fa, homepage_title_fa";
-            } else {
-                homePageFields = "homepage_url_en, homepage_title_en";
-            }
-
-            query.assign((boost::format("SELECT %1% FROM \"%2%\""
-                                        " WHERE pseudo_id = '0';")
-                          % homePageFields
-                          % txn.esc(Service::Pool::Database().GetTableName("SETTINGS"))).str());
-            LOG_INFO("Running query...", query, cgiEnv->GetInformation().ToJson());
-
-            r = txn.exec(query);
+            r = homePage;
 
             if (!r.empty()) {
                 const string homePageUrl(r[0][0].c_str());
@@ -784,13 +756,10 @@ Wt::WWidget *Subscription::Impl::GetUnsubscribeForm()
         auto conn = Pool::Database().Connection();
         pqxx::work txn(*conn.get());
 
-        string query((boost::format("SELECT inbox, subscription FROM \"%1%\""
-                                    " WHERE uuid = %2%;")
-                      % txn.esc(Service::Pool::Database().GetTableName("SUBSCRIBERS"))
-                      % txn.quote(cgiEnv->GetInformation().Subscription.Uuid)).str());
-        LOG_INFO("Running query...", query, cgiEnv->GetInformation().ToJson());
+        LOG_INFO("Running prepared statement...", "SUBSCRIBERS_SELECT_BY_UUID", cgiEnv->GetInformation().ToJson());
 
-        pqxx::result r = txn.exec(query);
+        pqxx::result r = Pool::Database().ExecutePrepared(txn, "SUBSCRIBERS_SELECT_BY_UUID",
+                                                          cgiEnv->GetInformation().Subscription.Uuid);
 
         if (r.empty()) {
             cgiRoot->setTitle(tr("home-subscription-invalid-recipient-id-title"));
@@ -1004,16 +973,29 @@ Wt::WWidget *Subscription::Impl::GetCancellationPage()
             return tmpl;
         }
 
-        auto conn = Pool::Database().Connection();
-        pqxx::work txn(*conn.get());
+        CoreLib::Database::UnitOfWork unit(Pool::Database());
+        pqxx::transaction_base &txn = unit.Transaction();
 
-        string query((boost::format("SELECT inbox, subscription, pending_cancel FROM \"%1%\""
-                                    " WHERE uuid = %2%;")
-                      % txn.esc(Service::Pool::Database().GetTableName("SUBSCRIBERS"))
-                      % txn.quote(cgiEnv->GetInformation().Subscription.Uuid)).str());
-        LOG_INFO("Running query...", query, cgiEnv->GetInformation().ToJson());
+        string homePageStatement;
+        if (cgiEnv->GetInformation().Client.Language.Code
+                == CgiEnv::InformationRecord::ClientRecord::LanguageCode::Fa) {
+            homePageStatement = "SETTINGS_SELECT_HOMEPAGE_FA";
+        } else {
+            homePageStatement = "SETTINGS_SELECT_HOMEPAGE_EN";
+        }
 
-        pqxx::result r = txn.exec(query);
+        LOG_INFO("Running pipelined statements...", "SUBSCRIBERS_SELECT_BY_UUID", homePageStatement, cgiEnv->GetInformation().ToJson());
+
+        pqxx::result r;
+        pqxx::result homePage;
+        {
+            CoreLib::Database::Pipeline pipeline(txn);
+            auto subscriberQuery = pipeline.QueuePrepared("SUBSCRIBERS_SELECT_BY_UUID",
+                                                          cgiEnv->GetInformation().Subscription.Uuid);
+            auto homePageQuery = pipeline.QueuePrepared(homePageStatement);
+            r = pipeline.Retrieve(subscriberQuery);
+            homePage = pipeline.Retrieve(homePageQuery);
+        }
 
         if (r.empty()) {
             cgiRoot->setTitle(tr("home-subscription-invalid-recipient-id-title"));
@@ -1090,29 +1072,17 @@ Wt::WWidget *Subscription::Impl::GetCancellationPage()
             Pool::Database().Update("SUBSCRIBERS",
                                     "inbox",
                                     inbox,
-                                    "subscription=?, pending_cancel=?, update_date=?",
-            { finalSubscription, "none", date });
+                                    DATABASE_SQL("subscription=?, pending_cancel=?, update_date=?"),
+                                    finalSubscription, "none", date);
+
+            unit.Commit("SUBSCRIBERS");
 
             SendMessage(Message::Cancelled, cgiEnv->GetInformation().Subscription.Uuid, inbox);
 
             tmpl->bindString("title", tr("home-subscription-cancellation-cancelled-title"));
             tmpl->bindString("message", tr("home-subscription-cancellation-cancelled-message"));
 
-            string homePageFields;
-            if (cgiEnv->GetInformation().Client.Language.Code
-                    == CgiEnv::InformationRecord::ClientRecord::LanguageCode::Fa) {
-                homePageFields = "homepage_url_fa, homepage_title_fa";
-            } else {
-                homePageFields = "homepage_url_en, homepage_title_en";
-            }
-
-            query.assign((boost::format("SELECT %1% FROM \"%2%\""
-                                        " WHERE pseudo_id = '0';")
-                          % homePageFields
-                          % txn.esc(Service::Pool::Database().GetTableName("SETTINGS"))).str());
-            LOG_INFO("Running query...", query, cgiEnv->GetInformation().ToJson());
-
-            r = txn.exec(query);
+            r = homePage;
 
             if (!r.empty()) {
                 const string homePageUrl(r[0][0].c_str());
@@ -1165,24 +1135,21 @@ void Subscription::Impl::GetMessageTemplate(WTemplate *tmpl, const Wt::WString &
             tmpl->bindString("title", title);
             tmpl->bindString("message", message);
 
-            string homePageFields;
+            string homePageStatement;
             if (cgiEnv->GetInformation().Client.Language.Code
                     == CgiEnv::InformationRecord::ClientRecord::LanguageCode::Fa) {
-                homePageFields = "homepage_url_fa, homepage_title_fa";
+                homePageStatement = "SETTINGS_SELECT_HOMEPAGE_FA";
             } else {
-                homePageFields = "homepage_url_en, homepage_title_en";
+                homePageStatement = "SETTINGS_SELECT_HOMEPAGE_EN";
             }
 
-            auto conn = Pool::Database().Connection();
-            pqxx::work txn(*conn.get());
+            /// Joins the caller's unit of work, if any, rather than borrowing
+            /// another connection
+            CoreLib::Database::UnitOfWork unit(Pool::Database(), CoreLib::Database::Access::ReadOnly);
 
-            string query((boost::format("SELECT %1% FROM \"%2%\""
-                                        " WHERE pseudo_id = '0';")
-                          % homePageFields
-                          % txn.esc(Service::Pool::Database().GetTableName("SETTINGS"))).str());
-            LOG_INFO("Running query...", query, cgiEnv->GetInformation().ToJson());
+            LOG_INFO("Running prepared statement...", homePageStatement, cgiEnv->GetInformation().ToJson());
 
-            result r = txn.exec(query);
+            result r = Pool::Database().ExecutePrepared(unit.Transaction(), homePageStatement);
 
             if (!r.empty()) {
                 const pqxx::row row(r[0]);
@@ -1354,24 +1321,21 @@ void Subscription::Impl::SendMessage(const Message &type, const string &uuid, co
                         lexical_cast<string>(cgiEnv->GetInformation().Client.GeoLocation.RawData));
 #endif // !(GDPR_COMPLIANCE)
 
-            string homePageFields;
+            string homePageStatement;
             if (cgiEnv->GetInformation().Client.Language.Code
                     == CgiEnv::InformationRecord::ClientRecord::LanguageCode::Fa) {
-                homePageFields = "homepage_url_fa, homepage_title_fa";
+                homePageStatement = "SETTINGS_SELECT_HOMEPAGE_FA";
             } else {
-                homePageFields = "homepage_url_en, homepage_title_en";
+                homePageStatement = "SETTINGS_SELECT_HOMEPAGE_EN";
             }
 
-            auto conn = Pool::Database().Connection();
-            pqxx::work txn(*conn.get());
+            /// Joins the caller's unit of work, if any, rather than borrowing
+            /// another connection
+            CoreLib::Database::UnitOfWork unit(Pool::Database(), CoreLib::Database::Access::ReadOnly);
 
-            string query((boost::format("SELECT %1% FROM \"%2%\""
-                                        " WHERE pseudo_id = '0';")
-                          % homePageFields
-                          % txn.esc(Service::Pool::Database().GetTableName("SETTINGS"))).str());
-            LOG_INFO("Running query...", query, cgiEnv->GetInformation().ToJson());
+            LOG_INFO("Running prepared statement...", homePageStatement, cgiEnv->GetInformation().ToJson());
 
-            result r = txn.exec(query);
+            result r = Pool::Database().ExecutePrepared(unit.Transaction(), homePageStatement);
 
             string homePageUrl;
             string homePageTitle;
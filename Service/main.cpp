@@ -33,6 +33,11 @@
  */
 
 
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
 #include <csignal>
 #include <cstdlib>
 #if defined ( _WIN32 )
@@ -41,6 +46,7 @@
 #include <unistd.h>
 #endif  // defined ( _WIN32 )
 #include <boost/algorithm/string.hpp>
+#include <boost/asio/signal_set.hpp>
 #include <boost/exception/diagnostic_information.hpp>
 #include <boost/filesystem/exception.hpp>
 #include <boost/filesystem/operations.hpp>
@@ -56,22 +62,33 @@
 #include <ImageMagick-6/Magick++.h>
 #endif // MAGICKPP_BACKEND == MAGICKPP_GM
 #include <statgrab.h>
+#include <CoreLib/AuditWriter.hpp>
 #include <CoreLib/CoreLib.hpp>
 #include <CoreLib/CDate.hpp>
 #include <CoreLib/Crypto.hpp>
 #include <CoreLib/Database.hpp>
 #include <CoreLib/Exception.hpp>
 #include <CoreLib/Log.hpp>
+#include <CoreLib/Mail.hpp>
+#include <CoreLib/MailSpool.hpp>
 #include <CoreLib/make_unique.hpp>
-#include <CoreLib/Random.hpp>
 #include <CoreLib/System.hpp>
+#include "CgiEnv.hpp"
 #include "CgiRoot.hpp"
 #include "Exception.hpp"
+#include "NewsletterCampaign.hpp"
 #include "Pool.hpp"
 #include "VersionInfo.hpp"
 
+/// Bump along with a new UpgradeDatabaseToVersion*() whenever the schema changes
+#define     DATABASE_VERSION        2
+
 void Terminate [[noreturn]] (int signo);
+#if defined ( __unix__ )
+void WaitForMetricsSignal(boost::asio::signal_set &signals);
+#endif  // defined ( __unix__ )
 void InitializeDatabase();
+void UpgradeDatabaseToVersion2(pqxx::transaction_base &txn);
 
 #if defined ( __unix__ )
 int main(int argc, char **argv, char **envp)
@@ -86,6 +103,12 @@ int main(int argc, char **argv)
         if (prev_fn == SIG_IGN)
             signal(SIGTERM, SIG_IGN);
 
+#if defined ( __unix__ )
+        /// Until the server is up and listens for it below, SIGUSR1 must not
+        /// take the process down
+        signal(SIGUSR1, SIG_IGN);
+#endif  // defined ( __unix__ )
+
 
         /// Extract the executable path and name
         boost::filesystem::path path(boost::filesystem::initial_path<boost::filesystem::path>());
@@ -180,15 +203,50 @@ int main(int argc, char **argv)
         InitializeDatabase();
 
 
+        /// Number of threads allowed to send queued mails in parallel
+        CoreLib::Mail::SetMaxWorkers(MAIL_MAX_WORKERS);
+#if MAIL_SPOOL
+        CoreLib::Mail::SetSpool(&Service::Pool::MailSpool());
+        Service::Pool::MailSpool().Start(MAIL_MAX_WORKERS);
+#endif  // MAIL_SPOOL
+
+        /// Newsletters interrupted by a crash or restart go on where they stopped
+        Service::NewsletterCampaign::ResumeAll();
+
+
         /// Start the server, otherwise go down
         LOG_INFO("Starting the server...");
         Wt::WServer server(argv[0]);
         server.setServerConfiguration(argc, argv, WTHTTP_CONFIGURATION);
+        Service::Pool::Database().EnableAsync(server.ioService(), PGSQL_ASYNC_CONNECTIONS);
+#if defined ( __unix__ )
+        /// Dump database latency histograms on SIGUSR1; the dump locks and
+        /// allocates, so it runs on the event loop rather than in the handler
+        boost::asio::signal_set metricsSignals(server.ioService(), SIGUSR1);
+        WaitForMetricsSignal(metricsSignals);
+#endif  // defined ( __unix__ )
         server.addEntryPoint(Wt::Application, Service::CgiRoot::CreateApplication, "", "favicon.ico");
         if (server.start()) {
             int sig = Wt::WServer::waitForShutdown();
             server.stop();
 
+            /// Close the async connections while their io_service is still around
+            Service::Pool::Database().DisableAsync();
+
+            /// Let the newsletter batches in flight record their outcome
+            Service::NewsletterCampaign::StopAll();
+
+            /// Write out the audit rows still waiting in the queue
+            Service::Pool::AuditWriter().Stop();
+
+#if MAIL_SPOOL
+            /// Spooled mails not leased yet wait in the database for the next run
+            Service::Pool::MailSpool().Stop();
+#endif  // MAIL_SPOOL
+
+            /// Send out the queued mails and let go of the relay
+            CoreLib::Mail::StopWorkers();
+
 #if defined ( __unix__ )
             /// Experimental, UNIX only
             if (sig == SIGHUP)
@@ -244,16 +302,43 @@ void Terminate(int signo)
     exit(EXIT_FAILURE);
 }
 
+#if defined ( __unix__ )
+void WaitForMetricsSignal(boost::asio::signal_set &signals)
+{
+    signals.async_wait([&signals](const boost::system::error_code &ec, int signo) {
+        (void)signo;
+
+        if (ec)
+            return;
+
+        LOG_INFO(Service::Pool::Database().DumpMetrics());
+
+        WaitForMetricsSignal(signals);
+    });
+}
+#endif  // defined ( __unix__ )
+
 void InitializeDatabase()
 {
     try {
         LOG_INFO("main: Initializing database...");
 
+        LOG_INFO("main: Registering database extensions...");
+
+        /// gen_random_uuid() is built into PostgreSQL 13 and later, earlier
+        /// versions get it from pgcrypto
+        Service::Pool::Database().RegisterExtension("PGCRYPTO", "pgcrypto");
+
+        LOG_INFO("main: Registered all database extensions!");
+
         LOG_INFO("main: Registering database enums...");
 
         Service::Pool::Database().RegisterEnum("SUBSCRIPTION", "subscription",
         { "none", "en_fa", "en", "fa" });
 
+        Service::Pool::Database().RegisterEnum("DELIVERY_STATUS", "delivery_status",
+        { "pending", "sending", "sent", "failed" });
+
         LOG_INFO("main: Registered all database enums!");
 
         LOG_INFO("main: Registering database tables...");
@@ -273,6 +358,28 @@ void InitializeDatabase()
                                                 " pwd TEXT NOT NULL, "
                                                 " modification_time TIMESTAMPTZ NOT NULL DEFAULT TIMESTAMPTZ $token$'EPOCH'''$token$ ");
 
+        /// Content addressed: snapshot_id is derived from the record itself, so
+        /// every distinct location is stored once, however many rows refer to it
+        Service::Pool::Database().RegisterTable("GEO_SNAPSHOTS", "geo_snapshots",
+                                                " snapshot_id UUID NOT NULL PRIMARY KEY, "
+                                                " country_code TEXT, "
+                                                " country_code3 TEXT, "
+                                                " country_name TEXT, "
+                                                " region TEXT, "
+                                                " city TEXT, "
+                                                " postal_code TEXT, "
+                                                " latitude REAL, "
+                                                " longitude REAL, "
+                                                " metro_code INTEGER, "
+                                                " dma_code INTEGER, "
+                                                " area_code INTEGER, "
+                                                " charset INTEGER, "
+                                                " continent_code TEXT, "
+                                                " netmask INTEGER, "
+                                                " asn INTEGER, "
+                                                " aso TEXT, "
+                                                " raw_data JSONB ");
+
         Service::Pool::Database().RegisterTable("ROOT_CREDENTIALS_RECOVERY", "root_credentials_recovery",
                                                 " token UUID NOT NULL PRIMARY KEY, "
                                                 " user_id UUID NOT NULL, "
@@ -280,44 +387,12 @@ void InitializeDatabase()
                                                 " new_pwd TEXT NOT NULL, "
                                                 " request_time TIMESTAMPTZ NOT NULL, "
                                                 " request_ip_address INET, "
-                                                " request_location_country_code TEXT, "
-                                                " request_location_country_code3 TEXT, "
-                                                " request_location_country_name TEXT, "
-                                                " request_location_region TEXT, "
-                                                " request_location_city TEXT, "
-                                                " request_location_postal_code TEXT, "
-                                                " request_location_latitude TEXT, "
-                                                " request_location_longitude TEXT, "
-                                                " request_location_metro_code TEXT, "
-                                                " request_location_dma_code TEXT, "
-                                                " request_location_area_code TEXT, "
-                                                " request_location_charset TEXT, "
-                                                " request_location_continent_code TEXT, "
-                                                " request_location_netmask TEXT, "
-                                                " request_location_asn TEXT, "
-                                                " request_location_aso TEXT, "
-                                                " request_location_raw_data JSONB, "
+                                                " request_geo_snapshot_id UUID, "
                                                 " request_user_agent TEXT, "
                                                 " request_referer TEXT, "
                                                 " utilization_time TIMESTAMPTZ NOT NULL DEFAULT TIMESTAMPTZ $token$'EPOCH'''$token$, "
                                                 " utilization_ip_address INET, "
-                                                " utilization_location_country_code TEXT, "
-                                                " utilization_location_country_code3 TEXT, "
-                                                " utilization_location_country_name TEXT, "
-                                                " utilization_location_region TEXT, "
-                                                " utilization_location_city TEXT, "
-                                                " utilization_location_postal_code TEXT, "
-                                                " utilization_location_latitude TEXT, "
-                                                " utilization_location_longitude TEXT, "
-                                                " utilization_location_metro_code TEXT, "
-                                                " utilization_location_dma_code TEXT, "
-                                                " utilization_location_area_code TEXT, "
-                                                " utilization_location_charset TEXT, "
-                                                " utilization_location_continent_code TEXT, "
-                                                " utilization_location_netmask TEXT, "
-                                                " utilization_location_aso TEXT, "
-                                                " utilization_location_asn TEXT, "
-                                                " utilization_location_raw_data JSONB, "
+                                                " utilization_geo_snapshot_id UUID, "
                                                 " utilization_user_agent TEXT, "
                                                 " utilization_referer TEXT ");
 
@@ -327,23 +402,7 @@ void InitializeDatabase()
                                                 " expiry TIMESTAMPTZ NOT NULL DEFAULT TIMESTAMPTZ $token$'EPOCH'''$token$, "
                                                 " login_time TIMESTAMPTZ NOT NULL DEFAULT TIMESTAMPTZ $token$'EPOCH'''$token$, "
                                                 " ip_address INET, "
-                                                " location_country_code TEXT, "
-                                                " location_country_code3 TEXT, "
-                                                " location_country_name TEXT, "
-                                                " location_region TEXT, "
-                                                " location_city TEXT, "
-                                                " location_postal_code TEXT, "
-                                                " location_latitude REAL, "
-                                                " location_longitude REAL, "
-                                                " location_metro_code INTEGER, "
-                                                " location_dma_code INTEGER, "
-                                                " location_area_code INTEGER, "
-                                                " location_charset INTEGER, "
-                                                " location_continent_code TEXT, "
-                                                " location_netmask INTEGER, "
-                                                " location_asn INTEGER, "
-                                                " location_aso TEXT, "
-                                                " location_raw_data JSONB, "
+                                                " geo_snapshot_id UUID, "
                                                 " user_agent TEXT, "
                                                 " referer TEXT ");
 
@@ -369,74 +428,307 @@ void InitializeDatabase()
                                                 " join_date TEXT NOT NULL, "
                                                 " update_date TEXT NOT NULL ");
 
+        /// Maintained by a trigger on SUBSCRIBERS, so listings never count the whole table
+        Service::Pool::Database().RegisterTable("SUBSCRIBERS_COUNTS", "subscribers_counts",
+                                                " subscription SUBSCRIPTION NOT NULL PRIMARY KEY, "
+                                                " total BIGINT NOT NULL DEFAULT 0 ");
+
+        Service::Pool::Database().RegisterTable("NEWSLETTER_CAMPAIGNS", "newsletter_campaigns",
+                                                " campaign_id UUID NOT NULL PRIMARY KEY, "
+                                                " sender TEXT NOT NULL, "
+                                                " copy_to TEXT NOT NULL, "
+                                                " subject TEXT NOT NULL, "
+                                                " body TEXT NOT NULL, "
+                                                " unsubscribe_link TEXT NOT NULL, "
+                                                " creation_time TIMESTAMPTZ NOT NULL DEFAULT NOW(), "
+                                                " completion_time TIMESTAMPTZ ");
+
+        /// The recipients of a campaign as of its creation, each with its own outcome
+        Service::Pool::Database().RegisterTable("NEWSLETTER_DELIVERIES", "newsletter_deliveries",
+                                                " campaign_id UUID NOT NULL, "
+                                                " inbox TEXT NOT NULL, "
+                                                " uuid UUID NOT NULL, "
+                                                " status DELIVERY_STATUS NOT NULL DEFAULT 'pending', "
+                                                " lease_token UUID, "
+                                                " lease_expiry TIMESTAMPTZ, "
+                                                " error TEXT, "
+                                                " delivery_time TIMESTAMPTZ, "
+                                                " PRIMARY KEY ( campaign_id, inbox ) ");
+
+#if MAIL_SPOOL
+        /// Drained by every instance sharing the database, see CoreLib::MailSpool
+        Service::Pool::Database().RegisterTable("MAIL_SPOOL", "mail_spool",
+                                                " id BIGSERIAL NOT NULL PRIMARY KEY, "
+                                                " sender TEXT NOT NULL, "
+                                                " recipient TEXT NOT NULL, "
+                                                " subject TEXT NOT NULL, "
+                                                " body TEXT NOT NULL, "
+                                                " attachments TEXT NOT NULL DEFAULT '', "
+                                                " enqueue_time TIMESTAMPTZ NOT NULL DEFAULT NOW(), "
+                                                " available_at TIMESTAMPTZ NOT NULL DEFAULT NOW(), "
+                                                " attempts INTEGER NOT NULL DEFAULT 0, "
+                                                " lease_token UUID, "
+                                                " last_error TEXT ");
+#endif  // MAIL_SPOOL
+
         LOG_INFO("main: Registered all database tables!");
 
 
+        LOG_INFO("main: Registering database indexes...");
+
+        /// CMS filters by subscription and pages by inbox
+        Service::Pool::Database().RegisterIndex("SUBSCRIBERS_SUBSCRIPTION", "subscribers_subscription_inbox_idx",
+                                                "SUBSCRIBERS", "subscription, inbox");
+
+        /// Newsletter recipients are read straight from the index
+        Service::Pool::Database().RegisterIndex("SUBSCRIBERS_ACTIVE", "subscribers_active_idx",
+                                                "SUBSCRIBERS", "subscription", "inbox, uuid",
+                                                "subscription <> 'none'");
+
+        /// Last login lookup
+        Service::Pool::Database().RegisterIndex("ROOT_SESSIONS_USER_ID_LOGIN_TIME", "root_sessions_user_id_login_time_idx",
+                                                "ROOT_SESSIONS", "user_id, login_time DESC");
+
+        /// Dispatchers only ever look for what is left of a campaign
+        Service::Pool::Database().RegisterIndex("NEWSLETTER_DELIVERIES_PENDING", "newsletter_deliveries_pending_idx",
+                                                "NEWSLETTER_DELIVERIES", "campaign_id, inbox", "uuid",
+                                                "status = 'pending' OR status = 'sending'");
+
+#if MAIL_SPOOL
+        /// Claiming walks the spool in availability order; parked mails sit
+        /// at infinity, out of the way
+        Service::Pool::Database().RegisterIndex("MAIL_SPOOL_AVAILABLE_AT", "mail_spool_available_at_idx",
+                                                "MAIL_SPOOL", "available_at");
+#endif  // MAIL_SPOOL
+
+        LOG_INFO("main: Registered all database indexes!");
+
+        /// Audit trails may lose their last few rows in a crash; signups and
+        /// credentials must not
+        Service::Pool::Database().SetTableDurability("ROOT_SESSIONS",
+                                                     CoreLib::Database::Durability::Relaxed);
+        Service::Pool::Database().SetTableDurability("ROOT_CREDENTIALS_RECOVERY",
+                                                     CoreLib::Database::Durability::Relaxed);
+
+        /// Requests only insert the columns a row cannot live without and leave
+        /// the rest of the audit trail to the writer, matched on the token
+        Service::Pool::AuditWriter().Register("GEO_SNAPSHOTS",
+        { "snapshot_id", "country_code", "country_code3", "country_name",
+          "region", "city", "postal_code", "latitude", "longitude",
+          "metro_code", "dma_code", "area_code", "charset", "continent_code",
+          "netmask", "asn", "aso", "raw_data" },
+        CoreLib::AuditWriter::Mode::InsertIgnoreConflicts);
+        Service::Pool::AuditWriter().Register("ROOT_SESSIONS",
+        { "token", "ip_address", "geo_snapshot_id", "user_agent", "referer" },
+        CoreLib::AuditWriter::Mode::Update,
+        { "token" });
+        Service::Pool::AuditWriter().Register("ROOT_CREDENTIALS_RECOVERY",
+        { "token", "request_ip_address", "request_geo_snapshot_id", "request_user_agent", "request_referer" },
+        CoreLib::AuditWriter::Mode::Update,
+        { "token" });
+
+
         LOG_INFO("main: Calling Database::Initialize()...");
         Service::Pool::Database().Initialize();
 
 
-        LOG_INFO("main: Setting up the database...");
+        /// Statements get prepared against the latest schema, so an older one
+        /// has to be upgraded before any of them is registered
+        {
+            auto conn = Service::Pool::Database().Connection();
+            pqxx::work txn(*conn.get());
+
+            /// Check the database version; the table lock keeps concurrent instances
+            /// from upgrading the same database twice, or both versioning a fresh
+            /// one, which has no row to lock yet
+            const std::string version(txn.esc(Service::Pool::Database().GetTableName("VERSION")));
+            txn.exec((boost::format("LOCK TABLE \"%1%\" IN SHARE ROW EXCLUSIVE MODE;") % version).str());
+            pqxx::result r = txn.exec((boost::format("SELECT version FROM \"%1%\";") % version).str());
+
+            /// If the database is un-versioned
+            if (r.empty()) {
+                /// The tables have just been created with the latest schema; the row
+                /// commits along with the check or not at all
+                Service::Pool::Database().InsertReturning(txn, "VERSION", DATABASE_COLUMNS("version"),
+                                                          DATABASE_SQL("?"), "", DATABASE_VERSION);
+            } else if (r[0]["version"].as<int>() < 2) {
+                LOG_INFO("main: Upgrading the database to version 2...");
+                UpgradeDatabaseToVersion2(txn);
+            }
 
-        auto conn = Service::Pool::Database().Connection();
-        pqxx::work txn(*conn.get());
+            Service::Pool::Database().Commit(txn, "VERSION");
+        }
 
-        /// Check the database version
-        pqxx::result r = txn.exec((boost::format("SELECT version FROM \"%1%\" WHERE 1 = 1;")
-                                   % txn.esc(Service::Pool::Database().GetTableName("VERSION"))).str());
 
-        /// If the database is un-versioned
-        if (r.empty()) {
-            /// Insert the version number 1
-            Service::Pool::Database().Insert("VERSION", "version", { "1" });
-        }
+        /// Statements are prepared against the tables above, hence they have to
+        /// be registered after Database::Initialize() has created them
+        LOG_INFO("main: Registering prepared statements...");
+
+        Service::Pool::Database().RegisterStatement("SUBSCRIBERS_SELECT_BY_INBOX",
+                                                    (boost::format("SELECT inbox, uuid, subscription, pending_confirm, pending_cancel"
+                                                                   " FROM \"%1%\" WHERE inbox = $1;")
+                                                     % Service::Pool::Database().GetTableName("SUBSCRIBERS")).str());
+
+        Service::Pool::Database().RegisterStatement("SUBSCRIBERS_SELECT_BY_UUID",
+                                                    (boost::format("SELECT inbox, uuid, subscription, pending_confirm, pending_cancel"
+                                                                   " FROM \"%1%\" WHERE uuid = $1;")
+                                                     % Service::Pool::Database().GetTableName("SUBSCRIBERS")).str());
+
+        Service::Pool::Database().RegisterStatement("SETTINGS_SELECT_HOMEPAGE_EN",
+                                                    (boost::format("SELECT homepage_url_en, homepage_title_en"
+                                                                   " FROM \"%1%\" WHERE pseudo_id = '0';")
+                                                     % Service::Pool::Database().GetTableName("SETTINGS")).str());
+
+        Service::Pool::Database().RegisterStatement("SETTINGS_SELECT_HOMEPAGE_FA",
+                                                    (boost::format("SELECT homepage_url_fa, homepage_title_fa"
+                                                                   " FROM \"%1%\" WHERE pseudo_id = '0';")
+                                                     % Service::Pool::Database().GetTableName("SETTINGS")).str());
+
+        Service::Pool::Database().RegisterStatement("ROOT_SELECT_EMAIL_BY_USERNAME",
+                                                    (boost::format("SELECT email FROM \"%1%\" WHERE username = $1;")
+                                                     % Service::Pool::Database().GetTableName("ROOT")).str());
+
+        Service::Pool::Database().RegisterStatement("ROOT_SELECT_CREDENTIALS_BY_USERNAME",
+                                                    (boost::format("SELECT t1.user_id, t1.username, t1.email, t2.pwd, t3.new_pwd,"
+                                                                   " EXTRACT ( EPOCH FROM t3.expiry::TIMESTAMPTZ ) as expiry"
+                                                                   " FROM \"%1%\" t1"
+                                                                   " INNER JOIN \"%2%\" t2 ON t1.user_id = t2.user_id"
+                                                                   " LEFT OUTER JOIN \"%3%\" t3 ON t1.user_id = t3.user_id"
+                                                                   " WHERE t1.username = $1"
+                                                                   " ORDER BY t3.request_time DESC LIMIT 1;")
+                                                     % Service::Pool::Database().GetTableName("ROOT")
+                                                     % Service::Pool::Database().GetTableName("ROOT_CREDENTIALS")
+                                                     % Service::Pool::Database().GetTableName("ROOT_CREDENTIALS_RECOVERY")).str());
+
+        Service::Pool::Database().RegisterStatement("ROOT_SESSIONS_SELECT_EXPIRY_BY_TOKEN",
+                                                    (boost::format("SELECT EXTRACT ( EPOCH FROM expiry::TIMESTAMPTZ ) as expiry"
+                                                                   " FROM \"%1%\" WHERE token = $1;")
+                                                     % Service::Pool::Database().GetTableName("ROOT_SESSIONS")).str());
+
+        Service::Pool::Database().RegisterStatement("ROOT_SESSIONS_SELECT_TOKEN",
+                                                    (boost::format("SELECT token FROM \"%1%\" WHERE token = $1;")
+                                                     % Service::Pool::Database().GetTableName("ROOT_SESSIONS")).str());
+
+        Service::Pool::Database().RegisterStatement("ROOT_SESSIONS_SELECT_LAST_LOGIN_BY_USERNAME",
+                                                    (boost::format("SELECT t1.user_id, t1.username, t1.email,"
+                                                                   " EXTRACT ( EPOCH FROM t2.login_time::TIMESTAMPTZ ) as login_time,"
+                                                                   " t2.ip_address, t3.country_code AS location_country_code,"
+                                                                   " t3.country_code3 AS location_country_code3,"
+                                                                   " t3.country_name AS location_country_name,"
+                                                                   " t3.region AS location_region, t3.city AS location_city,"
+                                                                   " t3.postal_code AS location_postal_code,"
+                                                                   " COALESCE ( t3.latitude, 0 ) AS location_latitude,"
+                                                                   " COALESCE ( t3.longitude, 0 ) AS location_longitude,"
+                                                                   " COALESCE ( t3.metro_code, 0 ) AS location_metro_code,"
+                                                                   " COALESCE ( t3.dma_code, 0 ) AS location_dma_code,"
+                                                                   " COALESCE ( t3.area_code, 0 ) AS location_area_code,"
+                                                                   " COALESCE ( t3.charset, 0 ) AS location_charset,"
+                                                                   " t3.continent_code AS location_continent_code,"
+                                                                   " COALESCE ( t3.netmask, 0 ) AS location_netmask,"
+                                                                   " COALESCE ( t3.asn, 0 ) AS location_asn,"
+                                                                   " t3.aso AS location_aso, t3.raw_data AS location_raw_data,"
+                                                                   " t2.user_agent, t2.referer"
+                                                                   " FROM \"%1%\" t1"
+                                                                   " INNER JOIN \"%2%\" t2 ON t1.user_id = t2.user_id"
+                                                                   " LEFT OUTER JOIN \"%3%\" t3 ON t2.geo_snapshot_id = t3.snapshot_id"
+                                                                   " WHERE t1.username = $1"
+                                                                   " ORDER BY t2.login_time DESC LIMIT 1;")
+                                                     % Service::Pool::Database().GetTableName("ROOT")
+                                                     % Service::Pool::Database().GetTableName("ROOT_SESSIONS")
+                                                     % Service::Pool::Database().GetTableName("GEO_SNAPSHOTS")).str());
+
+        Service::Pool::Database().RegisterStatement("ROOT_CREDENTIALS_RECOVERY_SELECT_TOKEN",
+                                                    (boost::format("SELECT token FROM \"%1%\" WHERE token = $1;")
+                                                     % Service::Pool::Database().GetTableName("ROOT_CREDENTIALS_RECOVERY")).str());
+
+        Service::Pool::Database().RegisterStatement("CONTACTS_SELECT_ADDRESS_BY_RECIPIENT",
+                                                    (boost::format("SELECT address FROM \"%1%\" WHERE recipient = $1;")
+                                                     % Service::Pool::Database().GetTableName("CONTACTS")).str());
+
+        Service::Pool::Database().RegisterStatement("CONTACTS_SELECT_ADDRESS_BY_RECIPIENT_FA",
+                                                    (boost::format("SELECT address FROM \"%1%\" WHERE recipient_fa = $1;")
+                                                     % Service::Pool::Database().GetTableName("CONTACTS")).str());
+
+        LOG_INFO("main: Registered all prepared statements!");
 
-        /// Check whether the default root user already exists
-        r = txn.exec((boost::format("SELECT username FROM \"%1%\" WHERE username=%2%;")
-                      % txn.esc(Service::Pool::Database().GetTableName("ROOT"))
-                      % txn.quote(Service::Pool::Storage().RootUsername())).str());
 
-        /// If the default root user does not exists
-        if (r.empty()) {
-            std::string uuid;
+        LOG_INFO("main: Setting up the database...");
 
-            /// Continue untile we can generate a unique UUID
-            while (true) {
-                /// Generate a new UUID
-                CoreLib::Random::Uuid(uuid);
+        auto conn = Service::Pool::Database().Connection();
+        pqxx::work txn(*conn.get());
 
-                /// Query all existing UUIDs in order to avoid a possible duplicate UUID
-                r = txn.exec((boost::format("SELECT user_id FROM \"%1%\" WHERE user_id=%2%;")
-                              % txn.esc(Service::Pool::Database().GetTableName("ROOT"))
-                              % txn.quote(uuid)).str());
+        pqxx::result r;
+
+        /// Get the current date/time
+        CoreLib::CDate::Now n(CoreLib::CDate::Timezone::UTC);
+
+        /// Insert the default root user unless it already exists; the server
+        /// generates its UUID, and nothing comes back if it was there already
+        r = Service::Pool::Database().Upsert(txn,
+                                             "ROOT",
+                                             DATABASE_COLUMNS("user_id, username, email, creation_time"),
+                                             DATABASE_SQL("gen_random_uuid(), ?, ?, TO_TIMESTAMP(?)::TIMESTAMPTZ"),
+                                             "username",
+                                             DATABASE_SQL(""),
+                                             "user_id",
+                                             Service::Pool::Storage().RootUsername(),
+                                             Service::Pool::Storage().RootInitialEmail(),
+                                             n.RawTime());
+
+        /// If the default root user did not exist, set its default password
+        if (!r.empty()) {
+            Service::Pool::Database().InsertReturning(txn,
+                                                      "ROOT_CREDENTIALS",
+                                                      DATABASE_COLUMNS("user_id, pwd"),
+                                                      DATABASE_SQL("?, ?"),
+                                                      "",
+                                                      r[0]["user_id"].c_str(),
+                                                      Service::Pool::Storage().RootInitialPassword());
+        }
 
-                /// Break the loop if the new UUID is not a duplicate
-                if (r.empty()) {
-                    break;
-                }
-            }
+        /// Install the subscriber counter trigger once, and seed the counters in
+        /// the same transaction; CREATE TRIGGER holds off concurrent writes to
+        /// the table until commit, so nothing gets counted twice or missed
+        r = txn.exec((boost::format("SELECT tgname FROM pg_trigger WHERE tgname = %1%;")
+                      % txn.quote(Service::Pool::Database().GetTableName("SUBSCRIBERS_COUNTS") + "_trigger")).str());
 
-            /// Get the current date/time
-            CoreLib::CDate::Now n(CoreLib::CDate::Timezone::UTC);
-
-            /// Insert a new default root user into the database with default password
-            txn.exec((boost::format("INSERT INTO \"%1%\""
-                                    " ( user_id, username, email, creation_time )"
-                                    " VALUES ( %2%, %3%, %4%, TO_TIMESTAMP(%5%)::TIMESTAMPTZ );")
-                      % txn.esc(Service::Pool::Database().GetTableName("ROOT"))
-                      % txn.quote(uuid)
-                      % txn.quote(Service::Pool::Storage().RootUsername())
-                      % txn.quote(Service::Pool::Storage().RootInitialEmail())
-                      % txn.esc(boost::lexical_cast<std::string>(n.RawTime()))).str());
-            Service::Pool::Database().Insert("ROOT_CREDENTIALS",
-                                             "user_id, pwd",
-            {
-                                                 uuid,
-                                                 Service::Pool::Storage().RootInitialPassword()
-                                             });
+        if (r.empty()) {
+            LOG_INFO("main: Installing subscriber counters...");
+
+            const std::string subscribers(txn.esc(Service::Pool::Database().GetTableName("SUBSCRIBERS")));
+            const std::string counts(txn.esc(Service::Pool::Database().GetTableName("SUBSCRIBERS_COUNTS")));
+
+            txn.exec((boost::format("CREATE OR REPLACE FUNCTION \"%2%_update\"() RETURNS TRIGGER AS $body$"
+                                    " BEGIN"
+                                    "   IF TG_OP = 'UPDATE' THEN"
+                                    "     IF OLD.subscription = NEW.subscription THEN"
+                                    "       RETURN NULL;"
+                                    "     END IF;"
+                                    "   END IF;"
+                                    "   IF TG_OP = 'INSERT' OR TG_OP = 'UPDATE' THEN"
+                                    "     INSERT INTO \"%2%\" ( subscription, total ) VALUES ( NEW.subscription, 1 )"
+                                    "       ON CONFLICT ( subscription ) DO UPDATE SET total = \"%2%\".total + 1;"
+                                    "   END IF;"
+                                    "   IF TG_OP = 'UPDATE' OR TG_OP = 'DELETE' THEN"
+                                    "     UPDATE \"%2%\" SET total = total - 1 WHERE subscription = OLD.subscription;"
+                                    "   END IF;"
+                                    "   RETURN NULL;"
+                                    " END;"
+                                    " $body$ LANGUAGE plpgsql;")
+                      % subscribers % counts).str());
+
+            txn.exec((boost::format("CREATE TRIGGER \"%2%_trigger\""
+                                    " AFTER INSERT OR DELETE OR UPDATE OF subscription ON \"%1%\""
+                                    " FOR EACH ROW EXECUTE PROCEDURE \"%2%_update\"();")
+                      % subscribers % counts).str());
+
+            txn.exec((boost::format("DELETE FROM \"%1%\";") % counts).str());
+            txn.exec((boost::format("INSERT INTO \"%2%\" ( subscription, total )"
+                                    " SELECT subscription, count(*) FROM \"%1%\" GROUP BY subscription;")
+                      % subscribers % counts).str());
         }
 
-        txn.commit();
+        Service::Pool::Database().Commit(txn, "ROOT");
 
         LOG_INFO("main: Database setup is complete!");
 
@@ -459,3 +751,119 @@ void InitializeDatabase()
         LOG_ERROR("Unknown error!");
     }
 }
+
+void UpgradeDatabaseToVersion2(pqxx::transaction_base &txn)
+{
+    /// Version 2 moved the per-row location columns into GEO_SNAPSHOTS; the
+    /// legacy rows get their snapshot ids the same way the application does,
+    /// so a legacy location and a fresh one of the same place share a row
+    static const std::vector<std::string> GEO_COLUMNS {
+        "country_code", "country_code3", "country_name",
+        "region", "city", "postal_code",
+        "latitude", "longitude",
+        "metro_code", "dma_code", "area_code",
+        "charset", "continent_code",
+        "netmask", "asn", "aso",
+        "raw_data"
+    };
+
+    const std::string snapshots(txn.esc(Service::Pool::Database().GetTableName("GEO_SNAPSHOTS")));
+
+    /// Missing numbers take the defaults the application falls back to
+    const auto toNumber = [](const pqxx::field &field, auto &out_number, const auto fallback) {
+        out_number = fallback;
+        if (!field.is_null() && field.size() > 0) {
+            try {
+                out_number = boost::lexical_cast<std::decay_t<decltype(out_number)>>(field.c_str());
+            } catch (const boost::bad_lexical_cast &) {
+            }
+        }
+    };
+
+    const auto moveGeoColumns = [&txn, &snapshots, &toNumber](const std::string &tableId,
+            const std::string &prefix, const std::string &snapshotColumn) {
+        const std::string table(txn.esc(Service::Pool::Database().GetTableName(tableId)));
+
+        std::vector<std::string> legacy;
+        std::vector<std::string> texts;
+        for (const auto &c : GEO_COLUMNS) {
+            legacy.push_back(prefix + c);
+            /// Recovery rows used to keep the numbers as text
+            texts.push_back((boost::format("%1%%2%::TEXT AS %2%") % prefix % c).str());
+        }
+
+        const std::string row(boost::algorithm::join(legacy, ", "));
+
+        txn.exec((boost::format("ALTER TABLE \"%1%\" ADD COLUMN IF NOT EXISTS %2% UUID;")
+                  % table % snapshotColumn).str());
+
+        txn.exec("CREATE TEMPORARY TABLE IF NOT EXISTS geo_snapshot_ids"
+                 " ( row_key TEXT NOT NULL PRIMARY KEY, snapshot_id UUID NOT NULL ) ON COMMIT DROP;");
+        txn.exec("TRUNCATE geo_snapshot_ids;");
+
+        pqxx::result r = txn.exec((boost::format("SELECT DISTINCT ON ( row_key ) MD5 ( ROW ( %2% )::TEXT ) AS row_key, %3%"
+                                                 " FROM \"%1%\" WHERE NOT ( ROW ( %2% ) IS NULL );")
+                                   % table % row % boost::algorithm::join(texts, ", ")).str());
+
+        {
+            CoreLib::Database::Pipeline pipeline(txn);
+
+            for (const auto &legacyRow : r) {
+                Service::CgiEnv::InformationRecord::ClientRecord::GeoLocationRecord geo;
+                geo.CountryCode = legacyRow["country_code"].c_str();
+                geo.CountryCode3 = legacyRow["country_code3"].c_str();
+                geo.CountryName = legacyRow["country_name"].c_str();
+                geo.Region = legacyRow["region"].c_str();
+                geo.City = legacyRow["city"].c_str();
+                geo.PostalCode = legacyRow["postal_code"].c_str();
+                toNumber(legacyRow["latitude"], geo.Latitude, 0.0f);
+                toNumber(legacyRow["longitude"], geo.Longitude, 0.0f);
+                toNumber(legacyRow["metro_code"], geo.MetroCode, -1);
+                toNumber(legacyRow["dma_code"], geo.DmaCode, -1);
+                toNumber(legacyRow["area_code"], geo.AreaCode, -1);
+                toNumber(legacyRow["charset"], geo.Charset, -1);
+                geo.ContinentCode = legacyRow["continent_code"].c_str();
+                toNumber(legacyRow["netmask"], geo.Netmask, -1);
+                toNumber(legacyRow["asn"], geo.ASN, -1);
+                geo.ASO = legacyRow["aso"].c_str();
+                geo.RawData = legacyRow["raw_data"].c_str();
+
+                std::vector<std::string> values;
+                if (!geo.ToSnapshot(values)) {
+                    throw std::runtime_error("Failed to hash a legacy geo-location!");
+                }
+
+                pipeline.Queue((boost::format("INSERT INTO geo_snapshot_ids ( row_key, snapshot_id )"
+                                              " VALUES ( %1%, %2% );")
+                                % txn.quote(legacyRow["row_key"].c_str())
+                                % txn.quote(values[0])).str());
+
+                for (auto &v : values) {
+                    v = txn.quote(v);
+                }
+
+                pipeline.Queue((boost::format("INSERT INTO \"%1%\" ( snapshot_id, %2% ) VALUES ( %3% )"
+                                              " ON CONFLICT DO NOTHING;")
+                                % snapshots
+                                % boost::algorithm::join(GEO_COLUMNS, ", ")
+                                % boost::algorithm::join(values, ", ")).str());
+            }
+
+            pipeline.Complete();
+        }
+
+        txn.exec((boost::format("UPDATE \"%1%\" SET %2% = m.snapshot_id FROM geo_snapshot_ids m"
+                                " WHERE m.row_key = MD5 ( ROW ( %3% )::TEXT );")
+                  % table % snapshotColumn % row).str());
+
+        txn.exec((boost::format("ALTER TABLE \"%1%\" DROP COLUMN IF EXISTS %2%;")
+                  % table % boost::algorithm::join(legacy, ", DROP COLUMN IF EXISTS ")).str());
+    };
+
+    moveGeoColumns("ROOT_SESSIONS", "location_", "geo_snapshot_id");
+    moveGeoColumns("ROOT_CREDENTIALS_RECOVERY", "request_location_", "request_geo_snapshot_id");
+    moveGeoColumns("ROOT_CREDENTIALS_RECOVERY", "utilization_location_", "utilization_geo_snapshot_id");
+
+    txn.exec((boost::format("UPDATE \"%1%\" SET version = 2;")
+              % txn.esc(Service::Pool::Database().GetTableName("VERSION"))).str());
+}
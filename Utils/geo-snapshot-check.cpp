@@ -0,0 +1,148 @@
+/**
+ * @file
+ * @author  Mamadou Babaei <info@babaei.net>
+ * @version 0.1.0
+ *
+ * @section LICENSE
+ *
+ * (The MIT License)
+ *
+ * Copyright (c) 2016 - 2021 Mamadou Babaei
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * Checks the GEO_SNAPSHOTS rows built out of geo-location records, most of
+ * all the one for a failed lookup, which must still be accepted by COPY.
+ * Exits with a non-zero status on the first failed check.
+ * Usage: geo-snapshot-check
+ */
+
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <boost/exception/diagnostic_information.hpp>
+#include <boost/regex.hpp>
+#include <CoreLib/Exception.hpp>
+#include <Service/CgiEnv.hpp>
+
+#define     UNKNOWN_ERROR           "Unknown error!"
+
+/// snapshot_id plus the GEO_SNAPSHOTS columns
+const std::size_t SNAPSHOT_COLUMNS = 18;
+
+typedef Service::CgiEnv::InformationRecord::ClientRecord::GeoLocationRecord GeoLocationRecord;
+
+GeoLocationRecord EmptyRecord();
+bool Check(const bool condition, const std::string &what);
+
+int main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    try {
+        bool passed = true;
+
+        /// What CgiEnv leaves behind when the lookup throws
+        const GeoLocationRecord empty(EmptyRecord());
+
+        std::vector<std::string> values;
+        passed &= Check(empty.ToSnapshot(values), "an empty record can be snapshotted");
+        passed &= Check(values.size() == SNAPSHOT_COLUMNS, "an empty record fills every column");
+
+        if (values.size() == SNAPSHOT_COLUMNS) {
+            passed &= Check(boost::regex_match(values.front(),
+                                               boost::regex("[0-9a-f]{8}-[0-9a-f]{4}-[0-9a-f]{4}-[0-9a-f]{4}-[0-9a-f]{12}")),
+                            "an empty record gets a well-formed snapshot id");
+            passed &= Check(values.back() == "{}", "an empty record carries valid JSON raw data");
+
+            std::vector<std::string> again;
+            empty.ToSnapshot(again);
+            passed &= Check(again == values, "equal records share one snapshot");
+        }
+
+        GeoLocationRecord located(EmptyRecord());
+        located.CountryCode = "NL";
+        located.City = "Amsterdam";
+        located.RawData = "{\"country\":{\"iso_code\":\"NL\"}}";
+
+        std::vector<std::string> locatedValues;
+        passed &= Check(located.ToSnapshot(locatedValues), "a located record can be snapshotted");
+
+        if (locatedValues.size() == SNAPSHOT_COLUMNS && values.size() == SNAPSHOT_COLUMNS) {
+            passed &= Check(locatedValues.back() == located.RawData, "raw data is kept as is");
+            passed &= Check(locatedValues.front() != values.front(), "different records get different snapshots");
+        }
+
+        if (!passed) {
+            return EXIT_FAILURE;
+        }
+
+        std::cout << "All checks passed." << std::endl;
+    }
+
+    catch (CoreLib::Exception<std::string> &ex) {
+        std::cerr << ex.What() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    catch (boost::exception &ex) {
+        std::cerr << boost::diagnostic_information(ex) << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    catch (std::exception &ex) {
+        std::cerr << ex.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    catch (...) {
+        std::cerr << UNKNOWN_ERROR << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+GeoLocationRecord EmptyRecord()
+{
+    GeoLocationRecord record;
+
+    record.Latitude = 0.0f;
+    record.Longitude = 0.0f;
+    record.MetroCode = -1;
+    record.DmaCode = -1;
+    record.AreaCode = -1;
+    record.Charset = -1;
+    record.Netmask = -1;
+    record.ASN = -1;
+
+    return record;
+}
+
+bool Check(const bool condition, const std::string &what)
+{
+    std::cout << (condition ? "[PASS] " : "[FAIL] ") << what << std::endl;
+    return condition;
+}
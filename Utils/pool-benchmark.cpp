@@ -0,0 +1,176 @@
+/**
+ * @file
+ * @author  Mamadou Babaei <info@babaei.net>
+ * @version 0.1.0
+ *
+ * @section LICENSE
+ *
+ * (The MIT License)
+ *
+ * Copyright (c) 2016 - 2021 Mamadou Babaei
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * A micro-benchmark which compares the mutex based SharedObjectPool against
+ * the lock-free LockFreeObjectPool under 1 to 64 threads hammering the same
+ * pool with acquire/release pairs.
+ * Usage: pool-benchmark [objects] [iterations-per-thread]
+ */
+
+
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <boost/chrono/duration.hpp>
+#include <boost/exception/diagnostic_information.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/barrier.hpp>
+#include <boost/thread/thread.hpp>
+#include <CoreLib/Exception.hpp>
+#include <CoreLib/LockFreeObjectPool.hpp>
+#include <CoreLib/SharedObjectPool.hpp>
+#include <CoreLib/Stopwatch.hpp>
+
+#define     UNKNOWN_ERROR           "Unknown error!"
+
+const std::size_t DEFAULT_OBJECTS = 16;
+const std::size_t DEFAULT_ITERATIONS = 100000;
+const std::size_t MAX_THREADS = 64;
+const boost::chrono::milliseconds ACQUIRE_TIMEOUT(60000);
+
+struct Payload
+{
+    std::size_t Uses;
+};
+
+template <typename _Pool>
+double Run(_Pool &pool, const std::size_t threads, const std::size_t iterations);
+
+void Report(const std::string &name, const std::size_t threads,
+            const std::size_t iterations, const double elapsed);
+
+int main(int argc, char **argv)
+{
+    try {
+        const std::size_t objects = argc > 1
+                ? boost::lexical_cast<std::size_t>(argv[1]) : DEFAULT_OBJECTS;
+        const std::size_t iterations = argc > 2
+                ? boost::lexical_cast<std::size_t>(argv[2]) : DEFAULT_ITERATIONS;
+
+        std::cout << "Objects: " << objects << ", iterations per thread: " << iterations
+                  << std::endl << std::endl;
+        std::cout << std::left << std::setw(12) << "pool" << std::right
+                  << std::setw(10) << "threads"
+                  << std::setw(16) << "ops/s"
+                  << std::setw(12) << "ns/op" << std::endl;
+
+        for (std::size_t threads = 1; threads <= MAX_THREADS; threads *= 2) {
+            {
+                CoreLib::SharedObjectPool<Payload> pool;
+                pool.SetLimits(objects, objects);
+                for (std::size_t i = 0; i < objects; ++i) {
+                    std::unique_ptr<Payload> payload(new Payload{0});
+                    pool.Add(payload);
+                }
+
+                Report("shared", threads, iterations, Run(pool, threads, iterations));
+            }
+
+            {
+                CoreLib::LockFreeObjectPool<Payload> pool(objects);
+                for (std::size_t i = 0; i < objects; ++i) {
+                    std::unique_ptr<Payload> payload(new Payload{0});
+                    pool.Add(payload);
+                }
+
+                Report("lock-free", threads, iterations, Run(pool, threads, iterations));
+            }
+        }
+    }
+
+    catch (CoreLib::Exception<std::string> &ex) {
+        std::cerr << ex.What() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    catch (boost::exception &ex) {
+        std::cerr << boost::diagnostic_information(ex) << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    catch (std::exception &ex) {
+        std::cerr << ex.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    catch (...) {
+        std::cerr << UNKNOWN_ERROR << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+template <typename _Pool>
+double Run(_Pool &pool, const std::size_t threads, const std::size_t iterations)
+{
+    /// The clock starts once every thread is up and before any of them may
+    /// proceed, so thread creation stays out of the measurement.
+    boost::barrier ready(static_cast<unsigned int>(threads + 1));
+    boost::barrier start(static_cast<unsigned int>(threads + 1));
+    boost::thread_group group;
+
+    for (std::size_t t = 0; t < threads; ++t) {
+        group.create_thread([&pool, &ready, &start, iterations]() {
+            ready.wait();
+            start.wait();
+
+            for (std::size_t i = 0; i < iterations; ++i) {
+                auto payload(pool.Acquire(ACQUIRE_TIMEOUT));
+                ++payload->Uses;
+            }
+        });
+    }
+
+    ready.wait();
+    CoreLib::Stopwatch<> stopwatch;
+    start.wait();
+    group.join_all();
+
+    return stopwatch.Stop();
+}
+
+void Report(const std::string &name, const std::size_t threads,
+            const std::size_t iterations, const double elapsed)
+{
+    const double operations = static_cast<double>(threads * iterations);
+    const double seconds = elapsed / 1000000.0;
+
+    std::cout << std::left << std::setw(12) << name << std::right
+              << std::setw(10) << threads
+              << std::setw(16) << std::fixed << std::setprecision(0) << operations / seconds
+              << std::setw(12) << std::setprecision(1) << elapsed * 1000.0 / operations
+              << std::endl;
+}